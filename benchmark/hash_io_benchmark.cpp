@@ -0,0 +1,183 @@
+// *****************************************************************************
+// Hash I/O Benchmark
+// Compares the FileReader modes against the former 256 MiB filebuf reader by
+// MD5-hashing the given files or directory trees with each of them.
+//
+// Usage: hash_io_benchmark [--warm] <file|directory>...
+//   --warm  keep the files in the page cache between runs instead of dropping them
+// *****************************************************************************
+
+// Section 1: Includes
+// C++ Standard Library
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// System Includes
+#include <fcntl.h>
+#include <unistd.h>
+
+// Project Includes
+#include "file_reader.h"
+#include <md5.h>
+
+// Section 2: Defines and Macros
+#define LEGACY_BUFFERSIZE (256 * 1024 * 1024)
+
+// Section 3: Helpers
+namespace {
+
+struct RunResult
+{
+    double seconds;
+    uint64_t bytes;
+    std::vector<std::string> digests;
+};
+
+std::string toHex(const uint8_t *digest)
+{
+    std::ostringstream hex;
+    for ( int i = 0; i < MD5_DIGEST_LENGTH; ++i )
+        hex << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(digest[i]);
+    return hex.str();
+}
+
+void dropFromPageCache(const std::filesystem::path &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if ( fd < 0 )
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// what MD5Calculator did before FileReader: a fresh 256 MiB buffer per file, read through std::filebuf
+std::string legacyDigest(const std::filesystem::path &path, uint64_t &bytes)
+{
+    uintmax_t filesize = std::filesystem::file_size(path);
+    std::filebuf filebuf;
+    if ( filebuf.open(path, std::ios::binary | std::ios::in) == nullptr )
+        return {};
+
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    auto *buffer = new uint8_t[LEGACY_BUFFERSIZE];
+    while ( filesize != 0 )
+    {
+        const size_t buffersize = std::min<uintmax_t>(filesize, LEGACY_BUFFERSIZE);
+        const auto dataread = filebuf.sgetn(reinterpret_cast<char *>(buffer), static_cast<std::streamsize>(buffersize));
+        if ( dataread <= 0 )
+            break;
+        MD5Update(&ctx, buffer, static_cast<size_t>(dataread));
+        filesize -= static_cast<uintmax_t>(dataread);
+        bytes += static_cast<uint64_t>(dataread);
+    }
+    delete[] buffer;
+
+    uint8_t digest[MD5_DIGEST_LENGTH];
+    MD5Final(digest, &ctx);
+    return toHex(digest);
+}
+
+std::string readerDigest(const std::filesystem::path &path, FileReader::Mode mode, uint64_t &bytes)
+{
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    const int result = FileReader::read(path.c_str(), mode, [&](const uint8_t *data, size_t size) {
+        MD5Update(&ctx, data, size);
+        bytes += size;
+    });
+    if ( result != 0 )
+        return {};
+
+    uint8_t digest[MD5_DIGEST_LENGTH];
+    MD5Final(digest, &ctx);
+    return toHex(digest);
+}
+
+template <typename DigestFunction>
+RunResult run(const std::vector<std::filesystem::path> &files, bool warm, DigestFunction digestFunction)
+{
+    if ( !warm )
+    {
+        for ( const auto &file : files )
+            dropFromPageCache(file);
+    }
+
+    RunResult result{ .seconds = 0, .bytes = 0, .digests = {} };
+    result.digests.reserve(files.size());
+    const auto start = std::chrono::steady_clock::now();
+    for ( const auto &file : files )
+        result.digests.push_back(digestFunction(file, result.bytes));
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+} // namespace
+
+// Section 4: Main
+int main(int argc, char *argv[])
+{
+    bool warm = false;
+    std::vector<std::filesystem::path> files;
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp(argv[i], "--warm") == 0 )
+        {
+            warm = true;
+            continue;
+        }
+
+        const std::filesystem::path path(argv[i]);
+        if ( std::filesystem::is_directory(path) )
+        {
+            for ( const auto &entry : std::filesystem::recursive_directory_iterator(path) )
+            {
+                if ( entry.is_regular_file() )
+                    files.push_back(entry.path());
+            }
+        }
+        else if ( std::filesystem::is_regular_file(path) )
+            files.push_back(path);
+    }
+
+    if ( files.empty() )
+    {
+        std::cout << "Usage: hash_io_benchmark [--warm] <file|directory>..." << "\r\n";
+        return 1;
+    }
+
+    struct Candidate
+    {
+        const char *name;
+        RunResult result;
+    };
+    std::vector<Candidate> candidates;
+    candidates.push_back({ "legacy filebuf", run(files, warm, legacyDigest) });
+    candidates.push_back({ "buffered", run(files, warm, [](const auto &path, uint64_t &bytes) { return readerDigest(path, FileReader::Mode::BUFFERED, bytes); }) });
+    candidates.push_back({ "direct", run(files, warm, [](const auto &path, uint64_t &bytes) { return readerDigest(path, FileReader::Mode::DIRECT, bytes); }) });
+    candidates.push_back({ "mmap", run(files, warm, [](const auto &path, uint64_t &bytes) { return readerDigest(path, FileReader::Mode::MMAP, bytes); }) });
+
+    std::cout << files.size() << " files, " << (warm ? "warm" : "cold") << " page cache" << "\r\n";
+    std::cout << std::left << std::setw(16) << "mode" << std::right << std::setw(12) << "seconds" << std::setw(12) << "MiB/s" << "  digests" << "\r\n";
+    for ( const auto &candidate : candidates )
+    {
+        const double mebibytes = static_cast<double>(candidate.result.bytes) / (1024.0 * 1024.0);
+        const bool match = candidate.result.digests == candidates.front().result.digests;
+        std::cout << std::left << std::setw(16) << candidate.name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(12) << candidate.result.seconds << std::setprecision(1)
+                  << std::setw(12) << (candidate.result.seconds > 0 ? mebibytes / candidate.result.seconds : 0.0)
+                  << "  " << (match ? "match" : "MISMATCH") << "\r\n";
+    }
+    return 0;
+}
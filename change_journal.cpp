@@ -0,0 +1,566 @@
+// Section 1: Main Header
+#include "change_journal.h"
+
+// Section 2: Includes
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "directory_indexer.h"
+
+// Third-Party Includes
+#include "termcolor/termcolor.hpp"
+
+// Section 3: Defines and Macros
+constexpr const char *CHANGE_JOURNAL_NAME = ".folderindex.journal";
+constexpr const char *CHANGE_JOURNAL_LOCK_NAME = ".folderindex.journal.lock";
+constexpr const char *CHANGE_JOURNAL_BARRIER_NAME = ".folderindex.journal.barrier";
+constexpr const char *CHANGE_JOURNAL_SNAPSHOT_NAME = ".folderindex.scan";
+constexpr uint32_t CHANGE_JOURNAL_WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                               IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+constexpr int CHANGE_JOURNAL_POLL_MS = 200;
+constexpr auto CHANGE_JOURNAL_FLUSH_INTERVAL = std::chrono::seconds(1);
+constexpr auto CHANGE_JOURNAL_BARRIER_POLL_INTERVAL = std::chrono::milliseconds(2);
+
+// Section 4: Static Variables
+// (none)
+
+// Section 5: Helpers
+namespace {
+
+std::string joinPath(const std::string &directory, const std::string &name)
+{
+    return directory.empty() ? name : directory + "/" + name;
+}
+
+void appendRecord(std::string &records, char type, const std::string &value)
+{
+    records += type;
+    records += value;
+    records += '\0';
+}
+
+bool readAll(int fd, std::string &content)
+{
+    content.clear();
+    char buffer[64 * 1024];
+    off_t offset = 0;
+    while ( true )
+    {
+        const ssize_t bytesRead = pread(fd, buffer, sizeof(buffer), offset);
+        if ( bytesRead < 0 && errno == EINTR )
+            continue;
+        if ( bytesRead < 0 )
+            return false;
+        if ( bytesRead == 0 )
+            return true;
+        content.append(buffer, static_cast<size_t>(bytesRead));
+        offset += bytesRead;
+    }
+}
+
+bool writeAll(int fd, const std::string &content, off_t offset)
+{
+    size_t written = 0;
+    while ( written < content.size() )
+    {
+        const ssize_t result = offset < 0 ? write(fd, content.data() + written, content.size() - written)
+                                          : pwrite(fd, content.data() + written, content.size() - written,
+                                                   offset + static_cast<off_t>(written));
+        if ( result < 0 && errno == EINTR )
+            continue;
+        if ( result <= 0 )
+            return false;
+        written += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+/**
+ * Replaces the content of a file.
+ * Written over and cut to size rather than truncated first: ext4 flushes a
+ * file truncated to zero on close, which costs tens of milliseconds.
+ */
+bool replaceAll(int fd, const std::string &content)
+{
+    return writeAll(fd, content, 0) && ftruncate(fd, static_cast<off_t>(content.size())) == 0;
+}
+
+std::string uniqueToken()
+{
+    static std::atomic<uint64_t> counter{0};
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::to_string(getpid()) + "." + std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()) +
+           "." + std::to_string(counter.fetch_add(1));
+}
+
+/**
+ * Journal file opened and flocked for the lifetime of the object
+ */
+class JournalFile
+{
+public:
+    JournalFile(const std::filesystem::path &path, int flags, int operation) :
+        mFd(open(path.c_str(), flags | O_CLOEXEC, 0600))
+    {
+        if ( mFd >= 0 && flock(mFd, operation) != 0 )
+        {
+            close(mFd);
+            mFd = -1;
+        }
+    }
+    ~JournalFile() { if ( mFd >= 0 ) close(mFd); }
+    JournalFile(const JournalFile&) = delete;
+    JournalFile& operator=(const JournalFile&) = delete;
+    int fd() const { return mFd; }
+
+private:
+    int mFd;
+};
+
+} // namespace
+
+// Section 6: Constructors and Destructors
+ChangeJournal::ChangeJournal(const std::filesystem::path &root) :
+    mRoot( root ),
+    mInotifyFd( -1 ),
+    mLockFd( -1 ),
+    mQuit( false ),
+    mIncomplete( false ),
+    mPendingRescan( false )
+{
+}
+
+ChangeJournal::~ChangeJournal()
+{
+    stop();
+}
+
+// Section 7: Static Methods
+std::filesystem::path ChangeJournal::snapshotPath(const std::filesystem::path &root)
+{
+    return root / CHANGE_JOURNAL_SNAPSHOT_NAME;
+}
+
+bool ChangeJournal::isJournalFile(const std::string &name)
+{
+    return name == CHANGE_JOURNAL_NAME || name == CHANGE_JOURNAL_LOCK_NAME || name == CHANGE_JOURNAL_BARRIER_NAME ||
+           name == CHANGE_JOURNAL_SNAPSHOT_NAME;
+}
+
+ChangeJournal::Changes ChangeJournal::read(const std::filesystem::path &root)
+{
+    Changes changes;
+    changes.root = root.string();
+
+    // the watcher holds the lock for as long as it runs and keeps its session in it
+    {
+        const int lockFd = open((root / CHANGE_JOURNAL_LOCK_NAME).c_str(), O_RDONLY | O_CLOEXEC);
+        if ( lockFd < 0 )
+            return changes;
+        if ( flock(lockFd, LOCK_SH | LOCK_NB) == 0 )
+        {
+            close(lockFd);
+            return changes;
+        }
+        readAll(lockFd, changes.session);
+        close(lockFd);
+    }
+    if ( changes.session.empty() )
+        return changes;
+
+    // events are queued in order, once the watcher journals the barrier it has journaled everything before it
+    const std::string token = uniqueToken();
+    {
+        const int barrierFd = open((root / CHANGE_JOURNAL_BARRIER_NAME).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+        if ( barrierFd < 0 )
+            return changes;
+        const bool written = replaceAll(barrierFd, token);
+        close(barrierFd);
+        if ( !written )
+            return changes;
+    }
+
+    std::string header;
+    appendRecord(header, 'W', changes.session);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CHANGE_JOURNAL_BARRIER_TIMEOUT_MS);
+    while ( true )
+    {
+        std::string content;
+        {
+            const JournalFile journal(root / CHANGE_JOURNAL_NAME, O_RDONLY, LOCK_SH);
+            if ( journal.fd() < 0 || !readAll(journal.fd(), content) )
+                return changes;
+        }
+        // a journal of another session is being reset by a watcher that just started
+        if ( !content.starts_with(header) )
+            return changes;
+        changes.watched = true;
+
+        bool rescan = false;
+        bool barrier = false;
+        std::unordered_set<std::string> directories;
+        std::unordered_set<std::string> subtrees;
+        size_t offset = header.size();
+        while ( offset < content.size() )
+        {
+            const size_t end = content.find('\0', offset);
+            if ( end == std::string::npos )
+                break;
+            const std::string value = content.substr(offset + 1, end - offset - 1);
+            switch ( content[offset] )
+            {
+                case 'R': rescan = true; break;
+                case 'D': directories.insert(value); break;
+                case 'S': subtrees.insert(value); break;
+                case 'B': barrier = barrier || value == token; break;
+                default: rescan = true; break;
+            }
+            offset = end + 1;
+        }
+        changes.consumed = offset;
+
+        if ( barrier )
+        {
+            changes.rescan = rescan;
+            changes.directories.swap(directories);
+            changes.subtrees.swap(subtrees);
+            break;
+        }
+        if ( std::chrono::steady_clock::now() > deadline )
+        {
+            std::cout << termcolor::yellow << "Change watcher of " << root << " did not answer, indexing everything" << termcolor::reset << "\r\n";
+            return changes;
+        }
+        std::this_thread::sleep_for(CHANGE_JOURNAL_BARRIER_POLL_INTERVAL);
+    }
+
+    if ( changes.rescan )
+        return changes;
+
+    for ( const auto *changed : { &changes.directories, &changes.subtrees } )
+    {
+        for ( std::string directory : *changed )
+        {
+            while ( !directory.empty() )
+            {
+                const size_t slash = directory.rfind('/');
+                directory.resize(slash == std::string::npos ? 0 : slash);
+                if ( !changes.ancestors.insert(directory).second )
+                    break;
+            }
+        }
+    }
+    return changes;
+}
+
+void ChangeJournal::release(const Changes &changes)
+{
+    if ( !changes.watched || changes.consumed == 0 )
+        return;
+
+    const JournalFile journal(std::filesystem::path(changes.root) / CHANGE_JOURNAL_NAME, O_RDWR, LOCK_EX);
+    std::string content;
+    if ( journal.fd() < 0 || !readAll(journal.fd(), content) )
+        return;
+
+    // only drop records of the session they were read from, a restarted watcher begins a journal of its own
+    std::string header;
+    appendRecord(header, 'W', changes.session);
+    if ( !content.starts_with(header) || content.size() < changes.consumed )
+        return;
+
+    content.erase(header.size(), changes.consumed - header.size());
+    if ( !replaceAll(journal.fd(), content) )
+        std::cerr << "Failed to trim change journal of " << changes.root << ": " << strerror(errno) << "\r\n";
+}
+
+// Section 8: Public/Protected/Private Methods
+bool ChangeJournal::Changes::needsWalk(const std::filesystem::path &directory) const
+{
+    if ( rescan )
+        return true;
+
+    const std::string &path = directory.string();
+    if ( path.size() <= root.size() || !path.starts_with(root) || path[root.size()] != '/' )
+        return true;
+
+    std::string relative = path.substr(root.size() + 1);
+    if ( directories.contains(relative) || ancestors.contains(relative) )
+        return true;
+
+    // inside a tree that appeared while watched, nothing below it was ever listed
+    while ( !subtrees.empty() )
+    {
+        if ( subtrees.contains(relative) )
+            return true;
+        const size_t slash = relative.rfind('/');
+        if ( slash == std::string::npos )
+            break;
+        relative.resize(slash);
+    }
+    return false;
+}
+
+bool ChangeJournal::start()
+{
+    mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ( mInotifyFd < 0 )
+    {
+        std::cout << termcolor::red << "Cannot watch " << mRoot << " for changes: " << strerror(errno) << termcolor::reset << "\r\n";
+        return false;
+    }
+
+    mLockFd = open((mRoot / CHANGE_JOURNAL_LOCK_NAME).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if ( mLockFd < 0 || flock(mLockFd, LOCK_EX | LOCK_NB) != 0 )
+    {
+        std::cout << termcolor::red << "Cannot watch " << mRoot << " for changes, another watcher is running" << termcolor::reset << "\r\n";
+        stop();
+        return false;
+    }
+
+    // a new session starts with a rescan: whatever happened while nobody watched is unknown
+    mSession = uniqueToken();
+    if ( !replaceAll(mLockFd, mSession) )
+    {
+        std::cout << termcolor::red << "Cannot write " << (mRoot / CHANGE_JOURNAL_LOCK_NAME) << ": " << strerror(errno) << termcolor::reset << "\r\n";
+        stop();
+        return false;
+    }
+    {
+        const JournalFile journal(mRoot / CHANGE_JOURNAL_NAME, O_WRONLY | O_CREAT, LOCK_EX);
+        std::string records;
+        appendRecord(records, 'W', mSession);
+        appendRecord(records, 'R', "");
+        if ( journal.fd() < 0 || !replaceAll(journal.fd(), records) )
+        {
+            std::cout << termcolor::red << "Cannot write " << (mRoot / CHANGE_JOURNAL_NAME) << ": " << strerror(errno) << termcolor::reset << "\r\n";
+            stop();
+            return false;
+        }
+    }
+
+    // and so do directories listed before their watch was in place
+    addWatches("");
+    mPendingRescan = true;
+    flush();
+
+    mQuit = false;
+    mThread = std::thread(&ChangeJournal::watchLoop, this);
+    return true;
+}
+
+void ChangeJournal::stop()
+{
+    mQuit = true;
+    if ( mThread.joinable() )
+        mThread.join();
+    if ( mInotifyFd >= 0 )
+        close(mInotifyFd);
+    if ( mLockFd >= 0 )
+        close(mLockFd);
+    mInotifyFd = -1;
+    mLockFd = -1;
+    mWatches.clear();
+}
+
+void ChangeJournal::watchLoop()
+{
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    auto lastFlush = std::chrono::steady_clock::now();
+    while ( !mQuit )
+    {
+        pollfd pollFd{ .fd = mInotifyFd, .events = POLLIN, .revents = 0 };
+        const int ready = poll(&pollFd, 1, CHANGE_JOURNAL_POLL_MS);
+        if ( ready > 0 )
+        {
+            ssize_t bytesRead;
+            while ( (bytesRead = ::read(mInotifyFd, buffer, sizeof(buffer))) > 0 )
+                handleEvents(buffer, static_cast<size_t>(bytesRead));
+        }
+
+        // quiet or a reader waiting on a barrier: write out what piled up
+        const auto now = std::chrono::steady_clock::now();
+        if ( ready == 0 || !mPendingBarriers.empty() || now - lastFlush >= CHANGE_JOURNAL_FLUSH_INTERVAL )
+        {
+            flush();
+            lastFlush = now;
+        }
+    }
+    flush();
+}
+
+void ChangeJournal::handleEvents(const char *buffer, size_t size)
+{
+    size_t offset = 0;
+    while ( offset < size )
+    {
+        const auto *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+        offset += sizeof(struct inotify_event) + event->len;
+
+        if ( event->mask & IN_Q_OVERFLOW )
+        {
+            mPendingRescan = true;
+            continue;
+        }
+        const auto watch = mWatches.find(event->wd);
+        if ( watch == mWatches.end() )
+            continue;
+        if ( event->mask & IN_IGNORED )
+        {
+            mWatches.erase(watch);
+            continue;
+        }
+        // events of the directory itself are reported to its parent as well
+        if ( event->len == 0 )
+            continue;
+
+        const std::string directory = watch->second;
+        const std::string name = event->name;
+        if ( directory.empty() && name == CHANGE_JOURNAL_BARRIER_NAME )
+        {
+            if ( event->mask & IN_CLOSE_WRITE )
+            {
+                const int barrierFd = open((mRoot / CHANGE_JOURNAL_BARRIER_NAME).c_str(), O_RDONLY | O_CLOEXEC);
+                std::string token;
+                if ( barrierFd >= 0 && readAll(barrierFd, token) && !token.empty() )
+                    mPendingBarriers.push_back(token);
+                if ( barrierFd >= 0 )
+                    close(barrierFd);
+            }
+            continue;
+        }
+        if ( DirectoryIndexer::isIndexFile(name) )
+            continue;
+
+        const std::string path = joinPath(directory, name);
+        if ( event->mask & IN_ISDIR )
+        {
+            if ( event->mask & (IN_MOVED_FROM | IN_DELETE) )
+                removeWatches(path);
+            // watched before it is journaled, so a reader never walks a tree whose changes could go unseen
+            if ( event->mask & (IN_CREATE | IN_MOVED_TO) )
+            {
+                addWatches(path);
+                mPendingSubtrees.insert(path);
+            }
+        }
+        mPendingDirectories.insert(directory);
+    }
+}
+
+void ChangeJournal::addWatches(const std::string &directory)
+{
+    std::vector<std::string> pending{ directory };
+    while ( !pending.empty() )
+    {
+        const std::string current = std::move(pending.back());
+        pending.pop_back();
+
+        const int watch = inotify_add_watch(mInotifyFd, absolute(current).c_str(), CHANGE_JOURNAL_WATCH_MASK);
+        if ( watch < 0 )
+        {
+            // gone already, its parent's events tell
+            if ( errno == ENOENT || errno == ENOTDIR )
+                continue;
+            if ( !mIncomplete )
+            {
+                std::cout << termcolor::yellow << "Cannot watch " << absolute(current) << ": " << strerror(errno)
+                          << (errno == ENOSPC ? ", raise fs.inotify.max_user_watches" : "")
+                          << ", indexing walks everything until the watcher restarts" << termcolor::reset << "\r\n";
+                // an empty session makes every reader walk everything
+                if ( ftruncate(mLockFd, 0) != 0 )
+                    std::cerr << "Failed to reset " << (mRoot / CHANGE_JOURNAL_LOCK_NAME) << "\r\n";
+            }
+            mIncomplete = true;
+            continue;
+        }
+        mWatches[watch] = current;
+
+        std::error_code errorCode;
+        std::filesystem::directory_iterator entries(absolute(current), errorCode);
+        for ( ; !errorCode && entries != std::filesystem::directory_iterator(); entries.increment(errorCode) )
+        {
+            std::error_code typeError;
+            if ( entries->symlink_status(typeError).type() == std::filesystem::file_type::directory )
+                pending.push_back(joinPath(current, entries->path().filename().string()));
+        }
+    }
+}
+
+void ChangeJournal::removeWatches(const std::string &directory)
+{
+    const std::string prefix = directory + "/";
+    for ( auto watch = mWatches.begin(); watch != mWatches.end(); )
+    {
+        if ( watch->second == directory || watch->second.starts_with(prefix) )
+        {
+            inotify_rm_watch(mInotifyFd, watch->first);
+            watch = mWatches.erase(watch);
+        }
+        else
+            ++watch;
+    }
+}
+
+bool ChangeJournal::flush()
+{
+    if ( !mPendingRescan && mPendingDirectories.empty() && mPendingSubtrees.empty() && mPendingBarriers.empty() )
+        return true;
+
+    std::string records;
+    if ( mPendingRescan || mIncomplete )
+        appendRecord(records, 'R', "");
+    else
+    {
+        for ( const auto &directory : mPendingDirectories )
+            appendRecord(records, 'D', directory);
+        for ( const auto &directory : mPendingSubtrees )
+            appendRecord(records, 'S', directory);
+    }
+    for ( const auto &token : mPendingBarriers )
+        appendRecord(records, 'B', token);
+
+    const JournalFile journal(mRoot / CHANGE_JOURNAL_NAME, O_WRONLY | O_APPEND | O_CREAT, LOCK_EX);
+    struct stat journalStat{};
+    if ( journal.fd() < 0 || fstat(journal.fd(), &journalStat) != 0 )
+        return false;
+
+    // nobody reads the journal, rather than growing forever it collapses into a rescan
+    if ( static_cast<uint64_t>(journalStat.st_size) + records.size() > CHANGE_JOURNAL_MAX_BYTES )
+    {
+        std::string collapsed;
+        appendRecord(collapsed, 'W', mSession);
+        appendRecord(collapsed, 'R', "");
+        for ( const auto &token : mPendingBarriers )
+            appendRecord(collapsed, 'B', token);
+        records.swap(collapsed);
+        if ( ftruncate(journal.fd(), 0) != 0 )
+            return false;
+    }
+    if ( !writeAll(journal.fd(), records, -1) )
+    {
+        std::cerr << "Failed to append to change journal of " << mRoot << ": " << strerror(errno) << "\r\n";
+        return false;
+    }
+
+    mPendingRescan = false;
+    mPendingDirectories.clear();
+    mPendingSubtrees.clear();
+    mPendingBarriers.clear();
+    return true;
+}
+
+std::filesystem::path ChangeJournal::absolute(const std::string &directory) const
+{
+    return directory.empty() ? mRoot : mRoot / directory;
+}
@@ -0,0 +1,132 @@
+// Section 1: Compilation Guards
+#ifndef _CHANGE_JOURNAL_H_
+#define _CHANGE_JOURNAL_H_
+
+// Section 2: Includes
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Section 3: Defines and Macros
+constexpr uint64_t CHANGE_JOURNAL_MAX_BYTES = 64ULL << 20;   // past this the journal collapses into a full rescan
+constexpr int CHANGE_JOURNAL_BARRIER_TIMEOUT_MS = 5000;
+
+// Section 4: Classes
+/**
+ * Directories changed under a sync root since it was last indexed.
+ * A watcher (the server, or `multi-pc-sync --watch <path>` next to a client)
+ * follows the tree with inotify and appends the directories whose listing or
+ * entries changed to .folderindex.journal. The indexer reads the journal,
+ * walks only those directories on top of the last scan and drops what it
+ * read once the new scan is saved. Whenever the journal cannot vouch for the
+ * whole tree (no watcher running, watcher restarted, inotify queue overflow,
+ * watch limit reached) it says so and the indexer walks everything.
+ *
+ * The journal is a sequence of NUL terminated records: a header naming the
+ * watcher session, then R (rescan all), D<dir> (directory changed),
+ * S<dir> (directory tree appeared, walk all of it) and B<token> (barrier).
+ * Directories are relative to the root, "" being the root itself.
+ */
+class ChangeJournal {
+public:
+    /**
+     * Changes recorded for a root, as read by the indexer
+     */
+    struct Changes {
+        bool watched = false;                           ///< A watcher is running, the scan must be saved for the next run
+        bool rescan = true;                             ///< The journal cannot tell what changed, walk everything
+        std::string root;                               ///< Root the directories are relative to
+        std::unordered_set<std::string> directories;    ///< Directories whose listing or entries changed
+        std::unordered_set<std::string> subtrees;       ///< Directories to walk completely
+        std::unordered_set<std::string> ancestors;      ///< Directories leading to a changed one
+        std::string session;                            ///< Watcher session the journal was read from
+        uint64_t consumed = 0;                          ///< Journal bytes read
+
+        /**
+         * Checks whether a directory must be listed again
+         * @param directory Absolute path of the directory, below root
+         * @return true if it or something below it changed
+         */
+        [[nodiscard]] bool needsWalk(const std::filesystem::path &directory) const;
+    };
+
+    /**
+     * Prepares a watcher
+     * @param root Sync root to watch
+     */
+    explicit ChangeJournal(const std::filesystem::path &root);
+
+    /**
+     * Stops the watcher
+     */
+    ~ChangeJournal();
+
+    ChangeJournal(const ChangeJournal&) = delete;
+    ChangeJournal& operator=(const ChangeJournal&) = delete;
+
+    /**
+     * Watches the tree and starts journaling its changes
+     * @return true if the watcher runs, false if inotify failed or another watcher owns the root
+     */
+    bool start();
+
+    /**
+     * Stops journaling, the next index walks everything
+     */
+    void stop();
+
+    /**
+     * Reads the changes journaled for a root, waiting until the watcher caught up with the present
+     * @param root Sync root
+     * @return Changes, rescan set when no watcher vouches for the whole tree
+     */
+    static Changes read(const std::filesystem::path &root);
+
+    /**
+     * Drops journal records the indexer has applied
+     * @param changes Changes returned by read(), whose scan has been saved
+     */
+    static void release(const Changes &changes);
+
+    /**
+     * Gets the last scan of a root, the base the journal applies to
+     * @param root Sync root
+     * @return Path of the scan snapshot
+     */
+    static std::filesystem::path snapshotPath(const std::filesystem::path &root);
+
+    /**
+     * Checks whether a root level name is one of the journal's own files
+     * @param name Entry name
+     * @return true for the journal, its lock, barrier and the scan snapshot
+     */
+    static bool isJournalFile(const std::string &name);
+
+private:
+    void watchLoop();
+    void addWatches(const std::string &directory);
+    void removeWatches(const std::string &directory);
+    void handleEvents(const char *buffer, size_t size);
+    bool flush();
+    std::filesystem::path absolute(const std::string &directory) const;
+
+    std::filesystem::path mRoot;
+    std::string mSession;
+    int mInotifyFd;
+    int mLockFd;
+    std::thread mThread;
+    std::atomic<bool> mQuit;
+    bool mIncomplete;                                   ///< A watch could not be added, every flush asks for a rescan
+    std::unordered_map<int, std::string> mWatches;      ///< Directory of every watch descriptor
+    bool mPendingRescan;
+    std::unordered_set<std::string> mPendingDirectories;
+    std::unordered_set<std::string> mPendingSubtrees;
+    std::vector<std::string> mPendingBarriers;
+};
+
+#endif // _CHANGE_JOURNAL_H_
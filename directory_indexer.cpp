@@ -3,17 +3,24 @@
 
 // Section 2: Includes
 #include "file.pb.h"
+#include "directory_scanner.h"
+#include "flat_index.h"
 #include "folder.pb.h"
-#include "md5_wrapper.h"
+#include "hash_pipeline.h"
+#include "program_options.h"
 #include "sync_command.h"
+#include "sync_planner.h"
 #include "tcp_command.h"
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <filesystem>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <string>
 #include <thread>
+#include <utility>
 #include <unistd.h>
 #include <fcntl.h> /* Definition of AT_* constants */
 #include <sys/stat.h>
@@ -25,13 +32,32 @@
 
 
 // Section 4: Static Variables
-// (none)
+unsigned DirectoryIndexer::indexThreads = 0;   // 0 means one thread per core
+unsigned DirectoryIndexer::hashThreads = 0;    // 0 means one worker per core
+std::filesystem::path DirectoryIndexer::hashCacheDirectory;   // empty means HashCache::defaultDirectory()
+uint64_t DirectoryIndexer::hashCacheMaxSize = DEFAULT_HASH_CACHE_MAX_SIZE_BYTES;
+uint64_t DirectoryIndexer::chunkHashMinFileBytes = 0;  // 0 means files are always hashed whole
+uint64_t DirectoryIndexer::chunkHashBytes = DEFAULT_CHUNK_HASH_BYTES;
 
 // Section 5: Constructors and Destructors
-DirectoryIndexer::DirectoryIndexer(const std::filesystem::path &path, bool topLevel, INDEX_TYPE type ) :
+DirectoryIndexer::DirectoryIndexer(const std::filesystem::path &path, bool topLevel, INDEX_TYPE type, google::protobuf::Arena *arena ) :
     mDir( path ),
-    mUpdateIndexFile( true ),
-    mTopLevel( topLevel )
+    mOwnedArena( arena == nullptr ? std::make_unique<google::protobuf::Arena>( indexArenaOptions() ) : nullptr ),
+    mArena( arena == nullptr ? mOwnedArena.get() : arena ),
+    mFolderIndex( *google::protobuf::Arena::CreateMessage<com::fileindexer::Folder>( mArena ) ),
+    mPathLookupActive( false ),
+    mContentLookupActive( false ),
+    mDirty( &mDirtyFolders ),
+    mTopLevel( topLevel ),
+    mPool( nullptr ),
+    mSubfolderTasks( nullptr ),
+    mHashPipeline( nullptr ),
+    mHashReuse( nullptr ),
+    mHashCache( nullptr ),
+    mHashAlgorithm( FileHasher::algorithm() ),
+    mChunkHashMinFileBytes( chunkHashMinFileBytes ),
+    mChunkHashBytes( chunkHashBytes ),
+    mChanges( nullptr )
 {
     if ( !mDir.exists() || !mDir.is_directory() )
         return;
@@ -60,63 +86,189 @@ DirectoryIndexer::DirectoryIndexer(const std::filesystem::path &path, bool topLe
         /* import existing index from file */
         if ( std::filesystem::exists( indexpath ) )
         {
-            std::cout << termcolor::white << "Loading index from file... " << termcolor::reset;
-            
-            mUpdateIndexFile = false;
-            mIndexfile.open( indexpath, std::ios::in );
-            mFolderIndex.ParseFromIstream( &mIndexfile );
-            mIndexfile.close();
+            // a last run index mostly answers lookups, it is read in place while its flat cache is current,
+            // otherwise parsed only where the lookups go
+            const bool lastRun = type == INDEX_TYPE_LOCAL_LAST_RUN || type == INDEX_TYPE_REMOTE_LAST_RUN;
+            auto flatIndex = std::make_unique<FlatIndex>();
+            auto lazyIndex = std::make_unique<LazyIndex>();
+            if ( lastRun && flatIndex->open( indexpath ) )
+            {
+                flatIndex->toFolderEntry( 0, mFolderIndex );
+                mFlatIndex = std::move( flatIndex );
+                mIndexBase = indexpath;
+            }
+            else if ( lastRun && lazyIndex->open( indexpath, mFolderIndex ) )
+            {
+                mLazyIndex = std::move( lazyIndex );
+                mIndexBase = indexpath;
+            }
+            else if ( IndexLog::load( indexpath, mFolderIndex ) )
+                mIndexBase = indexpath;
+            else
+                mFolderIndex.Clear();   // unreadable, built again by the next walk
 
-            std::cout << termcolor::green << " done" << termcolor::reset << "\r\n";
+            // one line once loaded, the indexes of a session load concurrently
+            std::cout << termcolor::white << "Loaded index from " << indexpath.filename().string() << termcolor::reset << "\r\n";
         }
         
         if ( mFolderIndex.name().empty() )
             mFolderIndex.set_name( mDir.path() );
     }
 }
-DirectoryIndexer::DirectoryIndexer(const std::filesystem::path &path, const com::fileindexer::Folder &folderIndex, bool topLevel) :
+DirectoryIndexer::DirectoryIndexer(const std::filesystem::path &path, com::fileindexer::Folder &&folderIndex, bool topLevel) :
     mDir( path ),
-    mUpdateIndexFile( true ),
-    mFolderIndex(folderIndex),
-    mTopLevel( topLevel )
+    mOwnedArena( folderIndex.GetArena() == nullptr ? std::make_unique<google::protobuf::Arena>( indexArenaOptions() ) : nullptr ),
+    mArena( folderIndex.GetArena() == nullptr ? mOwnedArena.get() : folderIndex.GetArena() ),
+    mFolderIndex( *google::protobuf::Arena::CreateMessage<com::fileindexer::Folder>( mArena ) ),
+    mPathLookupActive( false ),
+    mContentLookupActive( false ),
+    mDirty( &mDirtyFolders ),
+    mTopLevel( topLevel ),
+    mPool( nullptr ),
+    mSubfolderTasks( nullptr ),
+    mHashPipeline( nullptr ),
+    mHashReuse( nullptr ),
+    mHashCache( nullptr ),
+    mHashAlgorithm( FileHasher::algorithm() ),
+    mChunkHashMinFileBytes( chunkHashMinFileBytes ),
+    mChunkHashBytes( chunkHashBytes ),
+    mChanges( nullptr )
 {
-
+    // take the subtree over instead of copying it, the caller swaps it back once indexed,
+    // a pointer swap since both live on the same arena
+    mFolderIndex.Swap( &folderIndex );
 }
 
 DirectoryIndexer::~DirectoryIndexer()
 { 
+    if ( mIndexCompaction.joinable() )
+        mIndexCompaction.join();
 }
 
 // Section 6: Static Methods
-// ...existing code...
+unsigned DirectoryIndexer::resolvedIndexThreads()
+{
+    if ( indexThreads != 0 )
+        return indexThreads;
+    return std::max( 1U, std::thread::hardware_concurrency() );
+}
+
+google::protobuf::ArenaOptions DirectoryIndexer::indexArenaOptions()
+{
+    google::protobuf::ArenaOptions options;
+    options.max_block_size = INDEX_ARENA_MAX_BLOCK_BYTES;
+    return options;
+}
+
+unsigned DirectoryIndexer::resolvedHashThreads()
+{
+    if ( hashThreads != 0 )
+        return hashThreads;
+    return std::max( 1U, std::thread::hardware_concurrency() );
+}
+
+void DirectoryIndexer::collectKnownHashes(const com::fileindexer::Folder &folderIndex, HashReuseMap &knownHashes)
+{
+    for ( const auto &file : folderIndex.files() )
+    {
+        if ( file.has_inode() && !file.hash().empty() )
+            knownHashes.emplace( FileIdentity{ .device = file.device(), .inode = file.inode(),
+                                               .size = file.size(), .modifiedTimeNs = file.modifiedtimens(),
+                                               .algorithm = file.hashalgorithm(), .chunkSize = file.chunksize() },
+                                 KnownHash{ .hash = file.hash(),
+                                            .chunkHashes = { file.chunkhashes().begin(), file.chunkhashes().end() } } );
+    }
+    for ( const auto &folder : folderIndex.folders() )
+        collectKnownHashes( folder, knownHashes );
+}
+
+size_t DirectoryIndexer::FileIdentityHash::operator()(const FileIdentity &identity) const
+{
+    size_t seed = std::hash<uint64_t>{}( identity.inode );
+    seed ^= std::hash<uint64_t>{}( identity.device ) + 0x9e3779b97f4a7c15ULL + ( seed << 6 ) + ( seed >> 2 );
+    seed ^= std::hash<uint64_t>{}( identity.size ) + 0x9e3779b97f4a7c15ULL + ( seed << 6 ) + ( seed >> 2 );
+    seed ^= std::hash<int64_t>{}( identity.modifiedTimeNs ) + 0x9e3779b97f4a7c15ULL + ( seed << 6 ) + ( seed >> 2 );
+    seed ^= std::hash<int>{}( identity.algorithm ) + 0x9e3779b97f4a7c15ULL + ( seed << 6 ) + ( seed >> 2 );
+    seed ^= std::hash<uint64_t>{}( identity.chunkSize ) + 0x9e3779b97f4a7c15ULL + ( seed << 6 ) + ( seed >> 2 );
+    return seed;
+}
+
+bool DirectoryIndexer::ContentOrder::operator()(const com::fileindexer::File *fileA, const com::fileindexer::File *fileB) const
+{
+    const int comparison = fileA->hash().compare( fileB->hash() );
+    return comparison != 0 ? comparison < 0 : fileA->name() < fileB->name();
+}
+
+bool DirectoryIndexer::ContentOrder::operator()(const com::fileindexer::File *file, std::string_view digest) const
+{
+    return std::string_view( file->hash() ) < digest;
+}
+
+bool DirectoryIndexer::ContentOrder::operator()(std::string_view digest, const com::fileindexer::File *file) const
+{
+    return digest < std::string_view( file->hash() );
+}
+
+void DirectoryIndexer::copyDigest(com::fileindexer::File &to, const com::fileindexer::File &from)
+{
+    to.set_hash( from.hash() );
+    to.set_hashalgorithm( from.hashalgorithm() );
+    if ( from.has_chunksize() )
+        to.set_chunksize( from.chunksize() );
+    else
+        to.clear_chunksize();
+    *to.mutable_chunkhashes() = from.chunkhashes();
+}
+
+bool DirectoryIndexer::isIndexFile(const std::string &name)
+{
+    const std::string index = IndexLog::indexName( name );
+    return index == ".folderindex" || index == ".remote.folderindex" ||
+           index == ".folderindex.last_run" || index == ".remote.folderindex.last_run" ||
+           name == "sync_commands.sh" || ChangeJournal::isJournalFile( index );
+}
+
+bool DirectoryIndexer::isSameContent(const com::fileindexer::File &fileA, const com::fileindexer::File &fileB)
+{
+    if ( fileA.hashalgorithm() == fileB.hashalgorithm() && fileA.chunksize() == fileB.chunksize() )
+        return FileHasher::sameDigest( fileA.hash(), fileB.hash() );
+
+    // an index from before a change of algorithm or chunking, the digests say nothing about each other:
+    // trust size and modified time, like the indexer does before rehashing a file
+    return fileA.has_size() && fileB.has_size() && fileA.size() == fileB.size() &&
+           fileA.modifiedtimens() == fileB.modifiedtimens();
+}
 
 // Section 7: Public/Protected/Private Methods
 void DirectoryIndexer::printIndex( com::fileindexer::Folder *folderIndex, int recursionlevel )
 {
     if ( folderIndex == nullptr )
+    {
+        expandIndex();
         folderIndex = &mFolderIndex;
+    }
 
     std::string tabs = "\t";
     for ( int i = 0; i < recursionlevel; ++i )
     {
         tabs += "\t";
     }
-    for ( auto folder : *folderIndex->mutable_folders() )
+    for ( auto &folder : *folderIndex->mutable_folders() )
     {
-        std::cout << termcolor::magenta << tabs << *folder.mutable_name() << termcolor::reset;
+        std::cout << termcolor::magenta << tabs << folder.name() << termcolor::reset;
         std::cout << termcolor::cyan << "\t" << folder.permissions() << termcolor::reset;
         std::cout << termcolor::cyan << "\t" << folder.type() << termcolor::reset;
-        std::cout << termcolor::cyan << "\t" << *folder.mutable_modifiedtime() << termcolor::reset;
+        std::cout << termcolor::cyan << "\t" << file_time_to_string(ns_to_timespec(folder.modifiedtimens())) << termcolor::reset;
         std::cout << termcolor::cyan << "\r\n" << termcolor::reset;
         printIndex( &folder, recursionlevel + 1 );
     }
-    for ( auto file : *folderIndex->mutable_files() )
+    for ( const auto &file : folderIndex->files() )
     {
-        std::cout << termcolor::magenta << tabs << *file.mutable_name() << termcolor::reset;
+        std::cout << termcolor::magenta << tabs << file.name() << termcolor::reset;
         std::cout << termcolor::cyan << "\t" << file.permissions() << termcolor::reset;
         std::cout << termcolor::cyan << "\t" << file.type() << termcolor::reset;
-        std::cout << termcolor::cyan << "\t" << *file.mutable_modifiedtime() << termcolor::reset;
-        std::cout << termcolor::cyan << "\t" << *file.mutable_hash() << termcolor::reset;
+        std::cout << termcolor::cyan << "\t" << file_time_to_string(ns_to_timespec(file.modifiedtimens())) << termcolor::reset;
+        std::cout << termcolor::cyan << "\t" << FileHasher::toHex(file.hash()) << termcolor::reset;
         std::cout << termcolor::cyan << "\r\n" << termcolor::reset;
     }
 
@@ -131,7 +283,14 @@ std::vector<std::string> DirectoryIndexer::getDeletions(DirectoryIndexer* lastRu
 
     // Start comparison from the root folders of both indexes
     // Pass an empty path initially for basePath, it will be built up during recursion
-    findDeletedRecursive(this->mFolderIndex, lastRunIndexer->mFolderIndex, "", deletions);
+    expandIndex();
+    if (lastRunIndexer->mFlatIndex != nullptr)
+        findDeletedFlat(this->mFolderIndex, *lastRunIndexer->mFlatIndex, 0, deletions);
+    else
+    {
+        lastRunIndexer->expandIndex();
+        findDeletedRecursive(this->mFolderIndex, lastRunIndexer->mFolderIndex, "", deletions);
+    }
 
     return deletions;
 }
@@ -140,26 +299,128 @@ int DirectoryIndexer::indexonprotobuf( bool verbose )
 {
     if ( !mDir.exists() || !mDir.is_directory() )
         return -1;
+    expandIndex();
     
     if ( verbose )
         std::cout << mDir.path() << "\r\n";
+
+    // the top level owns the pool, subfolder indexers borrow it
+    std::unique_ptr<WorkStealingPool> ownedPool;
+    if ( mPool == nullptr && resolvedIndexThreads() > 1 )
+    {
+        ownedPool = std::make_unique<WorkStealingPool>( resolvedIndexThreads() );
+        mPool = ownedPool.get();
+    }
+
+    // with a watcher running the last scan is the base and only the directories it saw change are listed again
+    std::unique_ptr<ChangeJournal::Changes> ownedChanges;
+    if ( mTopLevel && mChanges == nullptr )
+    {
+        ownedChanges = std::make_unique<ChangeJournal::Changes>( ChangeJournal::read( mDir.path() ) );
+        if ( ownedChanges->watched && !loadScanSnapshot() )
+            ownedChanges->rescan = true;
+    }
+
+    // same for the persistent digest cache, it outlives the hash workers feeding it
+    std::unique_ptr<HashCache> ownedHashCache;
+    if ( mHashCache == nullptr && hashCacheMaxSize != 0 )
+    {
+        ownedHashCache = std::make_unique<HashCache>( hashCacheDirectory.empty() ? HashCache::defaultDirectory() : hashCacheDirectory,
+                                                      hashCacheMaxSize );
+        mHashCache = ownedHashCache.get();
+    }
+
+    // and for the hash workers, files are queued during the walk and hashed behind it
+    std::unique_ptr<HashPipeline> ownedHashPipeline;
+    if ( mHashPipeline == nullptr )
+    {
+        ownedHashPipeline = std::make_unique<HashPipeline>( resolvedHashThreads(), mHashCache );
+        mHashPipeline = ownedHashPipeline.get();
+    }
+
+    // and for the known digests, so a file moved anywhere in the tree keeps its hash
+    std::unique_ptr<HashReuseMap> ownedHashReuse;
+    if ( mHashReuse == nullptr )
+    {
+        ownedHashReuse = std::make_unique<HashReuseMap>();
+        collectKnownHashes( mFolderIndex, *ownedHashReuse );
+        mHashReuse = ownedHashReuse.get();
+    }
+
+    // the root records which algorithm the digests below it use, so the peer knows how to compare them
+    if ( mTopLevel && ( !mFolderIndex.has_hashalgorithm() || indexedHashAlgorithm() != mHashAlgorithm ||
+                        mFolderIndex.chunkhashminfilesize() != mChunkHashMinFileBytes ||
+                        mFolderIndex.chunkhashsize() != mChunkHashBytes ) )
+    {
+        mFolderIndex.set_hashalgorithm( static_cast<com::fileindexer::File::HashAlgorithm>( mHashAlgorithm ) );
+        mFolderIndex.set_chunkhashminfilesize( mChunkHashMinFileBytes );
+        mFolderIndex.set_chunkhashsize( mChunkHashBytes );
+        markDirty();
+        // every entry must be looked at to be hashed the new way
+        if ( ownedChanges != nullptr )
+            ownedChanges->rescan = true;
+    }
+    if ( ownedChanges != nullptr && ownedChanges->watched && !ownedChanges->rescan )
+        mChanges = ownedChanges.get();
+
+    WorkStealingPool::TaskGroup subfolderTasks;
+    mSubfolderTasks = &subfolderTasks;
+    mSeenEntries.clear();
+    buildChildLookup();
     
-    for ( const auto& file : std::filesystem::directory_iterator( mDir.path() ) )
+    try
     {
-        if ( file.path().filename() == ".folderindex" || file.path().filename() == ".remote.folderindex" ||
-             file.path().filename() == ".folderindex.last_run" || file.path().filename() == ".remote.folderindex.last_run" ||
-             file.path().filename() == "sync_commands.sh" )
-            continue;
+        DirectoryScanner scanner( mDir.path() );
+        DirectoryScanner::Entry entry;
+        while ( scanner.next( entry ) )
+        {
+            if ( isIndexFile( entry.name ) )
+                continue;
 
-        indexpath( file.path(), verbose );
+            indexpath( scanner, entry, verbose );
+        }
+
+        /* subfolder entries must be complete before they get compacted below */
+        if ( mPool != nullptr )
+            mPool->wait( subfolderTasks );
     }
+    catch (...)
+    {
+        // nothing queued by this walk may outlive the entries it points to
+        if ( mPool != nullptr )
+        {
+            try { mPool->wait( subfolderTasks ); } catch (...) {}   // keep the first error
+        }
+        mHashPipeline->wait();
+        mSubfolderTasks = nullptr;
+        if ( ownedChanges != nullptr )
+            mChanges = nullptr;
+        if ( ownedPool != nullptr )
+            mPool = nullptr;
+        if ( ownedHashPipeline != nullptr )
+            mHashPipeline = nullptr;
+        if ( ownedHashCache != nullptr )
+            mHashCache = nullptr;
+        if ( ownedHashReuse != nullptr )
+            mHashReuse = nullptr;
+        throw;
+    }
+    mSubfolderTasks = nullptr;
+    if ( ownedPool != nullptr )
+        mPool = nullptr;
+    if ( ownedHashReuse != nullptr )
+        mHashReuse = nullptr;
+    if ( ownedChanges != nullptr )
+        mChanges = nullptr;
 
     /* check for file deletion */
+    // Entries still waiting for their hash are always in mSeenEntries, so compaction never
+    // frees an entry a hash worker is about to write to.
     // Move all filtered elements to the end of the list.
     int keep = 0;  // number to keep
     for (int i = 0; i < mFolderIndex.files_size(); i++)
     {
-        if ( std::filesystem::exists( (mDir.path() / mFolderIndex.files()[i].name()) ) )
+        if ( mSeenEntries.contains( mFolderIndex.files()[i].name() ) )
         {
             if (keep < i) 
             {
@@ -167,7 +428,7 @@ int DirectoryIndexer::indexonprotobuf( bool verbose )
             }
             ++keep;
         } else
-            mUpdateIndexFile = true;
+            markDirty();
     }
     // Remove the filtered elements.
     mFolderIndex.mutable_files()->DeleteSubrange(keep, mFolderIndex.files_size() - keep);
@@ -177,7 +438,7 @@ int DirectoryIndexer::indexonprotobuf( bool verbose )
     keep = 0;  // number to keep
     for (int i = 0; i < mFolderIndex.folders_size(); i++)
     {
-        if ( std::filesystem::exists( (mDir.path() / mFolderIndex.folders()[i].name()) ) )
+        if ( mSeenEntries.contains( mFolderIndex.folders()[i].name() ) )
         {
             if (keep < i) 
             {
@@ -185,139 +446,500 @@ int DirectoryIndexer::indexonprotobuf( bool verbose )
             }
             ++keep;
         } else
-            mUpdateIndexFile = true;
+            markDirty();
     }
     // Remove the filtered elements.
     mFolderIndex.mutable_folders()->DeleteSubrange(keep, mFolderIndex.folders_size() - keep);
+    mSeenEntries.clear();
+    mFileLookup.clear();
+    mFolderLookup.clear();
 
-    /* output to file */
-    if ( mUpdateIndexFile && mTopLevel )
-        return dumpIndexToFile({});    //default path is .folderindex in the directory being indexed
+    /* every digest must be written back before the index is used or saved */
+    if ( ownedHashPipeline != nullptr )
+    {
+        ownedHashPipeline->wait();
+        mHashPipeline = nullptr;
+    }
+    if ( ownedHashCache != nullptr )
+    {
+        ownedHashCache->flush();
+        mHashCache = nullptr;
+    }
 
-    return 0;
+    if ( !mTopLevel )
+        return 0;
+
+    /* the scan is the base the next run applies the journal to, the journal up to it is done with */
+    if ( ownedChanges != nullptr && ownedChanges->watched && saveScanSnapshot() == 0 )
+    {
+        ChangeJournal::release( *ownedChanges );
+        // the index is the scan until the sync edits it, link it rather than write it again
+        if ( IndexLog::duplicate( ChangeJournal::snapshotPath( mDir.path() ), mDir.path() / ".folderindex" ) )
+        {
+            mIndexBase = mDir.path() / ".folderindex";
+            refreshFlatIndex( mIndexBase );
+            return 0;
+        }
+    }
+
+    /* output to file */
+    return dumpIndexToFile({});    //default path is .folderindex in the directory being indexed
 }
 
 int DirectoryIndexer::dumpIndexToFile(const std::optional<std::filesystem::path> &path) {
     
     auto indexPath = path ? *path : (mDir.path() / ".folderindex");
-    if (std::filesystem::exists(indexPath))
-        std::filesystem::remove(indexPath);
+    expandIndex();
+    std::lock_guard<std::mutex> lock(mDirty->mutex);
+
+    /* the file holds the index as it was loaded or saved, only the folders changed since are appended,
+       unless it predates the current format: it is migrated by writing it whole */
+    if (indexPath == mIndexBase && mFolderIndex.formatversion() == INDEX_FORMAT_VERSION) {
+        if (mDirty->names.empty()) {
+            refreshFlatIndex(indexPath);
+            return 0;
+        }
+        std::string records;
+        collectLogRecords(mFolderIndex, records);
+        if (IndexLog::append(indexPath, records) == 0) {
+            mDirty->names.clear();
+            refreshFlatIndex(indexPath);
+            if (IndexLog::needsCompaction(indexPath)) {
+                if (mIndexCompaction.joinable())
+                    mIndexCompaction.join();
+                mIndexCompaction = std::thread([indexPath]() { IndexLog::compact(indexPath); });
+            }
+            return 0;
+        }
+        std::cout << termcolor::yellow << "Failed to append to the index log, writing the whole index: " << indexPath << termcolor::reset << "\r\n";
+    }
 
-    std::ofstream outFile( indexPath, std::ios::out );
-    if (!outFile) {
-        std::cout << termcolor::red << "Failed to open index file for writing: " << indexPath << termcolor::reset << "\r\n";
+    if (IndexLog::writeSnapshot(indexPath, mFolderIndex) != 0) {
+        std::cout << termcolor::red << "Failed to write index file: " << indexPath << termcolor::reset << "\r\n";
         std::cerr << "Error: " << strerror(errno) << "\r\n";
-        outFile.close();
         return -1;
     }
-    mFolderIndex.SerializeToOstream(&outFile);
-    outFile.close();
+    mIndexBase = indexPath;
+    mDirty->names.clear();
+    refreshFlatIndex(indexPath);
     return 0;
 }
 
-void DirectoryIndexer::updateFileEntry(const std::filesystem::directory_entry& file, com::fileindexer::File& protobufFile, bool verbose, bool& found) {
-    for (int i = 0; i < mFolderIndex.files_size(); i++) {
-        auto *fileInIndex = mFolderIndex.mutable_files()->Mutable(i);
-        if (fileInIndex->name() == protobufFile.name()) {
-            found = true;
-            if (fileInIndex->permissions() != protobufFile.permissions() ||
-                fileInIndex->type() != protobufFile.type() ||
-                fileInIndex->modifiedtime() != protobufFile.modifiedtime() ||
-                fileInIndex->changetime() != protobufFile.changetime()) {
-                mUpdateIndexFile = true;
-                if (file.status().type() == std::filesystem::file_type::regular) {
-                    MD5Calculator hash(std::filesystem::canonical(file.path()), verbose);
-                    std::string hashstring = hash.getDigest().to_string();
-                    *fileInIndex->mutable_hash() = hashstring;
-                }
-                fileInIndex->set_permissions(protobufFile.permissions());
-                fileInIndex->set_type(protobufFile.type());
-                *fileInIndex->mutable_modifiedtime() = protobufFile.modifiedtime();
-            }
-            break;
-        }
+int DirectoryIndexer::compactIndexFile() {
+    if (mIndexBase.empty() || !IndexLog::hasLog(mIndexBase))
+        return 0;
+    // the index in memory is the snapshot with its log applied, no need to read them back
+    expandIndex();
+    std::lock_guard<std::mutex> lock(mDirty->mutex);
+    const bool flatIndexCurrent = mDirty->names.empty() && FlatIndex::isCurrent(mIndexBase);
+    if (IndexLog::writeSnapshot(mIndexBase, mFolderIndex) != 0) {
+        std::cout << termcolor::red << "Failed to write index file: " << mIndexBase << termcolor::reset << "\r\n";
+        return -1;
     }
+    mDirty->names.clear();
+    // nothing unsaved, so the same content in new files: only the identity the flat cache checks changed
+    if (!flatIndexCurrent || FlatIndex::retarget(mIndexBase) != 0)
+        refreshFlatIndex(mIndexBase);
+    return 0;
 }
 
-void DirectoryIndexer::updateFolderEntry(const std::filesystem::directory_entry& file, com::fileindexer::File& protobufFile, bool verbose, bool& found) {
-    for (int i = 0; i < mFolderIndex.folders_size(); i++) {
-        auto *folderInIndex = mFolderIndex.mutable_folders()->Mutable(i);
-        if (folderInIndex->name() == protobufFile.name()) {
-            found = true;
-            mUpdateIndexFile = true;
-            DirectoryIndexer indexer(file.path(), *folderInIndex, false);
-            indexer.indexonprotobuf(verbose);
-            *folderInIndex = indexer.mFolderIndex;
-            folderInIndex->set_name(protobufFile.name());
-            folderInIndex->set_permissions(protobufFile.permissions());
-            folderInIndex->set_type(static_cast<com::fileindexer::Folder::FileType>(protobufFile.type()));
-            folderInIndex->set_modifiedtime(protobufFile.modifiedtime());
-            folderInIndex->set_changetime(protobufFile.changetime());
-            break;
-        }
+void DirectoryIndexer::refreshFlatIndex(const std::filesystem::path &indexPath) {
+    // the next run reads it in place as its last run index
+    if (indexPath != mDir.path() / ".folderindex" || FlatIndex::isCurrent(indexPath))
+        return;
+    if (FlatIndex::write(indexPath, mFolderIndex) != 0)
+        std::cout << termcolor::yellow << "Failed to write the flat index of " << indexPath << termcolor::reset << "\r\n";
+}
+
+void DirectoryIndexer::expandIndex() {
+    if (mLazyIndex == nullptr && mFlatIndex == nullptr)
+        return;
+    if (mLazyIndex != nullptr)
+    {
+        // a whole parse beats expanding every folder in turn
+        mLazyIndex.reset();
+        mFolderIndex.Clear();
+        if (!IndexLog::load(mIndexBase, mFolderIndex))
+            mFolderIndex.Clear();
+        if (mFolderIndex.name().empty())
+            mFolderIndex.set_name(mDir.path());
+    }
+    if (mFlatIndex != nullptr)
+    {
+        mFolderIndex.Clear();
+        mFlatIndex->toFolder(0, mFolderIndex);
+        mFlatIndex.reset();
+        mFlatEntries.clear();
+    }
+    // a new tree, the entries the lookup held are gone
+    if (mPathLookupActive)
+        buildPathLookup(mContentLookupActive);
+}
+
+void DirectoryIndexer::buildPathLookup(bool withContent) {
+    mPathLookupActive = true;
+    mPathLookup.clear();
+    mContentLookupActive = withContent;
+    mContentLookup.clear();
+    mContentSchemes.clear();
+    if (mFlatIndex != nullptr)
+        return;
+    mPathLookup.emplace(mFolderIndex.name(), PathEntry{ &mFolderIndex, FOLDER });
+    // a lazy index has only its expanded folders yet, the others join as extract() expands them
+    addToPathLookup(mFolderIndex, true);
+}
+
+void DirectoryIndexer::dropPathLookup() {
+    mPathLookupActive = false;
+    mPathLookup = {};
+    mContentLookupActive = false;
+    mContentLookup = {};
+    mContentSchemes.clear();
+}
+
+void DirectoryIndexer::addToPathLookup(com::fileindexer::Folder &folder, bool withSubfolders) {
+    for (auto &file : *folder.mutable_files())
+    {
+        mPathLookup.emplace(file.name(), PathEntry{ &file, FILE });
+        rememberContent(file);
+    }
+    for (auto &subfolder : *folder.mutable_folders())
+    {
+        mPathLookup.emplace(subfolder.name(), PathEntry{ &subfolder, FOLDER });
+        if (withSubfolders)
+            addToPathLookup(subfolder, true);
+    }
+}
+
+void DirectoryIndexer::removeFromPathLookup(const com::fileindexer::Folder &folder) {
+    for (const auto &file : folder.files())
+    {
+        mPathLookup.erase(file.name());
+        forgetContent(file);
+    }
+    for (const auto &subfolder : folder.folders())
+    {
+        removeFromPathLookup(subfolder);
+        mPathLookup.erase(subfolder.name());
+    }
+}
+
+void DirectoryIndexer::rememberContent(com::fileindexer::File &file) {
+    if (!mContentLookupActive)
+        return;
+    mContentLookup.insert(&file);
+    ++mContentSchemes[{ file.hashalgorithm(), file.chunksize() }];
+    SyncPlanner::recordContent(*this, file, true);
+}
+
+void DirectoryIndexer::forgetContent(const com::fileindexer::File &file) {
+    if (!mContentLookupActive)
+        return;
+    const auto found = mContentLookup.find(&file);
+    if (found == mContentLookup.end() || *found != &file)
+        return;
+    mContentLookup.erase(found);
+    SyncPlanner::recordContent(*this, file, false);
+    const auto scheme = mContentSchemes.find({ file.hashalgorithm(), file.chunksize() });
+    if (scheme != mContentSchemes.end() && --scheme->second == 0)
+        mContentSchemes.erase(scheme);
+}
+
+void DirectoryIndexer::markDirty() {
+    markDirty(mFolderIndex.name());
+}
+
+void DirectoryIndexer::markDirty(const std::string &folderName) {
+    std::lock_guard<std::mutex> lock(mDirty->mutex);
+    mDirty->names.insert(folderName);
+}
+
+void DirectoryIndexer::collectLogRecords(com::fileindexer::Folder &folderIndex, std::string &records) {
+    // parents before children, a new folder's record needs its entry in the parent's
+    if (mDirty->names.contains(folderIndex.name())) {
+        mFolderIndex.set_logsequence(mFolderIndex.logsequence() + 1);
+        IndexLog::appendRecord(records, folderIndex, mFolderIndex.logsequence());
+    }
+    for (auto &folder : *folderIndex.mutable_folders())
+        collectLogRecords(folder, records);
+}
+
+void DirectoryIndexer::buildChildLookup() {
+    mFileLookup.clear();
+    mFolderLookup.clear();
+    mFileLookup.reserve(mFolderIndex.files_size());
+    mFolderLookup.reserve(mFolderIndex.folders_size());
+    // emplace keeps the first entry of a duplicated name, like the linear scan it replaces
+    for (auto &fileInIndex : *mFolderIndex.mutable_files())
+        mFileLookup.emplace(fileInIndex.name(), &fileInIndex);
+    for (auto &folderInIndex : *mFolderIndex.mutable_folders())
+        mFolderLookup.emplace(folderInIndex.name(), &folderInIndex);
+}
+
+void DirectoryIndexer::updateFileEntry(const std::filesystem::path& path, com::fileindexer::File& protobufFile, bool verbose, const DirectoryScanner::Entry& scanned, bool& found) {
+    const auto entry = mFileLookup.find(protobufFile.name());
+    if (entry == mFileLookup.end())
+        return;
+
+    auto *fileInIndex = entry->second;
+    found = true;
+    const bool regular = scanned.type == std::filesystem::file_type::regular;
+    // unchanged, but hashed with another algorithm or chunking: migrate the entry now that the walk is here anyway,
+    // decided before a hash worker may own the entry
+    const bool migrate = regular &&
+                         (fileInIndex->hashalgorithm() != static_cast<com::fileindexer::File::HashAlgorithm>(mHashAlgorithm) ||
+                          fileInIndex->chunksize() != chunkSizeFor(scanned.size));
+    // a different inode or size under the same name is a replaced file, even if the times were preserved
+    const bool replaced = fileInIndex->has_inode() &&
+                          (fileInIndex->device() != protobufFile.device() ||
+                           fileInIndex->inode() != protobufFile.inode() ||
+                           fileInIndex->size() != protobufFile.size());
+    if (replaced ||
+        fileInIndex->permissions() != protobufFile.permissions() ||
+        fileInIndex->type() != protobufFile.type() ||
+        fileInIndex->modifiedtimens() != protobufFile.modifiedtimens() ||
+        fileInIndex->changetimens() != protobufFile.changetimens()) {
+        markDirty();
+        fileInIndex->set_permissions(protobufFile.permissions());
+        fileInIndex->set_type(protobufFile.type());
+        fileInIndex->set_modifiedtimens(protobufFile.modifiedtimens());
+        fileInIndex->set_changetimens(protobufFile.changetimens());
+        setFileIdentity(*fileInIndex, protobufFile);
+        if (regular)
+            scheduleHash(path, fileInIndex, scanned, verbose);
+    } else if (migrate) {
+        markDirty();
+        if (!fileInIndex->has_inode())
+            setFileIdentity(*fileInIndex, protobufFile);
+        scheduleHash(path, fileInIndex, scanned, verbose);
+    } else if (!fileInIndex->has_inode()) {
+        markDirty();    // index written before the file identity was recorded
+        setFileIdentity(*fileInIndex, protobufFile);
     }
 }
 
-void DirectoryIndexer::addNewEntry(const std::filesystem::directory_entry& file, com::fileindexer::File& protobufFile, bool verbose, std::filesystem::file_type type) {
-    mUpdateIndexFile = true;
-    if (type == std::filesystem::file_type::directory) {
-        DirectoryIndexer indexer(file.path());
+void DirectoryIndexer::setFileIdentity(com::fileindexer::File &fileInIndex, const com::fileindexer::File &protobufFile)
+{
+    fileInIndex.set_device(protobufFile.device());
+    fileInIndex.set_inode(protobufFile.inode());
+    fileInIndex.set_size(protobufFile.size());
+}
+
+void DirectoryIndexer::updateFolderEntry(const std::filesystem::path& path, com::fileindexer::File& protobufFile, bool verbose, bool& found) {
+    const auto entry = mFolderLookup.find(protobufFile.name());
+    if (entry == mFolderLookup.end())
+        return;
+
+    auto *folderInIndex = entry->second;
+    found = true;
+    scheduleSubfolder([parent = this, folderInIndex, path, protobufFile, verbose]() {
+        DirectoryIndexer indexer(path, std::move(*folderInIndex), false);
+        parent->shareWalkWith(indexer);
         indexer.indexonprotobuf(verbose);
-        indexer.mFolderIndex.set_name(protobufFile.name());
-        indexer.mFolderIndex.set_permissions(protobufFile.permissions());
-        indexer.mFolderIndex.set_type(static_cast<com::fileindexer::Folder::FileType>(protobufFile.type()));
-        indexer.mFolderIndex.set_modifiedtime(protobufFile.modifiedtime());
-        indexer.mFolderIndex.set_changetime(protobufFile.changetime());
-        *mFolderIndex.add_folders() = indexer.mFolderIndex;
+        // swap rather than copy, queued hash jobs point into the child's entries
+        folderInIndex->Swap(&indexer.mFolderIndex);
+        // its own metadata is listed with its parent
+        const auto type = static_cast<com::fileindexer::Folder::FileType>(protobufFile.type());
+        if (folderInIndex->permissions() != protobufFile.permissions() ||
+            folderInIndex->type() != type ||
+            folderInIndex->modifiedtimens() != protobufFile.modifiedtimens() ||
+            folderInIndex->changetimens() != protobufFile.changetimens())
+            parent->markDirty();
+        folderInIndex->set_name(protobufFile.name());
+        folderInIndex->set_permissions(protobufFile.permissions());
+        folderInIndex->set_type(type);
+        folderInIndex->set_modifiedtimens(protobufFile.modifiedtimens());
+        folderInIndex->set_changetimens(protobufFile.changetimens());
+    });
+}
+
+void DirectoryIndexer::keepFolderEntry(const com::fileindexer::File& protobufFile, bool& found) {
+    const auto entry = mFolderLookup.find(protobufFile.name());
+    if (entry == mFolderLookup.end())
+        return;
+
+    // nothing changed below it, only its own metadata may have, which is listed with its parent
+    auto *folderInIndex = entry->second;
+    found = true;
+    const auto type = static_cast<com::fileindexer::Folder::FileType>(protobufFile.type());
+    if (folderInIndex->permissions() != protobufFile.permissions() ||
+        folderInIndex->type() != type ||
+        folderInIndex->modifiedtimens() != protobufFile.modifiedtimens() ||
+        folderInIndex->changetimens() != protobufFile.changetimens()) {
+        markDirty();
+        folderInIndex->set_permissions(protobufFile.permissions());
+        folderInIndex->set_type(type);
+        folderInIndex->set_modifiedtimens(protobufFile.modifiedtimens());
+        folderInIndex->set_changetimens(protobufFile.changetimens());
+    }
+}
+
+bool DirectoryIndexer::loadScanSnapshot() {
+    const std::filesystem::path snapshotPath = ChangeJournal::snapshotPath(mDir.path());
+    auto *snapshot = google::protobuf::Arena::CreateMessage<com::fileindexer::Folder>(mArena);
+    if (!IndexLog::load(snapshotPath, *snapshot) || snapshot->name() != mDir.path().string())
+        return false;
+    mFolderIndex.Swap(snapshot);
+    mIndexBase = snapshotPath;
+    std::lock_guard<std::mutex> lock(mDirty->mutex);
+    mDirty->names.clear();
+    return true;
+}
+
+int DirectoryIndexer::saveScanSnapshot() {
+    // never left torn: a snapshot missing changes the journal no longer holds would hide them
+    return dumpIndexToFile(ChangeJournal::snapshotPath(mDir.path()));
+}
+
+void DirectoryIndexer::addNewEntry(const std::filesystem::path& path, com::fileindexer::File& protobufFile, bool verbose, const DirectoryScanner::Entry& scanned) {
+    markDirty();
+    if (scanned.type == std::filesystem::file_type::directory) {
+        // reserve the slot now so the entry order matches the directory listing
+        // no matter when the subfolder task completes
+        auto *folderInIndex = mFolderIndex.add_folders();
+        mFolderLookup.emplace(protobufFile.name(), folderInIndex);
+        scheduleSubfolder([parent = this, folderInIndex, path, protobufFile, verbose]() {
+            DirectoryIndexer indexer(path, std::move(*folderInIndex), false);
+            parent->shareWalkWith(indexer);
+            indexer.mFolderIndex.set_name(protobufFile.name());     // names its dirty entries
+            indexer.indexonprotobuf(verbose);
+            indexer.mFolderIndex.set_permissions(protobufFile.permissions());
+            indexer.mFolderIndex.set_type(static_cast<com::fileindexer::Folder::FileType>(protobufFile.type()));
+            indexer.mFolderIndex.set_modifiedtimens(protobufFile.modifiedtimens());
+            indexer.mFolderIndex.set_changetimens(protobufFile.changetimens());
+            folderInIndex->Swap(&indexer.mFolderIndex);
+        });
     } else {
-        if (type == std::filesystem::file_type::regular) {
-            MD5Calculator hash(std::filesystem::canonical(file.path()), verbose);
-            std::string hashstring = hash.getDigest().to_string();
-            protobufFile.set_hash(hashstring);
-        }
-        *mFolderIndex.add_files() = protobufFile;
+        auto *fileInIndex = mFolderIndex.add_files();
+        *fileInIndex = protobufFile;
+        mFileLookup.emplace(protobufFile.name(), fileInIndex);
+        if (scanned.type == std::filesystem::file_type::regular)
+            scheduleHash(path, fileInIndex, scanned, verbose);
+    }
+}
+
+void DirectoryIndexer::scheduleSubfolder(WorkStealingPool::Task task)
+{
+    if ( mPool == nullptr || mSubfolderTasks == nullptr )
+    {
+        task();
+        return;
+    }
+    mPool->submit(*mSubfolderTasks, std::move(task));
+}
+
+void DirectoryIndexer::shareWalkWith(DirectoryIndexer &child) const
+{
+    child.mPool = mPool;
+    child.mHashPipeline = mHashPipeline;
+    child.mHashReuse = mHashReuse;
+    child.mHashCache = mHashCache;
+    child.mHashAlgorithm = mHashAlgorithm;
+    child.mChunkHashMinFileBytes = mChunkHashMinFileBytes;
+    child.mChunkHashBytes = mChunkHashBytes;
+    child.mChanges = mChanges;
+    child.mDirty = mDirty;
+}
+
+void DirectoryIndexer::adoptHashSettings(const DirectoryIndexer &other)
+{
+    // an index from before these were recorded was hashed whole with md5, which the defaults of the fields say
+    mHashAlgorithm = other.indexedHashAlgorithm();
+    mChunkHashMinFileBytes = other.mFolderIndex.chunkhashminfilesize();
+    mChunkHashBytes = other.mFolderIndex.chunkhashsize();
+}
+
+uint64_t DirectoryIndexer::chunkSizeFor(uint64_t fileSize) const
+{
+    if ( mChunkHashMinFileBytes == 0 || mChunkHashBytes == 0 || fileSize < mChunkHashMinFileBytes )
+        return 0;
+    return mChunkHashBytes;
+}
+
+bool DirectoryIndexer::reuseKnownHash(com::fileindexer::File &fileInIndex) const
+{
+    if ( mHashReuse == nullptr )
+        return false;
+
+    const auto known = mHashReuse->find({ .device = fileInIndex.device(), .inode = fileInIndex.inode(),
+                                          .size = fileInIndex.size(), .modifiedTimeNs = fileInIndex.modifiedtimens(),
+                                          .algorithm = fileInIndex.hashalgorithm(), .chunkSize = fileInIndex.chunksize() });
+    if ( known == mHashReuse->end() )
+        return false;
+
+    fileInIndex.set_hash(known->second.hash);
+    fileInIndex.mutable_chunkhashes()->Assign(known->second.chunkHashes.begin(), known->second.chunkHashes.end());
+    return true;
+}
+
+void DirectoryIndexer::scheduleHash(const std::filesystem::path &path, com::fileindexer::File *fileInIndex,
+                                    const DirectoryScanner::Entry &scanned, bool verbose)
+{
+    // tagged before any digest is written, so the entry is never queued twice for migration
+    const uint64_t chunkSize = chunkSizeFor(scanned.size);
+    fileInIndex->set_hashalgorithm(static_cast<com::fileindexer::File::HashAlgorithm>(mHashAlgorithm));
+    fileInIndex->clear_chunkhashes();
+    if ( chunkSize != 0 )
+        fileInIndex->set_chunksize(chunkSize);
+    else
+        fileInIndex->clear_chunksize();
+
+    // cheapest first: a digest from this index, then one from the machine wide cache, then read the file
+    if ( reuseKnownHash(*fileInIndex) )
+        return;
+
+    HashPipeline::HashJob job{ .path = path, .entry = fileInIndex,
+                               .cacheKey = { .device = scanned.device, .inode = scanned.inode, .size = scanned.size,
+                                             .modifiedTimeNs = timespec_to_ns(scanned.modifiedTime),
+                                             .changeTimeNs = timespec_to_ns(scanned.changeTime),
+                                             .algorithm = static_cast<uint64_t>(mHashAlgorithm) },
+                               .algorithm = mHashAlgorithm,
+                               .chunkSize = chunkSize,
+                               .verbose = verbose };
+
+    // the cache holds whole digests only, chunk trees are reused from the index alone
+    std::string digest;
+    if ( chunkSize == 0 && mHashCache != nullptr && mHashCache->lookup(job.cacheKey, digest) )
+    {
+        fileInIndex->set_hash(digest);
+        return;
     }
+
+    if ( mHashPipeline == nullptr )
+    {
+        HashPipeline::hashInto(job, mHashCache);
+        return;
+    }
+    mHashPipeline->enqueue(std::move(job));
 }
 
-void DirectoryIndexer::indexpath(const std::filesystem::path &path, bool verbose)
+void DirectoryIndexer::indexpath(DirectoryScanner &scanner, DirectoryScanner::Entry &entry, bool verbose)
 {
-    std::filesystem::directory_entry file(path);
+    const std::filesystem::path path = mDir.path() / entry.name;
 
-    std::filesystem::file_time_type indextime;
-    std::filesystem::file_time_type filetime;
-    std::filesystem::perms permissions;
-    std::filesystem::file_type type;
     // rudimentary loop to ensure the file time is not in the future
-    do
+    while (timespec_to_file_time(entry.modifiedTime) > std::filesystem::__file_clock::now())
     {
-        indextime = std::filesystem::__file_clock::now();
-        std::filesystem::file_status status = file.status();
-        permissions = status.permissions();
-        type = status.type();
-        filetime = file.last_write_time();
-    } while (filetime > indextime);
+        if (!scanner.refresh(entry))
+            return;
+    }
+    const std::filesystem::file_type type = entry.type;
 
     com::fileindexer::File protobufFile;
-    protobufFile.set_name(file.path());
-    protobufFile.set_permissions((int)permissions);
+    protobufFile.set_name(path);
+    protobufFile.set_permissions((int)entry.permissions);
     protobufFile.set_type((::com::fileindexer::File_FileType)type);
-    protobufFile.set_modifiedtime(file_time_to_string(filetime));
-    // Get the change time of the file
-    // This is a new field added to the protobuf definition
-    // It is needed to track permission changes and other metadata when content is not touched
+    protobufFile.set_modifiedtimens(timespec_to_ns(entry.modifiedTime));
+    // The change time tracks permission changes and other metadata when content is not touched
     // but the file's metadata (like permissions) changes.
-    struct stat fileInfo;
-    if (stat(file.path().c_str(), &fileInfo) == 0) {
-        // fileInfo.st_ctime contains the inode change time
-        struct timespec changetimespec = fileInfo.st_ctim;
-        protobufFile.set_changetime(file_time_to_string(changetimespec));
-    } else {
-        std::cerr << termcolor::red << "Error getting file info for: " << file.path() <<  termcolor::reset << "\r\n";
-    }
+    protobufFile.set_changetimens(timespec_to_ns(entry.changeTime));
+    protobufFile.set_device(entry.device);
+    protobufFile.set_inode(entry.inode);
+    protobufFile.set_size(entry.size);
 
     // Check for path and filename length warnings
-    std::string fullPath = file.path().string();
-    std::string filename = file.path().filename().string();
+    const std::string fullPath = path.string();
+    const std::string &filename = entry.name;
     
     if (fullPath.length() > TcpCommand::MAX_PATH_WARNING_LENGTH) {
         std::cout << termcolor::yellow << "Warning: Path length (" << termcolor::magenta << fullPath.length() 
@@ -333,25 +955,33 @@ void DirectoryIndexer::indexpath(const std::filesystem::path &path, bool verbose
                   << termcolor::reset << "\r\n";
     }
 
+    mSeenEntries.insert(protobufFile.name());
+
     bool found = false;
     if (type != std::filesystem::file_type::directory) {
-        updateFileEntry(file, protobufFile, verbose, found);
+        updateFileEntry(path, protobufFile, verbose, entry, found);
+    } else if (mChanges != nullptr && !entry.symlink && !mChanges->needsWalk(path)) {
+        // symlinked folders are not watched, they are always walked
+        keepFolderEntry(protobufFile, found);
     } else {
-        updateFolderEntry(file, protobufFile, verbose, found);
+        updateFolderEntry(path, protobufFile, verbose, found);
     }
 
     if (!found) {
-        addNewEntry(file, protobufFile, verbose, type);
+        addNewEntry(path, protobufFile, verbose, entry);
     }
 }
 
 size_t DirectoryIndexer::count( com::fileindexer::Folder *folderIndex, int recursionLevel)
 {
     if ( folderIndex == nullptr )
+    {
+        expandIndex();
         folderIndex = &mFolderIndex;
+    }
 
-    static size_t result=folderIndex->files_size();
-    for ( auto folder : *folderIndex->mutable_folders() )
+    size_t result = folderIndex->files_size();
+    for ( auto &folder : *folderIndex->mutable_folders() )
         result += count( &folder, recursionLevel + 1 );
     return result;
 }
@@ -362,60 +992,48 @@ void DirectoryIndexer::sync( com::fileindexer::Folder * folderIndex, DirectoryIn
         return;
 
     const bool topLevel = folderIndex == nullptr;
-    const bool forcePull = (past == nullptr);
-    const DirectoryIndexer *local = this;
 
     if (topLevel)
+    {
+        // the past indexes only answer lookups, they stay read in place or parsed as looked up
+        expandIndex();
+        remote->expandIndex();
         folderIndex = &remote->mFolderIndex;
+        // every lookup of the planning by path, rather than down from the root through the siblings,
+        // and the copy sources by digest in the two indexes that get searched for them
+        for (DirectoryIndexer *indexer : { this, past, remote, remotePast })
+        {
+            if (indexer != nullptr)
+                indexer->buildPathLookup(indexer == this || indexer == remote);
+        }
+    }
 
-    syncFolders(folderIndex, past, remote, remotePast, syncCommands, verbose, isRemote, local, forcePull);
-    syncFiles(folderIndex, past, remote, remotePast, syncCommands, verbose, isRemote, local, forcePull);
+    auto *localFolder = topLevel ? &mFolderIndex :
+        static_cast<com::fileindexer::Folder *>(extract(nullptr, mDir.path().string() + "/" + folderIndex->name().substr(remote->mDir.path().string().length() + 1), FOLDER));
+    SyncPlanner(*this, past, *remote, remotePast, verbose, isRemote).plan(localFolder, folderIndex, topLevel, syncCommands);
 
     if (topLevel)
     {
-        if (verbose)
-            std::cout << "\r\n" << "Exporting sync commands from local to remote" << "\r\n";
-        
-        remote->sync(&mFolderIndex, remotePast, this, past, syncCommands, verbose, true);
-        
         postProcessSyncCommands(syncCommands, remote);
+
+        for (DirectoryIndexer *indexer : { this, past, remote, remotePast })
+        {
+            if (indexer != nullptr)
+                indexer->dropPathLookup();
+        }
     }
 }
 
-void DirectoryIndexer::syncFolders(com::fileindexer::Folder *folderIndex, DirectoryIndexer *past, DirectoryIndexer *remote, DirectoryIndexer *remotePast, SyncCommands &syncCommands, bool verbose, bool isRemote, const DirectoryIndexer *local, bool forcePull)
+com::fileindexer::Folder *DirectoryIndexer::syncMissingFolder(com::fileindexer::Folder &remoteFolder, const std::string &localFolderPath, DirectoryIndexer *past, SyncCommands &syncCommands, bool isRemote, bool forcePull)
 {
-    for (auto &remoteFolder : *folderIndex->mutable_folders())
-    {
-        auto remoteFolderPath = remoteFolder.name();
-        auto localFolderPath = local->mDir.path().string() + "/" + remoteFolderPath.substr(remote->mDir.path().string().length() + 1);
-        if (verbose)
-            std::cout << termcolor::cyan << "Entering " << remoteFolderPath << termcolor::reset << "\r\n";
-
-        if (nullptr != extract(nullptr, localFolderPath, FOLDER))
-        {
-            if (verbose)
-                std::cout << termcolor::cyan << "folder exists! " << localFolderPath << termcolor::reset << "\r\n";
-            sync(&remoteFolder, past, remote, remotePast, syncCommands, verbose, isRemote);
-        }
-        else
-        {
-            if (verbose)
-                std::cout << termcolor::cyan << "folder missing! " << localFolderPath << termcolor::reset << "\r\n";
+    // deleted here since the last run, the remote folder goes
+    if (!forcePull && past->extract(nullptr, localFolderPath, FOLDER) != nullptr)
+        return nullptr;
 
-            if (forcePull || (past->extract(nullptr, localFolderPath, FOLDER) == nullptr))
-            {
-                checkPathLengthWarnings(localFolderPath, "mkdir");
-                syncCommands.emplace_back("mkdir", localFolderPath, "", isRemote);
-                copyTo(nullptr, &remoteFolder, localFolderPath, FOLDER);
-                sync(&remoteFolder, past, remote, remotePast, syncCommands, verbose, isRemote);
-            }
-            else
-            {
-                sync(&remoteFolder, past, remote, remotePast, syncCommands, verbose, isRemote);
-                syncCommands.emplace_back("rmdir", remoteFolderPath, "", !isRemote);
-            }
-        }
-    }
+    checkPathLengthWarnings(localFolderPath, "mkdir");
+    syncCommands.emplace_back("mkdir", localFolderPath, "", isRemote);
+    copyTo(nullptr, &remoteFolder, localFolderPath, FOLDER);
+    return static_cast<com::fileindexer::Folder *>(extract(nullptr, localFolderPath, FOLDER));
 }
 
 void DirectoryIndexer::handleFileConflict(com::fileindexer::File* remoteFile, com::fileindexer::File* localFile, 
@@ -438,8 +1056,8 @@ void DirectoryIndexer::handleFileConflict(com::fileindexer::File* remoteFile, co
 
     std::cout << termcolor::red << "CONFLICT: File content differs between " << localFilePath << " and " << remoteFilePath << "\r\n";
     std::cout << termcolor::yellow << "  Each side will keep their version and receive the other side's version\r\n";
-    std::cout << "  Client modified time: " << localFile->modifiedtime() << "\r\n";
-    std::cout << "  Server modified time: " << remoteFile->modifiedtime() << "\r\n" << termcolor::reset;
+    std::cout << "  Client modified time: " << file_time_to_string(ns_to_timespec(localFile->modifiedtimens())) << "\r\n";
+    std::cout << "  Server modified time: " << file_time_to_string(ns_to_timespec(remoteFile->modifiedtimens())) << "\r\n" << termcolor::reset;
     
     // Step 1: Send copy of file to the other computer
     const std::string targetFilename = isRemote ? localClientFilename : localServerFilename;
@@ -457,20 +1075,13 @@ void DirectoryIndexer::handleFileConflict(com::fileindexer::File* remoteFile, co
     // No need to update hashes as we're preserving both versions
 }
 
-void DirectoryIndexer::handleFileExists(com::fileindexer::File& remoteFile, com::fileindexer::File* localFile, const std::string& remoteFilePath, const std::string& localFilePath, SyncCommands &syncCommands, bool isRemote)
+void DirectoryIndexer::handleFileExists(com::fileindexer::File& remoteFile, com::fileindexer::File* localFile, const std::string& remoteFilePath, const std::string& localFilePath, DirectoryIndexer* remote, SyncCommands &syncCommands, bool isRemote)
 {
-    const FILE_TIME_COMP_RESULT mtimeComparisonResult = compareFileTime(remoteFile.modifiedtime(), localFile->modifiedtime());
-    const FILE_TIME_COMP_RESULT ctimeComparisonResult = compareFileTime(remoteFile.changetime(), localFile->changetime());      //we don't really work with ctime because we can't write to it, but we need to check it still for permissions and metadata changes
-    const bool isContentIdentical = (remoteFile.hash() == localFile->hash());
+    const FILE_TIME_COMP_RESULT mtimeComparisonResult = compareFileTime(remoteFile.modifiedtimens(), localFile->modifiedtimens());
+    const FILE_TIME_COMP_RESULT ctimeComparisonResult = compareFileTime(remoteFile.changetimens(), localFile->changetimens());      //we don't really work with ctime because we can't write to it, but we need to check it still for permissions and metadata changes
+    const bool isContentIdentical = isSameContent(remoteFile, *localFile);
     const bool isPermissionsIdentical = (remoteFile.permissions() == localFile->permissions());
 
-    if (mtimeComparisonResult == FILE_TIME_COMP_RESULT::FILE_TIME_LENGTH_MISMATCH ||
-        ctimeComparisonResult == FILE_TIME_COMP_RESULT::FILE_TIME_LENGTH_MISMATCH)
-    {
-        std::cout << termcolor::red << "ERROR IN COMPARING FILE TIMES, STRING OF DIFFERENT LENGTHS !!" << termcolor::reset << "\r\n";
-        return; // Exit early to avoid further processing
-    }
-
 
     if (!isContentIdentical)
     {
@@ -485,9 +1096,14 @@ void DirectoryIndexer::handleFileExists(com::fileindexer::File& remoteFile, com:
             /* this is a file replace, no need to erase the old file */
             //syncCommands.emplace_back("rm", localFilePath, "", isRemote );
             syncCommands.emplace_back(isRemote ? "push" : "fetch", remoteFilePath, localFilePath, !isRemote );
-            localFile->set_hash(remoteFile.hash());
-            localFile->set_modifiedtime(remoteFile.modifiedtime());
-            localFile->set_changetime(remoteFile.changetime()); // can't really control the change time on the disk, but we set it in the index reverse comparison finds it equal
+            {
+                const std::lock_guard<std::mutex> lock(mLookupMutex);
+                forgetContent(*localFile);
+                copyDigest(*localFile, remoteFile);
+                rememberContent(*localFile);
+            }
+            localFile->set_modifiedtimens(remoteFile.modifiedtimens());
+            localFile->set_changetimens(remoteFile.changetimens()); // can't really control the change time on the disk, but we set it in the index reverse comparison finds it equal
         }
         else
         {
@@ -495,9 +1111,14 @@ void DirectoryIndexer::handleFileExists(com::fileindexer::File& remoteFile, com:
             /* this is a file replace, no need to erase the old file */
             //syncCommands.emplace_back("rm", remoteFilePath, "", !isRemote );
             syncCommands.emplace_back(isRemote ? "fetch" : "push", localFilePath, remoteFilePath, !isRemote );
-            remoteFile.set_hash(localFile->hash());
-            remoteFile.set_modifiedtime(localFile->modifiedtime());
-            remoteFile.set_changetime(localFile->changetime()); // can't really control the change time on the disk, but we set it in the index reverse comparison finds it equal
+            {
+                const std::lock_guard<std::mutex> lock(remote->mLookupMutex);
+                remote->forgetContent(remoteFile);
+                copyDigest(remoteFile, *localFile);
+                remote->rememberContent(remoteFile);
+            }
+            remoteFile.set_modifiedtimens(localFile->modifiedtimens());
+            remoteFile.set_changetimens(localFile->changetimens()); // can't really control the change time on the disk, but we set it in the index reverse comparison finds it equal
         }
     }
     if ( !isPermissionsIdentical )
@@ -518,7 +1139,7 @@ void DirectoryIndexer::handleFileExists(com::fileindexer::File& remoteFile, com:
             oss << std::oct << remoteFile.permissions();
             syncCommands.emplace_back(isRemote ? "system" : "chmod", isRemote ? "chmod " + oss.str() : oss.str(), "\"" + localFilePath + "\"", isRemote);
             localFile->set_permissions(remoteFile.permissions());
-            localFile->set_changetime(remoteFile.changetime());
+            localFile->set_changetimens(remoteFile.changetimens());
         }
         else
         {
@@ -527,7 +1148,7 @@ void DirectoryIndexer::handleFileExists(com::fileindexer::File& remoteFile, com:
             oss << std::oct << localFile->permissions();
             syncCommands.emplace_back( !isRemote ? "system" : "chmod", !isRemote ? "chmod " + oss.str() : oss.str(), "\"" + remoteFilePath + "\"", !isRemote );
             remoteFile.set_permissions(localFile->permissions());
-            remoteFile.set_changetime(localFile->changetime());
+            remoteFile.set_changetimens(localFile->changetimens());
         }
     }
     if ( mtimeComparisonResult != FILE_TIME_COMP_RESULT::FILE_TIME_EQUAL && isContentIdentical && isPermissionsIdentical)
@@ -539,37 +1160,37 @@ void DirectoryIndexer::handleFileExists(com::fileindexer::File& remoteFile, com:
             /* remote file is younger */
             
             if (isRemote)
-                syncCommands.emplace_back("touch", localFilePath, remoteFile.modifiedtime(), isRemote);
+                syncCommands.emplace_back("touch", localFilePath, file_time_to_string(ns_to_timespec(remoteFile.modifiedtimens())), isRemote);
             else
             {
                 struct timespec remoteModifiedTimeSpec[2];
                 
                 remoteModifiedTimeSpec[0].tv_sec = 0;
                 remoteModifiedTimeSpec[0].tv_nsec = UTIME_OMIT;
-                make_timespec(remoteFile.modifiedtime(), &remoteModifiedTimeSpec[1]);
+                remoteModifiedTimeSpec[1] = ns_to_timespec(remoteFile.modifiedtimens());
                 utimensat(0, localFilePath.c_str(), remoteModifiedTimeSpec, 0);
             }
 
-            localFile->set_modifiedtime(remoteFile.modifiedtime());
-            localFile->set_changetime(remoteFile.changetime());
+            localFile->set_modifiedtimens(remoteFile.modifiedtimens());
+            localFile->set_changetimens(remoteFile.changetimens());
         }
         else
         {
             /* local file is younger */
             if (!isRemote)
-                syncCommands.emplace_back("touch", remoteFilePath, localFile->modifiedtime(), !isRemote);
+                syncCommands.emplace_back("touch", remoteFilePath, file_time_to_string(ns_to_timespec(localFile->modifiedtimens())), !isRemote);
             else
             {
                 struct timespec localModifiedTimeSpec[2];
 
                 localModifiedTimeSpec[0].tv_sec = 0;
                 localModifiedTimeSpec[0].tv_nsec = UTIME_OMIT;
-                make_timespec(localFile->modifiedtime(), &localModifiedTimeSpec[1]);
+                localModifiedTimeSpec[1] = ns_to_timespec(localFile->modifiedtimens());
                 utimensat(0, remoteFilePath.c_str(), localModifiedTimeSpec, 0);
             }
 
-            remoteFile.set_modifiedtime(localFile->modifiedtime());
-            remoteFile.set_changetime(localFile->changetime());
+            remoteFile.set_modifiedtimens(localFile->modifiedtimens());
+            remoteFile.set_changetimens(localFile->changetimens());
         }
 
         std::cout << termcolor::green << "Files are identical: " << remoteFilePath << " and " << localFilePath << termcolor::reset << "\r\n";
@@ -582,47 +1203,26 @@ void DirectoryIndexer::handleFileMissing(com::fileindexer::File& remoteFile, con
 {
     if (forcePull)
     {
-        auto fileList = findFileFromHash(nullptr, remoteFile.hash(), true, verbose);
-        if (fileList.empty())
-        {
-            checkPathLengthWarnings(localFilePath, "fetch/push missing file");
-            syncCommands.emplace_back(isRemote ? "push" : "fetch", remoteFilePath, localFilePath, !isRemote);
-        }
-        else
-        {
-            checkPathLengthWarnings(localFilePath, "copy missing file");
-            syncCommands.emplace_back("cp", (*fileList.cbegin())->name(), localFilePath, isRemote);
-        }
+        SyncPlanner::planFetch(*this, SyncPlanner::PendingFetch{ .remoteFilePath = remoteFilePath, .localFilePath = localFilePath, .reason = "missing",
+                                                                 .permissions = remoteFile.permissions(), .withChmod = false, .isRemote = isRemote },
+                               remoteFile, syncCommands, verbose);
         copyTo(nullptr, &remoteFile, localFilePath, FILE);
     }
     else
     {
         auto *localPastFile = static_cast<com::fileindexer::File *>(past->extract(nullptr, localFilePath, FILE));
-        auto localCopiesList = findFileFromHash(nullptr, remoteFile.hash(), true, verbose);
         auto *remotePastFile = remotePast != nullptr ?static_cast<com::fileindexer::File *>(remotePast->extract(nullptr, remoteFilePath, FILE)) : nullptr;
         if (localPastFile != nullptr)
         {
             // We have a past version of the file, but no current version on the local side
             // Check if the remote file was modified compared to the past version
-            if (remoteFile.hash() != localPastFile->hash())
+            if (!isSameContent(remoteFile, *localPastFile))
             {
                 // The file was modified on the remote side, so it should be preserved
                 // Fetch the modified version to the local side
-                auto fileList = findFileFromHash(nullptr, remoteFile.hash(), true, verbose);
-                if (fileList.empty())
-                {
-                    checkPathLengthWarnings(localFilePath, "fetch/push modified file");
-                    syncCommands.emplace_back(isRemote ? "push" : "fetch", remoteFilePath, localFilePath, !isRemote);
-                }
-                else
-                {
-                    checkPathLengthWarnings(localFilePath, "copy modified file");
-                    syncCommands.emplace_back("cp", (*fileList.cbegin())->name(), localFilePath, isRemote);
-
-                    std::ostringstream oss;
-                    oss << std::oct << remoteFile.permissions();
-                    syncCommands.emplace_back(isRemote ? "system" : "chmod", isRemote ? "chmod " + oss.str() : oss.str(), "\"" + localFilePath + "\"", isRemote);
-                }
+                SyncPlanner::planFetch(*this, SyncPlanner::PendingFetch{ .remoteFilePath = remoteFilePath, .localFilePath = localFilePath, .reason = "modified",
+                                                                         .permissions = remoteFile.permissions(), .withChmod = true, .isRemote = isRemote },
+                                       remoteFile, syncCommands, verbose);
                 copyTo(nullptr, &remoteFile, localFilePath, FILE);
             }
             else
@@ -640,90 +1240,74 @@ void DirectoryIndexer::handleFileMissing(com::fileindexer::File& remoteFile, con
         }
         else
         {
-            if (localCopiesList.empty())
-            {
-                checkPathLengthWarnings(localFilePath, "fetch/push new file");
-                syncCommands.emplace_back(isRemote ? "push" : "fetch", remoteFilePath, localFilePath, !isRemote);
-            }
-            else
-            {
-                std::cout << termcolor::yellow << "File " << termcolor::magenta << remoteFilePath << termcolor::yellow << " is missing locally, but found in remote index with hash " << termcolor::magenta << remoteFile.hash() << termcolor::reset << "\r\n";
-                checkPathLengthWarnings(localFilePath, "copy new file");
-                syncCommands.emplace_back("cp", (*localCopiesList.cbegin())->name(), localFilePath, isRemote);
-                
-                std::ostringstream oss;
-                oss << std::oct << remoteFile.permissions();
-                syncCommands.emplace_back(isRemote ? "system" : "chmod", isRemote ? "chmod " + oss.str() : oss.str(), "\"" + localFilePath + "\"", isRemote);
-            }
+            SyncPlanner::planFetch(*this, SyncPlanner::PendingFetch{ .remoteFilePath = remoteFilePath, .localFilePath = localFilePath, .reason = "new",
+                                                                     .permissions = remoteFile.permissions(), .withChmod = true, .isRemote = isRemote },
+                                   remoteFile, syncCommands, verbose);
             copyTo(nullptr, &remoteFile, localFilePath, FILE);
         }
     }
 }
 
-void DirectoryIndexer::syncFiles(com::fileindexer::Folder *folderIndex, DirectoryIndexer *past, DirectoryIndexer *remote, DirectoryIndexer *remotePast, SyncCommands &syncCommands, bool verbose, bool isRemote, const DirectoryIndexer *local, bool forcePull)
+void DirectoryIndexer::syncFile(com::fileindexer::File &remoteFile, com::fileindexer::File *localFile, DirectoryIndexer *past, DirectoryIndexer *remote, DirectoryIndexer *remotePast, SyncCommands &syncCommands, bool verbose, bool isRemote, bool forcePull)
 {
-    for (auto &remoteFile : *folderIndex->mutable_files())
+    auto remoteFilePath = remoteFile.name();
+    auto localFilePath = mDir.path().string() + "/" + remoteFilePath.substr(remote->mDir.path().string().length() + 1);
+    if (verbose)
+        std::cout << termcolor::cyan << "checking " << remoteFilePath << termcolor::reset << "\r\n";
+
+    if (localFile != nullptr)
     {
-        auto remoteFilePath = remoteFile.name();
-        auto localFilePath = local->mDir.path().string() + "/" + remoteFilePath.substr(remote->mDir.path().string().length() + 1);
         if (verbose)
-            std::cout << termcolor::cyan << "checking " << remoteFilePath << termcolor::reset << "\r\n";
+            std::cout << termcolor::cyan << "file exists! " << localFilePath << termcolor::reset << "\r\n";
 
-        auto *localFile = static_cast<com::fileindexer::File *>(extract(nullptr, localFilePath, FILE));
-        if (localFile != nullptr)
-        {
-            if (verbose)
-                std::cout << termcolor::cyan << "file exists! " << localFilePath << termcolor::reset << "\r\n";
-
-            auto *localPastFile = past == nullptr ? nullptr : static_cast<com::fileindexer::File *>(past->extract(nullptr, localFilePath, FILE));
-            auto *remotePastFile = remotePast == nullptr ? nullptr : static_cast<com::fileindexer::File *>(remotePast->extract(nullptr, remoteFilePath, FILE));
-            bool isLocalPastFile = (localPastFile != nullptr);
-            bool isRemotePastFile = (remotePastFile != nullptr);
+        auto *localPastFile = past == nullptr ? nullptr : static_cast<com::fileindexer::File *>(past->extract(nullptr, localFilePath, FILE));
+        auto *remotePastFile = remotePast == nullptr ? nullptr : static_cast<com::fileindexer::File *>(remotePast->extract(nullptr, remoteFilePath, FILE));
+        bool isLocalPastFile = (localPastFile != nullptr);
+        bool isRemotePastFile = (remotePastFile != nullptr);
 
-            if (remoteFile.hash() != localFile->hash())
+        if (!isSameContent(remoteFile, *localFile))
+        {
+            std::cout << termcolor::magenta << "Conflict detected between " << localFilePath << " and " << remoteFilePath << termcolor::reset << "\r\n";
+            
+            if ((!isRemotePastFile && !isLocalPastFile) || ( !(isRemotePastFile && isLocalPastFile)) || !isSameContent(*remotePastFile, *localPastFile) )
             {
+                // Neither has a past version, This is a file creation conflict case
                 std::cout << termcolor::magenta << "Conflict detected between " << localFilePath << " and " << remoteFilePath << termcolor::reset << "\r\n";
-                
-                if ((!isRemotePastFile && !isLocalPastFile) || ( !(isRemotePastFile && isLocalPastFile)) || (remotePastFile->hash() != localPastFile->hash()) )
-                {
-                    // Neither has a past version, This is a file creation conflict case
-                    std::cout << termcolor::magenta << "Conflict detected between " << localFilePath << " and " << remoteFilePath << termcolor::reset << "\r\n";
-                    handleFileConflict(&remoteFile, localFile, remoteFilePath, localFilePath, syncCommands, isRemote);
-                } else if ( (isRemotePastFile && isLocalPastFile) && (remoteFile.hash() != localFile->hash()) )
+                handleFileConflict(&remoteFile, localFile, remoteFilePath, localFilePath, syncCommands, isRemote);
+            } else if ( (isRemotePastFile && isLocalPastFile) && !isSameContent(remoteFile, *localFile) )
+            {
+                if ( isSameContent(*remotePastFile, *localPastFile) )
                 {
-                    if ( remotePastFile->hash() == localPastFile->hash() )
+                    const com::fileindexer::File &previousFile = *remotePastFile;
+
+                    if ( isSameContent(previousFile, remoteFile) || isSameContent(previousFile, *localFile) )
+                    {
+                        std::cout << termcolor::white << "File was modified by one side, sync newer copy" << termcolor::reset << "\r\n";
+                        handleFileExists(remoteFile, localFile, remoteFilePath, localFilePath, remote, syncCommands, isRemote);
+                    } else
                     {
-                        const std::string previousHash = remotePastFile->hash();
-
-                        if ( (previousHash == remoteFile.hash()) || (previousHash == localFile->hash()) )
-                        {
-                            std::cout << termcolor::white << "File was modified by one side, sync newer copy" << termcolor::reset << "\r\n";
-                            handleFileExists(remoteFile, localFile, remoteFilePath, localFilePath, syncCommands, isRemote);
-                        } else
-                        {
-                            // Both have a past version, this is a file modification conflict case
-                            std::cout << termcolor::magenta << "Conflict detected between " << localFilePath << " and " << remoteFilePath << termcolor::reset << "\r\n";
-                            handleFileConflict(&remoteFile, localFile, remoteFilePath, localFilePath, syncCommands, isRemote);
-                        }
+                        // Both have a past version, this is a file modification conflict case
+                        std::cout << termcolor::magenta << "Conflict detected between " << localFilePath << " and " << remoteFilePath << termcolor::reset << "\r\n";
+                        handleFileConflict(&remoteFile, localFile, remoteFilePath, localFilePath, syncCommands, isRemote);
                     }
-                } else
-                {
-                    // One of them has a past version, this is an out-of-sync error
-                    std::cout << termcolor::red << "Out-of-sync error detected between " << localFilePath << " and " << remoteFilePath << termcolor::reset << "\r\n";
                 }
-            }
-            else
+            } else
             {
-                handleFileExists(remoteFile, localFile, remoteFilePath, localFilePath, syncCommands, isRemote);
+                // One of them has a past version, this is an out-of-sync error
+                std::cout << termcolor::red << "Out-of-sync error detected between " << localFilePath << " and " << remoteFilePath << termcolor::reset << "\r\n";
             }
         }
         else
         {
-            if (verbose)
-                std::cout << termcolor::white << "file missing! " << localFilePath << termcolor::reset << "\r\n";
-            handleFileMissing(remoteFile, remoteFilePath, localFilePath, past, remotePast, syncCommands, isRemote, forcePull, verbose);
+            handleFileExists(remoteFile, localFile, remoteFilePath, localFilePath, remote, syncCommands, isRemote);
         }
     }
+    else
+    {
+        if (verbose)
+            std::cout << termcolor::white << "file missing! " << localFilePath << termcolor::reset << "\r\n";
+        handleFileMissing(remoteFile, remoteFilePath, localFilePath, past, remotePast, syncCommands, isRemote, forcePull, verbose);
+    }
 }
 
 void DirectoryIndexer::postProcessSyncCommands(SyncCommands &syncCommands, DirectoryIndexer *remote)
@@ -787,53 +1371,66 @@ bool DirectoryIndexer::isPathInFolder(const std::filesystem::path& pathToCheck,
     });
 }
 
+void DirectoryIndexer::indexChildrenByName(const com::fileindexer::Folder& folder, std::unordered_set<std::string_view>& files, std::unordered_map<std::string_view, const com::fileindexer::Folder*>& folders) {
+    files.reserve(static_cast<size_t>(folder.files_size()));
+    for (const auto& file : folder.files())
+        files.insert(file.name());
+    folders.reserve(static_cast<size_t>(folder.folders_size()));
+    for (const auto& subFolder : folder.folders())
+        folders.emplace(subFolder.name(), &subFolder);
+}
+
 void DirectoryIndexer::findDeletedRecursive(const com::fileindexer::Folder& currentFolder, const com::fileindexer::Folder& lastRunFolder, const std::filesystem::path& basePath, std::vector<std::string>& deletions) {
+    // the current entries by name, each one of the last run then looked up once
+    std::unordered_set<std::string_view> currentFiles;
+    std::unordered_map<std::string_view, const com::fileindexer::Folder*> currentSubFolders;
+    indexChildrenByName(currentFolder, currentFiles, currentSubFolders);
+
     // Check for deleted files in the lastRunFolder
     for (const auto& lastRunFile : lastRunFolder.files()) {
-        std::filesystem::path filePath = basePath / lastRunFile.name();
-        bool foundInCurrent = false;
-        for (const auto& currentFile : currentFolder.files()) {
-            if (currentFile.name() == lastRunFile.name()) {
-                foundInCurrent = true;
-                break;
-            }
-        }
-        if (!foundInCurrent) {
+        if (!currentFiles.contains(lastRunFile.name())) {
             // Construct the full path relative to the DirectoryIndexer's root and convert to string
-            deletions.push_back(filePath.string());
+            deletions.push_back((basePath / lastRunFile.name()).string());
         }
     }
 
     // Check for deleted subfolders in the lastRunFolder
     for (const auto& lastRunSubFolder : lastRunFolder.folders()) {
-        std::filesystem::path folderPath = basePath / lastRunSubFolder.name();
-        bool foundInCurrent = false;
-        const com::fileindexer::Folder* currentMatchingSubFolder = nullptr;
-        for (const auto& currentSubFolder : currentFolder.folders()) {
-            if (currentSubFolder.name() == lastRunSubFolder.name()) {
-                foundInCurrent = true;
-                currentMatchingSubFolder = &currentSubFolder;
-                break;
-            }
-        }
-        if (!foundInCurrent) {
-            // If the whole folder is deleted, add its path (as string)
-            deletions.push_back(folderPath.string());
-            // To list all contents of the deleted folder, you would iterate through lastRunSubFolder files/folders
-            // and add their paths as strings to the deletions vector, relative to folderPath.
-            // For example:
-            // for (const auto& deletedSubFile : lastRunSubFolder.files()) {
-            //     deletions.push_back((this->mDir.path() / folderPath / deletedSubFile.name()).string());
-            // }
-            // ... and recursively for sub-folders within the deleted folder.
-            // The current implementation just marks the top-level deleted folder.
-        } else if (currentMatchingSubFolder != nullptr) {
+        const auto currentMatchingSubFolder = currentSubFolders.find(lastRunSubFolder.name());
+        if (currentMatchingSubFolder == currentSubFolders.end()) {
+            // a whole deleted folder is one entry, its content goes with it
+            deletions.push_back((basePath / lastRunSubFolder.name()).string());
+        } else {
             // If folder exists, recurse into it
-            findDeletedRecursive(*currentMatchingSubFolder, lastRunSubFolder, "", deletions);
+            findDeletedRecursive(*currentMatchingSubFolder->second, lastRunSubFolder, "", deletions);
         }
     }
 }
 
+void DirectoryIndexer::findDeletedFlat(const com::fileindexer::Folder& currentFolder, const FlatIndex& lastRun, uint32_t lastRunFolder, std::vector<std::string>& deletions) {
+    // same comparison as findDeletedRecursive, the last run read in place
+    std::unordered_set<std::string_view> currentFiles;
+    std::unordered_map<std::string_view, const com::fileindexer::Folder*> currentSubFolders;
+    indexChildrenByName(currentFolder, currentFiles, currentSubFolders);
+
+    const uint32_t firstSubFolder = lastRunFolder + 1 + lastRun.fileCount(lastRunFolder);
+    for (uint32_t lastRunFile = lastRunFolder + 1; lastRunFile < firstSubFolder; ++lastRunFile) {
+        const std::string_view name = lastRun.name(lastRunFile);
+        if (!currentFiles.contains(name))
+            deletions.emplace_back(name);
+    }
+
+    const uint32_t end = lastRun.subtreeEnd(lastRunFolder);
+    for (uint32_t lastRunSubFolder = firstSubFolder; lastRunSubFolder < end; lastRunSubFolder = lastRun.subtreeEnd(lastRunSubFolder)) {
+        const std::string_view name = lastRun.name(lastRunSubFolder);
+        const auto currentMatchingSubFolder = currentSubFolders.find(name);
+        if (currentMatchingSubFolder == currentSubFolders.end())
+            deletions.emplace_back(name);
+        else
+            findDeletedFlat(*currentMatchingSubFolder->second, lastRun, lastRunSubFolder, deletions);
+    }
+}
+
 
 com::fileindexer::File * DirectoryIndexer::findFileAtPath( com::fileindexer::Folder * folderIndex, const std::string & path, bool verbose )
 {
@@ -909,8 +1506,16 @@ com::fileindexer::Folder * DirectoryIndexer::findFolderFromName( const std::file
     return nullptr;
 }
 
-std::list<com::fileindexer::File *> DirectoryIndexer::findFileFromHash( com::fileindexer::Folder * folderIndex, const std::string & hash, bool stopAtFirst, bool verbose)
+std::list<com::fileindexer::File *> DirectoryIndexer::findFileFromHash( com::fileindexer::Folder * folderIndex, const com::fileindexer::File & content, bool stopAtFirst, bool verbose)
 {
+    if ( folderIndex == nullptr && mContentLookupActive )
+    {
+        // the digests decide only against files hashed the same way, any other is compared by size and time on the walk
+        const auto scheme = mContentSchemes.begin();
+        if ( mContentSchemes.empty() ||
+             ( mContentSchemes.size() == 1 && scheme->first == std::pair<int, uint64_t>( content.hashalgorithm(), content.chunksize() ) ) )
+            return findFileFromDigest( content, stopAtFirst );
+    }
     if ( folderIndex == nullptr )
         folderIndex = &mFolderIndex;
 
@@ -918,13 +1523,13 @@ std::list<com::fileindexer::File *> DirectoryIndexer::findFileFromHash( com::fil
 
     for ( auto &folder : *folderIndex->mutable_folders() )
     {
-        auto files = findFileFromHash( &folder, hash, stopAtFirst, verbose );
+        auto files = findFileFromHash( &folder, content, stopAtFirst, verbose );
         if ( !files.empty() )
             files_list.insert(files_list.end(), files.begin(), files.end());
     }
     for ( auto &file : *folderIndex->mutable_files() )
     {
-        if ( file.hash() == hash )
+        if ( isSameContent( file, content ) )
         {
             files_list.push_back(&file);
             if ( stopAtFirst )
@@ -934,6 +1539,24 @@ std::list<com::fileindexer::File *> DirectoryIndexer::findFileFromHash( com::fil
     return files_list;
 }
 
+std::list<com::fileindexer::File *> DirectoryIndexer::findFileFromDigest( const com::fileindexer::File & content, bool stopAtFirst )
+{
+    std::list<com::fileindexer::File *> files_list;
+
+    // in name order, the first of the files with the digest wherever the planning looks it up from
+    auto [first, last] = mContentLookup.equal_range( std::string_view( content.hash() ) );
+    for ( auto it = first; it != last; ++it )
+    {
+        if ( isSameContent( **it, content ) )
+        {
+            files_list.push_back( *it );
+            if ( stopAtFirst )
+                return files_list;
+        }
+    }
+    return files_list;
+}
+
 std::list<std::string> DirectoryIndexer::__extractPathComponents( const std::filesystem::path & filepath, const bool verbose )
 {
     std::filesystem::path pathcopy = filepath;
@@ -974,6 +1597,12 @@ void* DirectoryIndexer::extractRecursive(com::fileindexer::Folder* folderIndex,
 
 void * DirectoryIndexer::extract( com::fileindexer::Folder * folderIndex, const std::string & path, const PATH_TYPE type )
 {
+    if ( folderIndex == nullptr && ( mFlatIndex != nullptr || mPathLookupActive ) )
+    {
+        // subtrees planned in parallel look up at once, and a lookup may convert or expand entries
+        const std::lock_guard<std::mutex> lock( mLookupMutex );
+        return mFlatIndex != nullptr ? extractFlat( path, type ) : extractByPath( path, type );
+    }
     if ( folderIndex == nullptr )
         folderIndex = &mFolderIndex;
 
@@ -981,6 +1610,8 @@ void * DirectoryIndexer::extract( com::fileindexer::Folder * folderIndex, const
         return nullptr;
     if ( path == folderIndex->name() )
         return folderIndex;
+    if ( mLazyIndex != nullptr )
+        mLazyIndex->expand( *folderIndex );
 
     if ( path.find_last_of('/') == folderIndex->name().length() )
     {
@@ -1000,10 +1631,85 @@ void * DirectoryIndexer::extract( com::fileindexer::Folder * folderIndex, const
     return nullptr;
 }
 
+void *DirectoryIndexer::extractFlat( const std::string &path, const PATH_TYPE type )
+{
+    if ( !path.starts_with( mFolderIndex.name() ) )
+        return nullptr;
+    if ( path == mFolderIndex.name() )
+        return &mFolderIndex;
+
+    const uint32_t entry = mFlatIndex->find( path );
+    if ( entry == FLAT_INDEX_NO_ENTRY || entry == 0 || mFlatIndex->isFolder( entry ) != ( type == FOLDER ) )
+        return nullptr;
+    const auto converted = mFlatEntries.find( entry );
+    if ( converted != mFlatEntries.end() )
+        return converted->second;
+
+    // converted once, on the arena, so the pointer stays valid like one into the tree
+    google::protobuf::Message *message = nullptr;
+    if ( type == FOLDER )
+    {
+        auto *folder = google::protobuf::Arena::CreateMessage<com::fileindexer::Folder>( mArena );
+        mFlatIndex->toFolderEntry( entry, *folder );
+        message = folder;
+    }
+    else
+    {
+        auto *file = google::protobuf::Arena::CreateMessage<com::fileindexer::File>( mArena );
+        mFlatIndex->toFile( entry, *file );
+        message = file;
+    }
+    mFlatEntries.emplace( entry, message );
+    return message;
+}
+
+void *DirectoryIndexer::extractByPath( const std::string &path, const PATH_TYPE type )
+{
+    const std::string_view target( path );
+    if ( !target.starts_with( mFolderIndex.name() ) )
+        return nullptr;
+    if ( target == mFolderIndex.name() )
+        return &mFolderIndex;
+
+    if ( mLazyIndex != nullptr )
+    {
+        // every folder above the entry is parsed first, its entries joining the lookup
+        auto *folder = &mFolderIndex;
+        size_t slash = mFolderIndex.name().size();
+        while ( true )
+        {
+            if ( mLazyIndex->expand( *folder ) )
+                addToPathLookup( *folder, false );
+            slash = target.find( '/', slash + 1 );
+            if ( slash == std::string_view::npos )
+                break;
+            const auto parent = mPathLookup.find( target.substr( 0, slash ) );
+            if ( parent == mPathLookup.end() || parent->second.type != FOLDER )
+                return nullptr;
+            folder = static_cast<com::fileindexer::Folder *>( parent->second.entry );
+        }
+    }
+
+    const auto entry = mPathLookup.find( target );
+    if ( entry == mPathLookup.end() || entry->second.type != type )
+        return nullptr;
+    return entry->second.entry;
+}
+
 bool DirectoryIndexer::removePath( com::fileindexer::Folder * folderIndex, const std::string & path, const PATH_TYPE type )
 {
     if ( folderIndex == nullptr )
+    {
+        expandIndex();
         folderIndex = &mFolderIndex;
+        // straight to the folder holding it rather than down from the root
+        if ( mPathLookupActive )
+        {
+            auto *parent = static_cast<com::fileindexer::Folder *>( extractByPath( path.substr( 0, path.find_last_of( '/' ) ), FOLDER ) );
+            if ( parent != nullptr )
+                folderIndex = parent;
+        }
+    }
 
     if ( !path.starts_with( folderIndex->name() ) )
         return false;
@@ -1015,7 +1721,10 @@ bool DirectoryIndexer::removePath( com::fileindexer::Folder * folderIndex, const
             if ( file->name() == path )
             {
                 /* file found, remove from index */
+                mPathLookup.erase( file->name() );
+                forgetContent( *file );
                 folderIndex->mutable_files()->erase( file );
+                markDirty( folderIndex->name() );
                 return true;
             }
         }
@@ -1026,7 +1735,10 @@ bool DirectoryIndexer::removePath( com::fileindexer::Folder * folderIndex, const
         if ( type == FOLDER && folder->name() == path )
         {
             /* folder found, remove from index */
+            removeFromPathLookup( *folder );
+            mPathLookup.erase( folder->name() );
             folderIndex->mutable_folders()->erase( folder );
+            markDirty( folderIndex->name() );
             return true;
         }
         if ( path.starts_with( folder->name() ) )
@@ -1054,42 +1766,43 @@ void DirectoryIndexer::copyTo( com::fileindexer::Folder * folderIndex, ::google:
         exit(1);
     }
 
+    // subtrees planned in parallel may copy into one folder, and they share the lookups
+    std::unique_lock<std::mutex> lock( mLookupMutex );
     if ( type == FOLDER )
     {
         auto *const folderToCopy = dynamic_cast<com::fileindexer::Folder*>(element);
-        com::fileindexer::Folder newFolder;
-        newFolder.set_name( path );
-        newFolder.set_permissions( folderToCopy->permissions() );
-        newFolder.set_type( folderToCopy->type() );
-        newFolder.set_modifiedtime( folderToCopy->modifiedtime() );
-        newFolder.set_changetime( folderToCopy->changetime() );
-        *subFolder->add_folders() = newFolder;
+        auto *newFolder = subFolder->add_folders();     // allocated on the arena of the index
+        newFolder->set_name( path );
+        newFolder->set_permissions( folderToCopy->permissions() );
+        newFolder->set_type( folderToCopy->type() );
+        newFolder->set_modifiedtimens( folderToCopy->modifiedtimens() );
+        newFolder->set_changetimens( folderToCopy->changetimens() );
+        if ( mPathLookupActive )
+            mPathLookup.emplace( newFolder->name(), PathEntry{ newFolder, FOLDER } );
     } else // ( type == FILE )
     {
         auto *const fileToCopy = dynamic_cast<com::fileindexer::File*>(element);
-        com::fileindexer::File newFile;
-        newFile.set_name( path );
-        newFile.set_permissions( fileToCopy->permissions() );
-        newFile.set_type( fileToCopy->type() );
-        newFile.set_modifiedtime( fileToCopy->modifiedtime() );
-        newFile.set_hash( fileToCopy->hash() );
-        newFile.set_changetime( fileToCopy->changetime() );
-        *subFolder->add_files() = newFile;
+        auto *newFile = subFolder->add_files();
+        newFile->set_name( path );
+        newFile->set_permissions( fileToCopy->permissions() );
+        newFile->set_type( fileToCopy->type() );
+        newFile->set_modifiedtimens( fileToCopy->modifiedtimens() );
+        copyDigest( *newFile, *fileToCopy );
+        newFile->set_changetimens( fileToCopy->changetimens() );
+        if ( mPathLookupActive )
+            mPathLookup.emplace( newFile->name(), PathEntry{ newFile, FILE } );
+        rememberContent( *newFile );
     }
+    lock.unlock();
+    markDirty( subFolder->name() );
 }
 
-DirectoryIndexer::FILE_TIME_COMP_RESULT DirectoryIndexer::compareFileTime(const std::string& timeA, const std::string& timeB)
+DirectoryIndexer::FILE_TIME_COMP_RESULT DirectoryIndexer::compareFileTime(int64_t timeA, int64_t timeB)
 {
-    if (timeA.length() != timeB.length())
-        return FILE_TIME_COMP_RESULT::FILE_TIME_LENGTH_MISMATCH;
-
-    for (size_t i = 0; i < timeA.length(); ++i) {
-        int diff = static_cast<unsigned char>(timeA[i]) - static_cast<unsigned char>(timeB[i]);
-        if (diff < 0)
-            return FILE_TIME_COMP_RESULT::FILE_TIME_FILE_A_OLDER;
-        if (diff > 0)
-            return FILE_TIME_COMP_RESULT::FILE_TIME_FILE_B_OLDER;
-    }
+    if (timeA < timeB)
+        return FILE_TIME_COMP_RESULT::FILE_TIME_FILE_A_OLDER;
+    if (timeA > timeB)
+        return FILE_TIME_COMP_RESULT::FILE_TIME_FILE_B_OLDER;
     return FILE_TIME_COMP_RESULT::FILE_TIME_EQUAL;
 }
 
@@ -1156,10 +1869,34 @@ std::string DirectoryIndexer::file_time_to_string(std::filesystem::file_time_typ
 {
     return std::format("{0:%F}_{0:%R}.{0:%S}", fileTime);
 }
+int64_t DirectoryIndexer::timespec_to_ns(const struct timespec &timespec)
+{
+    return static_cast<int64_t>(timespec.tv_sec) * 1000000000LL + timespec.tv_nsec;
+}
+struct timespec DirectoryIndexer::ns_to_timespec(int64_t timeNs)
+{
+    // floored, a time before the epoch keeps tv_nsec in [0, 1e9)
+    struct timespec timespec {};
+    timespec.tv_sec = static_cast<time_t>(timeNs / 1000000000LL);
+    timespec.tv_nsec = static_cast<long>(timeNs % 1000000000LL);
+    if ( timespec.tv_nsec < 0 )
+    {
+        timespec.tv_sec -= 1;
+        timespec.tv_nsec += 1000000000L;
+    }
+    return timespec;
+}
+std::filesystem::file_time_type DirectoryIndexer::timespec_to_file_time(const struct timespec &timespec)
+{
+    const std::chrono::sys_time<std::chrono::nanoseconds> systemTime{
+        std::chrono::seconds(timespec.tv_sec) + std::chrono::nanoseconds(timespec.tv_nsec) };
+    return std::chrono::file_clock::from_sys(systemTime);
+}
 std::string DirectoryIndexer::file_time_to_string(const struct timespec &timespec)
 {
     std::time_t time = timespec.tv_sec;
-    std::tm gmtTimeInfo = *std::gmtime(&time);
+    std::tm gmtTimeInfo{};
+    gmtime_r(&time, &gmtTimeInfo);     // subtrees planned in parallel format times at once
     std::ostringstream oss;
     oss << std::put_time(&gmtTimeInfo, "%Y-%m-%d_%H:%M.%S") << "." << std::setfill('0') << std::setw(9) << timespec.tv_nsec;
     return oss.str();
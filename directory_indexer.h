@@ -4,18 +4,41 @@
 
 // Section 2: Includes
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "change_journal.h"
+#include "directory_scanner.h"
+#include "file_hasher.h"
+#include "flat_index.h"
 #include "folder.pb.h"
+#include "hash_cache.h"
+#include "hash_pipeline.h"
+#include "index_log.h"
+#include "lazy_index.h"
 #include "sync_command.h"
+#include "work_stealing_pool.h"
+
+#include <google/protobuf/arena.h>
 
 // Section 3: Defines and Macros
-// (none)
+constexpr size_t INDEX_ARENA_MAX_BLOCK_BYTES = 1 << 20;   // arena blocks grow up to this size, a large index takes few of them
 
 // Section 4: Classes
 class SyncCommand;
+class SyncPlanner;
 
 /**
  * Class for indexing directory contents and managing synchronization
@@ -45,7 +68,6 @@ public:
         FILE_TIME_EQUAL = 0,          ///< File times are equal
         FILE_TIME_FILE_A_OLDER = -1,  ///< File A is older than File B
         FILE_TIME_FILE_B_OLDER = 1,   ///< File A is newer than File B
-        FILE_TIME_LENGTH_MISMATCH = -1000, ///< File lengths do not match
     };
 
     /**
@@ -53,17 +75,18 @@ public:
      * @param path Path to index
      * @param topLevel Whether this is the top-level directory
      * @param type Type of index to create
+     * @param arena Arena the index tree is allocated on, shared by the indexes of a session, nullptr for one of its own
      */
     DirectoryIndexer(const std::filesystem::path &path, bool topLevel = false,
-                     INDEX_TYPE type = INDEX_TYPE_LOCAL);
+                     INDEX_TYPE type = INDEX_TYPE_LOCAL, google::protobuf::Arena *arena = nullptr);
 
     /**
      * Constructs a directory indexer from existing index data
      * @param path Path the index represents
-     * @param folderIndex Existing index data
+     * @param folderIndex Existing index data, moved into the indexer without copying its subtree, the indexer allocates on its arena
      * @param topLevel Whether this is the top-level directory
      */
-    DirectoryIndexer(const std::filesystem::path &path, const com::fileindexer::Folder &folderIndex,
+    DirectoryIndexer(const std::filesystem::path &path, com::fileindexer::Folder &&folderIndex,
                      bool topLevel = false);
 
     /**
@@ -94,15 +117,24 @@ public:
 
 
     /**
-     * Dumps the index to file
+     * Dumps the index to file: the folders changed since it was loaded from or saved to that
+     * file are appended to its log, any other file gets a full snapshot
      * @param path Name of the file to dump the index to
      * @return 0 on success, negative on error
      */
     int dumpIndexToFile(const std::optional<std::filesystem::path> &path);
 
     /**
-     * Synchronizes directory contents with a remote directory
-     * @param folderIndex Current folder being synced
+     * Folds the log of the file the index was loaded from or saved to into a new snapshot,
+     * for readers of the snapshot alone such as the peer it is sent to
+     * @return 0 on success, negative on error
+     */
+    int compactIndexFile();
+
+    /**
+     * Synchronizes directory contents with a remote directory, walking both trees at once
+     * with the children of each folder sorted by name
+     * @param folderIndex Folder of the remote index to sync, nullptr for the whole tree
      * @param past Previous local state
      * @param remote Current remote state
      * @param remotePast Previous remote state
@@ -152,50 +184,233 @@ public:
 
     static std::string file_time_to_string(std::filesystem::file_time_type fileTime);
     static std::string file_time_to_string(const struct timespec &timespec);
+    static std::filesystem::file_time_type timespec_to_file_time(const struct timespec &timespec);
+    static int64_t timespec_to_ns(const struct timespec &timespec);
+    static struct timespec ns_to_timespec(int64_t timeNs);
+
+    /**
+     * Sets how many threads index subfolders, and plan the subtrees of a large sync, in parallel
+     * @param threads Thread count, 0 for one thread per core, 1 for a serial walk
+     */
+    static void setIndexThreads(unsigned threads) { indexThreads = threads; }
+
+    /**
+     * Sets how many files are hashed concurrently while the tree is walked
+     * @param threads Hash worker count, 0 for one worker per core
+     */
+    static void setHashThreads(unsigned threads) { hashThreads = threads; }
+
+    /**
+     * Configures the persistent digest cache shared by every sync root
+     * @param directory Directory holding the cache, empty for the default under ~/.cache
+     * @param maxSizeBytes Size the cache is compacted under, 0 disables it
+     */
+    static void setHashCache(const std::filesystem::path &directory, uint64_t maxSizeBytes)
+    {
+        hashCacheDirectory = directory;
+        hashCacheMaxSize = maxSizeBytes;
+    }
+
+    /**
+     * Sets from which size files are hashed as a chunk tree, whose chunks are hashed in parallel
+     * @param minFileBytes Smallest file hashed in chunks, 0 disables chunk trees
+     * @param chunkBytes Chunk size
+     */
+    static void setChunkHashing(uint64_t minFileBytes, uint64_t chunkBytes)
+    {
+        chunkHashMinFileBytes = minFileBytes;
+        chunkHashBytes = chunkBytes;
+    }
+
+    /**
+     * Makes indexonprotobuf hash like another index was hashed: same algorithm and chunk trees.
+     * Entries hashed differently are hashed again when next indexed.
+     * @param other Index whose settings to use, typically the peer's
+     */
+    void adoptHashSettings(const DirectoryIndexer &other);
+
+    /**
+     * Gets the algorithm the digests of the loaded index were computed with
+     * @return Algorithm recorded in the index, MD5 for indexes written before it was recorded
+     */
+    FileHasher::Algorithm indexedHashAlgorithm() const { return static_cast<FileHasher::Algorithm>(mFolderIndex.hashalgorithm()); }
+
+    /**
+     * Compares the content of two files by digest
+     * @param fileA First file
+     * @param fileB Second file
+     * @return true if the digests match, or for digests computed differently if size and modified time match
+     */
+    static bool isSameContent(const com::fileindexer::File &fileA, const com::fileindexer::File &fileB);
+
+    /**
+     * Checks whether a name belongs to the sync machinery rather than to the synchronized tree
+     * @param name Entry name
+     * @return true for the index files, the change journal files and sync_commands.sh
+     */
+    static bool isIndexFile(const std::string &name);
+
+    /**
+     * Gets the options of the arenas index trees are allocated on
+     * @return Options for an arena shared by the indexes of a session
+     */
+    static google::protobuf::ArenaOptions indexArenaOptions();
 
 protected:
     // (none)
 
 private:
-    void indexpath(const std::filesystem::path &path, bool verbose);
+    friend class SyncPlanner;   // plans the merge walk over the lookups and per-file decisions of both sides
+
+    /**
+     * Identity of a file's content as far as the filesystem can tell without reading it
+     */
+    struct FileIdentity {
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+        int64_t modifiedTimeNs;
+        com::fileindexer::File::HashAlgorithm algorithm;
+        uint64_t chunkSize;
+        bool operator==(const FileIdentity &other) const = default;
+    };
+    struct FileIdentityHash {
+        size_t operator()(const FileIdentity &identity) const;
+    };
+    struct KnownHash {
+        std::string hash;
+        std::vector<std::string> chunkHashes;
+    };
+    struct PathEntry {
+        google::protobuf::Message *entry;
+        PATH_TYPE type;
+    };
+    /**
+     * Order of the digest lookup, by digest then by name: the first file with a digest is its copy source
+     */
+    struct ContentOrder {
+        using is_transparent = void;
+        bool operator()(const com::fileindexer::File *fileA, const com::fileindexer::File *fileB) const;
+        bool operator()(const com::fileindexer::File *file, std::string_view digest) const;
+        bool operator()(std::string_view digest, const com::fileindexer::File *file) const;
+    };
+    using HashReuseMap = std::unordered_map<FileIdentity, KnownHash, FileIdentityHash>;
+    /**
+     * Folders whose own entries changed since the index file was written, by name
+     */
+    struct DirtyFolders {
+        std::mutex mutex;
+        std::unordered_set<std::string> names;
+    };
+
+    void indexpath(DirectoryScanner &scanner, DirectoryScanner::Entry &entry, bool verbose);
     com::fileindexer::File *findFileAtPath(com::fileindexer::Folder *folderIndex, const std::string &path, bool verbose);
     std::list<com::fileindexer::File *> findFileFromName(com::fileindexer::Folder *folderIndex,
                                                          const std::string &filename, bool verbose = false);
     com::fileindexer::Folder *findFolderFromName(const std::filesystem::path &filepath, bool verbose);
     std::list<com::fileindexer::File *> findFileFromHash(com::fileindexer::Folder *folderIndex,
-                                                         const std::string &hash, bool stopAtFirst,
+                                                         const com::fileindexer::File &content, bool stopAtFirst,
                                                          bool verbose = false);
+    std::list<com::fileindexer::File *> findFileFromDigest(const com::fileindexer::File &content, bool stopAtFirst);
     static std::list<std::string> __extractPathComponents(const std::filesystem::path &filepath,
                                                          bool verbose = false);
     void *extract(com::fileindexer::Folder *folderIndex, const std::string &path, PATH_TYPE type);
+    void *extractFlat(const std::string &path, PATH_TYPE type);
+    void *extractByPath(const std::string &path, PATH_TYPE type);
     void copyTo(com::fileindexer::Folder *folderIndex, ::google::protobuf::Message *element,
                 const std::string &path, PATH_TYPE type);
-	static FILE_TIME_COMP_RESULT compareFileTime(const std::string& timeA, const std::string& timeB);
+	static FILE_TIME_COMP_RESULT compareFileTime(int64_t timeA, int64_t timeB);
 
+    /**
+     * Collects the children of a folder by name, for the deletion walks to look them up
+     * @param folder Folder whose children are collected
+     * @param files Gets the names of its files
+     * @param folders Gets its subfolders by name
+     */
+    static void indexChildrenByName(const com::fileindexer::Folder& folder, std::unordered_set<std::string_view>& files, std::unordered_map<std::string_view, const com::fileindexer::Folder*>& folders);
     void findDeletedRecursive(const com::fileindexer::Folder& currentFolder, const com::fileindexer::Folder& lastRunFolder, const std::filesystem::path& basePath, std::vector<std::string>& deletions);
+    void findDeletedFlat(const com::fileindexer::Folder& currentFolder, const FlatIndex& lastRun, uint32_t lastRunFolder, std::vector<std::string>& deletions);
     
     static bool isPathInFolder(const std::filesystem::path& pathToCheck, const com::fileindexer::Folder& folder);
     static void* extractFile(com::fileindexer::Folder* folderIndex, const std::string& path);
     static void* extractFolder(com::fileindexer::Folder* folderIndex, const std::string& path);
     void* extractRecursive(com::fileindexer::Folder* folderIndex, const std::string& path, PATH_TYPE type);
     
-    void addNewEntry(const std::filesystem::directory_entry& file, com::fileindexer::File& protobufFile, bool verbose, std::filesystem::file_type type);
-    void updateFileEntry(const std::filesystem::directory_entry& file, com::fileindexer::File& protobufFile, bool verbose, bool& found);
-    void updateFolderEntry(const std::filesystem::directory_entry& file, com::fileindexer::File& protobufFile, bool verbose, bool& found);
-    void syncFolders(com::fileindexer::Folder *folderIndex, DirectoryIndexer *past, DirectoryIndexer *remote, DirectoryIndexer *remotePast, SyncCommands &syncCommands, bool verbose, bool isRemote, const DirectoryIndexer *local, bool forcePull);
-    void syncFiles(com::fileindexer::Folder *folderIndex, DirectoryIndexer *past, DirectoryIndexer *remote, DirectoryIndexer *remotePast, SyncCommands &syncCommands, bool verbose, bool isRemote, const DirectoryIndexer *local, bool forcePull);
+    void buildChildLookup();
+    void addNewEntry(const std::filesystem::path& path, com::fileindexer::File& protobufFile, bool verbose, const DirectoryScanner::Entry& scanned);
+    void scheduleSubfolder(WorkStealingPool::Task task);
+    static unsigned resolvedIndexThreads();
+    void scheduleHash(const std::filesystem::path &path, com::fileindexer::File *fileInIndex,
+                      const DirectoryScanner::Entry &scanned, bool verbose);
+    void shareWalkWith(DirectoryIndexer &child) const;
+    bool reuseKnownHash(com::fileindexer::File &fileInIndex) const;
+    static void setFileIdentity(com::fileindexer::File &fileInIndex, const com::fileindexer::File &protobufFile);
+    static void copyDigest(com::fileindexer::File &to, const com::fileindexer::File &from);
+    uint64_t chunkSizeFor(uint64_t fileSize) const;
+    static void collectKnownHashes(const com::fileindexer::Folder &folderIndex, HashReuseMap &knownHashes);
+    static unsigned resolvedHashThreads();
+    void updateFileEntry(const std::filesystem::path& path, com::fileindexer::File& protobufFile, bool verbose, const DirectoryScanner::Entry& scanned, bool& found);
+    void updateFolderEntry(const std::filesystem::path& path, com::fileindexer::File& protobufFile, bool verbose, bool& found);
+    void keepFolderEntry(const com::fileindexer::File& protobufFile, bool& found);
+    bool loadScanSnapshot();
+    int saveScanSnapshot();
+    void markDirty();
+    void markDirty(const std::string &folderName);
+    void collectLogRecords(com::fileindexer::Folder &folderIndex, std::string &records);
+    void refreshFlatIndex(const std::filesystem::path &indexPath);
+    void expandIndex();
+    void buildPathLookup(bool withContent);
+    void dropPathLookup();
+    void addToPathLookup(com::fileindexer::Folder &folder, bool withSubfolders);
+    void removeFromPathLookup(const com::fileindexer::Folder &folder);
+    void rememberContent(com::fileindexer::File &file);
+    void forgetContent(const com::fileindexer::File &file);
+    com::fileindexer::Folder *syncMissingFolder(com::fileindexer::Folder &remoteFolder, const std::string &localFolderPath, DirectoryIndexer *past, SyncCommands &syncCommands, bool isRemote, bool forcePull);
+    void syncFile(com::fileindexer::File &remoteFile, com::fileindexer::File *localFile, DirectoryIndexer *past, DirectoryIndexer *remote, DirectoryIndexer *remotePast, SyncCommands &syncCommands, bool verbose, bool isRemote, bool forcePull);
     void postProcessSyncCommands(SyncCommands &syncCommands, DirectoryIndexer *remote);
     void handleFileMissing(com::fileindexer::File& remoteFile, const std::string& remoteFilePath, const std::string& localFilePath, DirectoryIndexer* past, DirectoryIndexer* remotePast, SyncCommands &syncCommands, bool isRemote, bool forcePull, bool verbose);
     static void handleFileConflict(com::fileindexer::File* remoteFile, com::fileindexer::File* localFile, const std::string& remoteFilePath, const std::string& localFilePath, SyncCommands &syncCommands, bool isRemote);
-    static void handleFileExists(com::fileindexer::File& remoteFile, com::fileindexer::File* localFile, const std::string& remoteFilePath, const std::string& localFilePath, SyncCommands &syncCommands, bool isRemote);
+    void handleFileExists(com::fileindexer::File& remoteFile, com::fileindexer::File* localFile, const std::string& remoteFilePath, const std::string& localFilePath, DirectoryIndexer* remote, SyncCommands &syncCommands, bool isRemote);
     static void checkPathLengthWarnings(const std::string& path, const std::string& operation);
 
 
     std::filesystem::directory_entry mDir;
-    std::fstream mIndexfile;
-    bool mUpdateIndexFile;
-    com::fileindexer::Folder mFolderIndex;
+    std::unique_ptr<google::protobuf::Arena> mOwnedArena;  ///< Arena of the index when none was given, nullptr otherwise
+    google::protobuf::Arena *mArena;                ///< Arena the index tree lives on, one free when it goes
+    com::fileindexer::Folder &mFolderIndex;         ///< Index tree, owned by the arena
+    std::filesystem::path mIndexBase;               ///< Index file the index was loaded from or saved to, empty if none
+    std::unique_ptr<FlatIndex> mFlatIndex;          ///< Index read in place, mFolderIndex holding only the root's own fields until expanded, nullptr otherwise
+    std::unordered_map<uint32_t, google::protobuf::Message *> mFlatEntries;    ///< Entries of mFlatIndex converted by extract(), on the arena
+    std::unique_ptr<LazyIndex> mLazyIndex;          ///< Index parsed as extract() descends into it, mFolderIndex expanded that far, nullptr otherwise
+    std::unordered_map<std::string_view, PathEntry> mPathLookup;    ///< Entries of mFolderIndex by full path, keyed on their names, while mPathLookupActive
+    bool mPathLookupActive;                         ///< extract() answers from mPathLookup, or from mFlatIndex which has its own
+    std::set<com::fileindexer::File *, ContentOrder> mContentLookup;   ///< Files of mFolderIndex by digest and name, while mContentLookupActive
+    std::map<std::pair<int, uint64_t>, size_t> mContentSchemes;    ///< Files in mContentLookup by hash algorithm and chunk size
+    bool mContentLookupActive;                      ///< findFileFromHash() answers from mContentLookup where the digests decide
+    std::mutex mLookupMutex;                        ///< Guards the path and digest lookups while subtrees are planned in parallel
+    DirtyFolders mDirtyFolders;                     ///< Folders changed since, for the top level
+    DirtyFolders *mDirty;                           ///< Dirty folders of the top level, shared by the whole walk
+    std::thread mIndexCompaction;                   ///< Background compaction of the index file
     bool mTopLevel;
+    WorkStealingPool *mPool;                        ///< Pool shared by the whole walk, nullptr for a serial walk
+    WorkStealingPool::TaskGroup *mSubfolderTasks;   ///< Subfolder tasks of the indexonprotobuf call in progress
+    HashPipeline *mHashPipeline;                    ///< Hash workers shared by the whole walk, nullptr hashes inline
+    const HashReuseMap *mHashReuse;                 ///< Digests of the loaded index by file identity, shared by the whole walk
+    HashCache *mHashCache;                          ///< Persistent digest cache shared by the whole walk, nullptr when disabled
+    FileHasher::Algorithm mHashAlgorithm;           ///< Algorithm new digests are computed with
+    uint64_t mChunkHashMinFileBytes;                ///< Smallest file hashed as a chunk tree, 0 for none
+    uint64_t mChunkHashBytes;                       ///< Chunk size of the chunk trees
+    const ChangeJournal::Changes *mChanges;         ///< Directories changed since the last scan, nullptr walks everything
+    std::unordered_set<std::string> mSeenEntries;   ///< Entry names found on disk by the indexonprotobuf call in progress
+    std::unordered_map<std::string, com::fileindexer::File *> mFileLookup;      ///< Direct children files by name while indexing
+    std::unordered_map<std::string, com::fileindexer::Folder *> mFolderLookup;  ///< Direct children folders by name while indexing
+
+    static unsigned indexThreads;
+    static unsigned hashThreads;
+    static std::filesystem::path hashCacheDirectory;
+    static uint64_t hashCacheMaxSize;
+    static uint64_t chunkHashMinFileBytes;
+    static uint64_t chunkHashBytes;
 };
 
 #endif // _DIRECTORY_INDEXER_H_
\ No newline at end of file
@@ -0,0 +1,120 @@
+// Section 1: Main Header
+#include "directory_scanner.h"
+
+// Section 2: Includes
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h> /* Definition of AT_* constants */
+#include <iostream>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <system_error>
+#include <unistd.h>
+
+// Third-Party Includes
+#include "termcolor/termcolor.hpp"
+
+// Section 3: Defines and Macros
+constexpr unsigned STATX_WANTED = STATX_TYPE | STATX_MODE | STATX_MTIME | STATX_CTIME | STATX_SIZE | STATX_INO;
+
+// Section 4: Static Variables
+// (none)
+
+// Section 5: Constructors and Destructors
+DirectoryScanner::DirectoryScanner(const std::filesystem::path &path) :
+    mPath( path ),
+    mDirFd( open( path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ),
+    mBuffer( std::make_unique<char[]>( DIRECTORY_SCANNER_BUFFER_SIZE ) ),
+    mBufferUsed( 0 ),
+    mBufferOffset( 0 )
+{
+    if ( mDirFd < 0 )
+        throw std::filesystem::filesystem_error( "cannot open directory", mPath, std::error_code( errno, std::generic_category() ) );
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+    if ( mDirFd >= 0 )
+        close( mDirFd );
+}
+
+// Section 6: Static Methods
+// (none)
+
+// Section 7: Public/Protected/Private Methods
+bool DirectoryScanner::next(Entry &entry)
+{
+    while ( true )
+    {
+        if ( mBufferOffset >= mBufferUsed )
+        {
+            const ssize_t bytesRead = getdents64( mDirFd, mBuffer.get(), DIRECTORY_SCANNER_BUFFER_SIZE );
+            if ( bytesRead < 0 )
+                throw std::filesystem::filesystem_error( "cannot read directory", mPath, std::error_code( errno, std::generic_category() ) );
+            if ( bytesRead == 0 )
+                return false;
+            mBufferUsed = static_cast<size_t>( bytesRead );
+            mBufferOffset = 0;
+        }
+
+        const auto *dirent = reinterpret_cast<const struct dirent64 *>( mBuffer.get() + mBufferOffset );
+        mBufferOffset += dirent->d_reclen;
+
+        if ( strcmp( dirent->d_name, "." ) == 0 || strcmp( dirent->d_name, ".." ) == 0 )
+            continue;
+
+        if ( !statEntry( dirent->d_name, dirent->d_type == DT_LNK, entry ) )
+            continue;
+
+        // filesystems without d_type only tell us about the symlink after the first statx
+        if ( dirent->d_type == DT_UNKNOWN && entry.type == std::filesystem::file_type::symlink &&
+             !statEntry( dirent->d_name, true, entry ) )
+            continue;
+
+        return true;
+    }
+}
+
+bool DirectoryScanner::refresh(Entry &entry)
+{
+    const std::string name = entry.name;
+    return statEntry( name.c_str(), entry.symlink, entry );
+}
+
+bool DirectoryScanner::statEntry(const char *name, bool symlink, Entry &entry)
+{
+    // symlinks are indexed as what they point to, everything else is never followed
+    const int flags = AT_STATX_SYNC_AS_STAT | ( symlink ? 0 : AT_SYMLINK_NOFOLLOW );
+
+    struct statx stx;
+    if ( statx( mDirFd, name, flags, STATX_WANTED, &stx ) != 0 )
+    {
+        if ( errno == ENOENT && symlink )
+            std::cout << termcolor::yellow << "Skipping broken symlink: " << ( mPath / name ).string() << termcolor::reset << "\r\n";
+        else if ( errno != ENOENT )
+            std::cerr << termcolor::red << "Error getting file info for: " << ( mPath / name ).string() << ": " << strerror( errno ) << termcolor::reset << "\r\n";
+        return false;
+    }
+
+    entry.name = name;
+    switch ( stx.stx_mode & S_IFMT )
+    {
+        case S_IFREG:  entry.type = std::filesystem::file_type::regular; break;
+        case S_IFDIR:  entry.type = std::filesystem::file_type::directory; break;
+        case S_IFLNK:  entry.type = std::filesystem::file_type::symlink; break;
+        case S_IFBLK:  entry.type = std::filesystem::file_type::block; break;
+        case S_IFCHR:  entry.type = std::filesystem::file_type::character; break;
+        case S_IFIFO:  entry.type = std::filesystem::file_type::fifo; break;
+        case S_IFSOCK: entry.type = std::filesystem::file_type::socket; break;
+        default:       entry.type = std::filesystem::file_type::unknown; break;
+    }
+    entry.permissions = static_cast<std::filesystem::perms>( stx.stx_mode & 07777 );
+    entry.modifiedTime = { .tv_sec = stx.stx_mtime.tv_sec, .tv_nsec = stx.stx_mtime.tv_nsec };
+    entry.changeTime = { .tv_sec = stx.stx_ctime.tv_sec, .tv_nsec = stx.stx_ctime.tv_nsec };
+    entry.size = stx.stx_size;
+    entry.inode = stx.stx_ino;
+    entry.device = makedev( stx.stx_dev_major, stx.stx_dev_minor );
+    entry.symlink = symlink;
+    return true;
+}
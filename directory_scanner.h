@@ -0,0 +1,80 @@
+// Section 1: Compilation Guards
+#ifndef _DIRECTORY_SCANNER_H_
+#define _DIRECTORY_SCANNER_H_
+
+// Section 2: Includes
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+// Section 3: Defines and Macros
+constexpr size_t DIRECTORY_SCANNER_BUFFER_SIZE = 64 * 1024;
+
+// Section 4: Classes
+/**
+ * Lists a directory with getdents64 and stats every entry with a single
+ * statx call relative to the directory fd, so no entry goes through full
+ * path resolution. Entries come out in the same order as a
+ * std::filesystem::directory_iterator over the same directory.
+ */
+class DirectoryScanner {
+public:
+    /**
+     * Metadata of one directory entry
+     */
+    struct Entry {
+        std::string name;                       ///< Entry name, relative to the scanned directory
+        std::filesystem::file_type type;        ///< Entry type, symlinks report the type of their target
+        std::filesystem::perms permissions;     ///< Permission bits
+        struct timespec modifiedTime;           ///< Content modification time
+        struct timespec changeTime;             ///< Inode change time
+        uint64_t size;                          ///< Size in bytes
+        uint64_t inode;                         ///< Inode number
+        uint64_t device;                        ///< Device holding the inode
+        bool symlink;                           ///< Entry is a symlink, the metadata is the target's
+    };
+
+    /**
+     * Opens the directory to scan
+     * @param path Directory to scan
+     * @throws std::filesystem::filesystem_error if the directory cannot be opened
+     */
+    explicit DirectoryScanner(const std::filesystem::path &path);
+
+    /**
+     * Closes the directory
+     */
+    ~DirectoryScanner();
+
+    DirectoryScanner(const DirectoryScanner&) = delete;
+    DirectoryScanner& operator=(const DirectoryScanner&) = delete;
+
+    /**
+     * Reads the next entry, skipping "." and ".." and entries that vanished while scanning
+     * @param entry Entry to fill
+     * @return true if an entry was read, false at the end of the directory
+     * @throws std::filesystem::filesystem_error if the directory cannot be read
+     */
+    bool next(Entry &entry);
+
+    /**
+     * Stats an entry returned by next() again
+     * @param entry Entry to refresh
+     * @return true if the entry still exists
+     */
+    bool refresh(Entry &entry);
+
+private:
+    bool statEntry(const char *name, bool symlink, Entry &entry);
+
+    std::filesystem::path mPath;
+    int mDirFd;
+    std::unique_ptr<char[]> mBuffer;
+    size_t mBufferUsed;
+    size_t mBufferOffset;
+};
+
+#endif // _DIRECTORY_SCANNER_H_
@@ -0,0 +1,614 @@
+// Section 1: Main Header
+#include "flat_index.h"
+
+// Section 2: Includes
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <xxhash.h>
+
+#include "index_log.h"
+
+// Section 3: Defines and Macros
+constexpr char FLAT_INDEX_MAGIC[8] = { 'F', 'L', 'A', 'T', 'I', 'D', 'X', '\0' };
+constexpr const char *FLAT_INDEX_TMP_SUFFIX = ".tmp";
+constexpr size_t FLAT_INDEX_ALIGNMENT = 8;
+constexpr unsigned FLAT_INDEX_STRING_LENGTH_BITS = 24;     // strings up to 16 MiB, string table up to 1 TiB
+
+// Section 4: Static Variables
+namespace {
+
+/**
+ * Columns of the file, in file order
+ */
+enum FlatColumn : size_t {
+    COLUMN_PARENT = 0,      ///< uint32_t, FLAT_INDEX_NO_ENTRY for the root
+    COLUMN_SUBTREE_END,     ///< uint32_t
+    COLUMN_FILE_COUNT,      ///< uint32_t, 0 for files
+    COLUMN_META,            ///< EntryMeta
+    COLUMN_DEVICE,          ///< uint64_t, chunkHashMinFileSize for folders
+    COLUMN_INODE,           ///< uint64_t, chunkHashSize for folders
+    COLUMN_SIZE,            ///< uint64_t, logSequence for folders
+    COLUMN_CHUNK_SIZE,      ///< uint64_t, formatVersion for folders
+    COLUMN_MODIFIED_TIME,   ///< int64_t
+    COLUMN_CHANGE_TIME,     ///< int64_t
+    COLUMN_NAME,            ///< StringRef
+    COLUMN_HASH,            ///< StringRef
+    COLUMN_CHUNKS,          ///< ChunkRange into COLUMN_CHUNK_HASHES
+    COLUMN_CHUNK_HASHES,    ///< StringRef, chunkHashCount of them
+    COLUMN_LOOKUP,          ///< uint32_t entry numbers by name hash, lookupSlots of them
+    COLUMN_STRINGS,         ///< char, stringBytes of them
+    COLUMN_COUNT,
+};
+
+/**
+ * Fields present in an entry, proto3 optional fields having explicit presence
+ */
+enum FlatField : uint32_t {
+    FIELD_NAME = 1U << 0,
+    FIELD_MODIFIED_TIME = 1U << 1,
+    FIELD_PERMISSIONS = 1U << 2,
+    FIELD_TYPE = 1U << 3,
+    FIELD_CHANGE_TIME = 1U << 4,
+    FIELD_HASH = 1U << 5,
+    FIELD_DEVICE = 1U << 6,         // chunkHashMinFileSize for folders
+    FIELD_INODE = 1U << 7,          // chunkHashSize for folders
+    FIELD_SIZE = 1U << 8,           // logSequence for folders
+    FIELD_HASH_ALGORITHM = 1U << 9,
+    FIELD_CHUNK_SIZE = 1U << 10,    // formatVersion for folders
+    FIELD_FOLDER = 1U << 31,        // not a field, the entry is a folder
+};
+
+struct EntryMeta {
+    uint32_t fields;
+    int32_t type;
+    int32_t permissions;
+    int32_t hashAlgorithm;
+};
+
+/**
+ * Slice of the string table, offset and length packed in 8 bytes
+ */
+struct StringRef {
+    uint64_t packed;
+    uint64_t offset() const { return packed >> FLAT_INDEX_STRING_LENGTH_BITS; }
+    uint64_t length() const { return packed & ( ( 1ULL << FLAT_INDEX_STRING_LENGTH_BITS ) - 1 ); }
+};
+
+struct ChunkRange {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct FlatHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t chunkHashCount;
+    uint32_t lookupSlots;               // a power of two, at least twice the entries
+    uint64_t stringBytes;
+    // the snapshot and log the file was written from, it is stale once either changes
+    uint64_t snapshotDevice;
+    uint64_t snapshotInode;
+    uint64_t snapshotSize;
+    int64_t snapshotModifiedNs;
+    uint64_t logInode;                  // 0 without a log
+    uint64_t logSize;
+    uint64_t columnOffset[COLUMN_COUNT];
+};
+
+constexpr size_t COLUMN_ELEMENT_BYTES[COLUMN_COUNT] = {
+    sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(EntryMeta),
+    sizeof(uint64_t), sizeof(uint64_t), sizeof(uint64_t), sizeof(uint64_t),
+    sizeof(int64_t), sizeof(int64_t), sizeof(StringRef), sizeof(StringRef),
+    sizeof(ChunkRange), sizeof(StringRef), sizeof(uint32_t), sizeof(char),
+};
+
+} // namespace
+
+// Section 5: Helpers
+namespace {
+
+uint64_t columnElements(const FlatHeader &header, size_t column)
+{
+    switch ( column )
+    {
+        case COLUMN_CHUNK_HASHES:
+            return header.chunkHashCount;
+        case COLUMN_LOOKUP:
+            return header.lookupSlots;
+        case COLUMN_STRINGS:
+            return header.stringBytes;
+        default:
+            return header.entryCount;
+    }
+}
+
+uint64_t alignUp(uint64_t offset)
+{
+    return ( offset + FLAT_INDEX_ALIGNMENT - 1 ) & ~static_cast<uint64_t>(FLAT_INDEX_ALIGNMENT - 1);
+}
+
+/**
+ * Records the identity of the snapshot and log the flat file is written from
+ * @return false if the snapshot is missing
+ */
+bool identify(const std::filesystem::path &indexPath, FlatHeader &header)
+{
+    struct stat snapshot {};
+    if ( stat(indexPath.c_str(), &snapshot) != 0 )
+        return false;
+    header.snapshotDevice = snapshot.st_dev;
+    header.snapshotInode = snapshot.st_ino;
+    header.snapshotSize = static_cast<uint64_t>(snapshot.st_size);
+    header.snapshotModifiedNs = static_cast<int64_t>(snapshot.st_mtim.tv_sec) * 1000000000 + snapshot.st_mtim.tv_nsec;
+    struct stat log {};
+    if ( stat(IndexLog::logPath(indexPath).c_str(), &log) == 0 )
+    {
+        header.logInode = log.st_ino;
+        header.logSize = static_cast<uint64_t>(log.st_size);
+    }
+    return true;
+}
+
+bool isValidHeader(const FlatHeader &header, const std::filesystem::path &indexPath, uint64_t fileSize)
+{
+    if ( memcmp(header.magic, FLAT_INDEX_MAGIC, sizeof(FLAT_INDEX_MAGIC)) != 0 || header.version != FLAT_INDEX_VERSION ||
+         header.entryCount == 0 || header.entryCount == FLAT_INDEX_NO_ENTRY ||
+         header.lookupSlots == 0 || ( header.lookupSlots & ( header.lookupSlots - 1 ) ) != 0 )
+        return false;
+    for ( size_t column = 0; column < COLUMN_COUNT; ++column )
+    {
+        const uint64_t offset = header.columnOffset[column];
+        const uint64_t elements = columnElements(header, column);
+        if ( offset % FLAT_INDEX_ALIGNMENT != 0 || offset > fileSize ||
+             elements > ( fileSize - offset ) / COLUMN_ELEMENT_BYTES[column] )
+            return false;
+    }
+    FlatHeader current {};
+    return identify(indexPath, current) &&
+           current.snapshotDevice == header.snapshotDevice && current.snapshotInode == header.snapshotInode &&
+           current.snapshotSize == header.snapshotSize && current.snapshotModifiedNs == header.snapshotModifiedNs &&
+           current.logInode == header.logInode && current.logSize == header.logSize;
+}
+
+bool writeAt(int fd, const void *data, size_t size, uint64_t offset)
+{
+    const auto *bytes = static_cast<const char *>(data);
+    size_t written = 0;
+    while ( written < size )
+    {
+        const ssize_t result = pwrite(fd, bytes + written, size - written, static_cast<off_t>(offset + written));
+        if ( result < 0 && errno == EINTR )
+            continue;
+        if ( result <= 0 )
+            return false;
+        written += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+/**
+ * Lays a Folder tree out in columns
+ */
+class FlatWriter {
+public:
+    bool add(const com::fileindexer::Folder &folder, uint32_t parent)
+    {
+        const uint32_t entry = addEntry(parent, FIELD_FOLDER);
+        if ( entry == FLAT_INDEX_NO_ENTRY )
+            return false;
+        EntryMeta &meta = mMeta[entry];
+        setString(COLUMN_NAME, entry, folder.has_name(), folder.name(), meta, FIELD_NAME);
+        if ( folder.has_modifiedtimens() )
+            setField(meta, FIELD_MODIFIED_TIME, mModifiedTime[entry], folder.modifiedtimens());
+        if ( folder.has_changetimens() )
+            setField(meta, FIELD_CHANGE_TIME, mChangeTime[entry], folder.changetimens());
+        if ( folder.has_permissions() )
+            setField(meta, FIELD_PERMISSIONS, meta.permissions, folder.permissions());
+        if ( folder.has_type() )
+            setField(meta, FIELD_TYPE, meta.type, folder.type());
+        if ( folder.has_hashalgorithm() )
+            setField(meta, FIELD_HASH_ALGORITHM, meta.hashAlgorithm, folder.hashalgorithm());
+        if ( folder.has_chunkhashminfilesize() )
+            setField(meta, FIELD_DEVICE, mDevice[entry], folder.chunkhashminfilesize());
+        if ( folder.has_chunkhashsize() )
+            setField(meta, FIELD_INODE, mInode[entry], folder.chunkhashsize());
+        if ( folder.has_logsequence() )
+            setField(meta, FIELD_SIZE, mSize[entry], folder.logsequence());
+        if ( folder.has_formatversion() )
+            setField(meta, FIELD_CHUNK_SIZE, mChunkSize[entry], folder.formatversion());
+
+        mFileCount[entry] = static_cast<uint32_t>(folder.files_size());
+        for ( const auto &file : folder.files() )
+        {
+            if ( !add(file, entry) )
+                return false;
+        }
+        for ( const auto &subfolder : folder.folders() )
+        {
+            if ( !add(subfolder, entry) )
+                return false;
+        }
+        mSubtreeEnd[entry] = static_cast<uint32_t>(mParent.size());
+        return true;
+    }
+
+    int write(const std::filesystem::path &path, FlatHeader &header)
+    {
+        if ( mOverflow || mChunkHashes.size() >= UINT32_MAX )
+            return -1;
+        header.entryCount = static_cast<uint32_t>(mParent.size());
+        header.chunkHashCount = static_cast<uint32_t>(mChunkHashes.size());
+        header.stringBytes = mStrings.size();
+        header.lookupSlots = 1;
+        while ( header.lookupSlots < 2 * static_cast<uint64_t>(header.entryCount) )
+            header.lookupSlots <<= 1;
+        std::vector<uint32_t> lookup(header.lookupSlots, FLAT_INDEX_NO_ENTRY);
+        for ( uint32_t entry = 0; entry < header.entryCount; ++entry )
+        {
+            const StringRef &name = stringRefs(COLUMN_NAME)[entry];
+            uint64_t slot = XXH3_64bits(mStrings.data() + name.offset(), name.length());
+            while ( lookup[slot & ( header.lookupSlots - 1 )] != FLAT_INDEX_NO_ENTRY )
+                ++slot;
+            lookup[slot & ( header.lookupSlots - 1 )] = entry;
+        }
+
+        const void *columns[COLUMN_COUNT] = {
+            mParent.data(), mSubtreeEnd.data(), mFileCount.data(), mMeta.data(),
+            mDevice.data(), mInode.data(), mSize.data(), mChunkSize.data(),
+            mModifiedTime.data(), mChangeTime.data(), stringRefs(COLUMN_NAME).data(), stringRefs(COLUMN_HASH).data(),
+            mChunks.data(), mChunkHashes.data(), lookup.data(), mStrings.data(),
+        };
+        uint64_t offset = alignUp(sizeof(FlatHeader));
+        for ( size_t column = 0; column < COLUMN_COUNT; ++column )
+        {
+            header.columnOffset[column] = offset;
+            offset = alignUp(offset + columnElements(header, column) * COLUMN_ELEMENT_BYTES[column]);
+        }
+
+        const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if ( fd < 0 )
+            return -1;
+        bool written = ftruncate(fd, static_cast<off_t>(offset)) == 0 && writeAt(fd, &header, sizeof(header), 0);
+        for ( size_t column = 0; written && column < COLUMN_COUNT; ++column )
+            written = writeAt(fd, columns[column], columnElements(header, column) * COLUMN_ELEMENT_BYTES[column], header.columnOffset[column]);
+        return close(fd) == 0 && written ? 0 : -1;
+    }
+
+private:
+    uint32_t addEntry(uint32_t parent, uint32_t fields)
+    {
+        if ( mParent.size() >= FLAT_INDEX_NO_ENTRY - 1 )
+            return FLAT_INDEX_NO_ENTRY;
+        const auto entry = static_cast<uint32_t>(mParent.size());
+        mParent.push_back(parent);
+        mSubtreeEnd.push_back(entry + 1);
+        mFileCount.push_back(0);
+        mMeta.push_back(EntryMeta { fields, 0, 0, 0 });
+        mDevice.push_back(0);
+        mInode.push_back(0);
+        mSize.push_back(0);
+        mChunkSize.push_back(0);
+        mModifiedTime.push_back(0);
+        mChangeTime.push_back(0);
+        for ( auto &column : mStringRefs )
+            column.push_back(StringRef { 0 });
+        mChunks.push_back(ChunkRange { 0, 0 });
+        return entry;
+    }
+
+    bool add(const com::fileindexer::File &file, uint32_t parent)
+    {
+        const uint32_t entry = addEntry(parent, 0);
+        if ( entry == FLAT_INDEX_NO_ENTRY )
+            return false;
+        EntryMeta &meta = mMeta[entry];
+        setString(COLUMN_NAME, entry, file.has_name(), file.name(), meta, FIELD_NAME);
+        setString(COLUMN_HASH, entry, file.has_hash(), file.hash(), meta, FIELD_HASH);
+        if ( file.has_modifiedtimens() )
+            setField(meta, FIELD_MODIFIED_TIME, mModifiedTime[entry], file.modifiedtimens());
+        if ( file.has_changetimens() )
+            setField(meta, FIELD_CHANGE_TIME, mChangeTime[entry], file.changetimens());
+        if ( file.has_permissions() )
+            setField(meta, FIELD_PERMISSIONS, meta.permissions, file.permissions());
+        if ( file.has_type() )
+            setField(meta, FIELD_TYPE, meta.type, file.type());
+        if ( file.has_hashalgorithm() )
+            setField(meta, FIELD_HASH_ALGORITHM, meta.hashAlgorithm, file.hashalgorithm());
+        if ( file.has_device() )
+            setField(meta, FIELD_DEVICE, mDevice[entry], file.device());
+        if ( file.has_inode() )
+            setField(meta, FIELD_INODE, mInode[entry], file.inode());
+        if ( file.has_size() )
+            setField(meta, FIELD_SIZE, mSize[entry], file.size());
+        if ( file.has_chunksize() )
+            setField(meta, FIELD_CHUNK_SIZE, mChunkSize[entry], file.chunksize());
+        mChunks[entry] = ChunkRange { static_cast<uint32_t>(mChunkHashes.size()), static_cast<uint32_t>(file.chunkhashes_size()) };
+        for ( const auto &chunkHash : file.chunkhashes() )
+            mChunkHashes.push_back(addString(chunkHash));
+        return true;
+    }
+
+    template <typename Column, typename Value>
+    static void setField(EntryMeta &meta, FlatField field, Column &column, Value value)
+    {
+        meta.fields |= field;
+        column = static_cast<Column>(value);
+    }
+
+    void setString(FlatColumn column, uint32_t entry, bool present, const std::string &value, EntryMeta &meta, FlatField field)
+    {
+        if ( !present )
+            return;
+        meta.fields |= field;
+        stringRefs(column)[entry] = addString(value);
+    }
+
+    std::vector<StringRef> &stringRefs(FlatColumn column)
+    {
+        return mStringRefs[column - COLUMN_NAME];
+    }
+
+    StringRef addString(const std::string &value)
+    {
+        if ( value.size() >> FLAT_INDEX_STRING_LENGTH_BITS != 0 || mStrings.size() >> ( 64 - FLAT_INDEX_STRING_LENGTH_BITS ) != 0 )
+            mOverflow = true;
+        const StringRef ref { static_cast<uint64_t>(mStrings.size()) << FLAT_INDEX_STRING_LENGTH_BITS | value.size() };
+        mStrings += value;
+        return ref;
+    }
+
+    std::vector<uint32_t> mParent;
+    std::vector<uint32_t> mSubtreeEnd;
+    std::vector<uint32_t> mFileCount;
+    std::vector<EntryMeta> mMeta;
+    std::vector<uint64_t> mDevice;
+    std::vector<uint64_t> mInode;
+    std::vector<uint64_t> mSize;
+    std::vector<uint64_t> mChunkSize;
+    std::vector<int64_t> mModifiedTime;
+    std::vector<int64_t> mChangeTime;
+    std::vector<StringRef> mStringRefs[COLUMN_HASH - COLUMN_NAME + 1];  ///< name, hash
+    std::vector<ChunkRange> mChunks;
+    std::vector<StringRef> mChunkHashes;
+    std::string mStrings;
+    bool mOverflow = false;     ///< A string does not fit a StringRef
+};
+
+} // namespace
+
+// Section 6: Static Methods
+std::filesystem::path FlatIndex::flatPath(const std::filesystem::path &indexPath)
+{
+    return indexPath.string() + FLAT_INDEX_SUFFIX;
+}
+
+int FlatIndex::write(const std::filesystem::path &indexPath, const com::fileindexer::Folder &index)
+{
+    FlatHeader header {};
+    memcpy(header.magic, FLAT_INDEX_MAGIC, sizeof(FLAT_INDEX_MAGIC));
+    header.version = FLAT_INDEX_VERSION;
+    if ( !identify(indexPath, header) )
+        return -1;
+
+    FlatWriter writer;
+    const std::filesystem::path path = flatPath(indexPath);
+    const std::filesystem::path tmpPath = path.string() + FLAT_INDEX_TMP_SUFFIX;
+    std::error_code errorCode;
+    if ( !writer.add(index, FLAT_INDEX_NO_ENTRY) || writer.write(tmpPath, header) != 0 )
+    {
+        std::filesystem::remove(tmpPath, errorCode);
+        return -1;
+    }
+    // a cache, not worth the flush a rename over the old file would force
+    std::filesystem::remove(path, errorCode);
+    std::filesystem::rename(tmpPath, path, errorCode);
+    return errorCode ? -1 : 0;
+}
+
+int FlatIndex::retarget(const std::filesystem::path &indexPath)
+{
+    const int fd = ::open(flatPath(indexPath).c_str(), O_RDWR | O_CLOEXEC);
+    if ( fd < 0 )
+        return -1;
+    FlatHeader header {};
+    bool written = pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                   memcmp(header.magic, FLAT_INDEX_MAGIC, sizeof(FLAT_INDEX_MAGIC)) == 0 &&
+                   header.version == FLAT_INDEX_VERSION;
+    header.logInode = 0;
+    header.logSize = 0;
+    written = written && identify(indexPath, header) && writeAt(fd, &header, sizeof(header), 0);
+    return close(fd) == 0 && written ? 0 : -1;
+}
+
+bool FlatIndex::isCurrent(const std::filesystem::path &indexPath)
+{
+    const int fd = ::open(flatPath(indexPath).c_str(), O_RDONLY | O_CLOEXEC);
+    if ( fd < 0 )
+        return false;
+    FlatHeader header {};
+    struct stat status {};
+    const bool current = pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                         fstat(fd, &status) == 0 &&
+                         isValidHeader(header, indexPath, static_cast<uint64_t>(status.st_size));
+    close(fd);
+    return current;
+}
+
+// Section 7: Public/Protected/Private Methods
+FlatIndex::~FlatIndex()
+{
+    if ( mMap != nullptr )
+        munmap(mMap, mMapSize);
+}
+
+bool FlatIndex::open(const std::filesystem::path &indexPath)
+{
+    const int fd = ::open(flatPath(indexPath).c_str(), O_RDONLY | O_CLOEXEC);
+    if ( fd < 0 )
+        return false;
+    struct stat status {};
+    void *map = MAP_FAILED;
+    if ( fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(FlatHeader) )
+        map = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED )
+        return false;
+    if ( !isValidHeader(*static_cast<const FlatHeader *>(map), indexPath, static_cast<uint64_t>(status.st_size)) )
+    {
+        munmap(map, static_cast<size_t>(status.st_size));
+        return false;
+    }
+    if ( mMap != nullptr )
+        munmap(mMap, mMapSize);
+    mMap = map;
+    mMapSize = static_cast<size_t>(status.st_size);
+    mEntryCount = static_cast<const FlatHeader *>(map)->entryCount;
+    return true;
+}
+
+uint32_t FlatIndex::find(std::string_view name) const
+{
+    if ( mMap == nullptr )
+        return FLAT_INDEX_NO_ENTRY;
+    const auto &header = *static_cast<const FlatHeader *>(mMap);
+    const auto *lookup = static_cast<const uint32_t *>(column(COLUMN_LOOKUP));
+    const uint64_t first = XXH3_64bits(name.data(), name.size());
+    for ( uint64_t slot = first; slot - first < header.lookupSlots; ++slot )
+    {
+        const uint32_t entry = lookup[slot & ( header.lookupSlots - 1 )];
+        if ( entry >= mEntryCount )
+            return FLAT_INDEX_NO_ENTRY;
+        if ( this->name(entry) == name )
+            return entry;
+    }
+    return FLAT_INDEX_NO_ENTRY;
+}
+
+bool FlatIndex::isFolder(uint32_t entry) const
+{
+    return ( static_cast<const EntryMeta *>(column(COLUMN_META))[entry].fields & FIELD_FOLDER ) != 0;
+}
+
+std::string_view FlatIndex::name(uint32_t entry) const
+{
+    return string(COLUMN_NAME, entry);
+}
+
+uint32_t FlatIndex::subtreeEnd(uint32_t entry) const
+{
+    const uint32_t end = static_cast<const uint32_t *>(column(COLUMN_SUBTREE_END))[entry];
+    return end > entry && end <= mEntryCount ? end : entry + 1;
+}
+
+uint32_t FlatIndex::fileCount(uint32_t entry) const
+{
+    // never past the subtree, however malformed the file
+    return std::min(static_cast<const uint32_t *>(column(COLUMN_FILE_COUNT))[entry], subtreeEnd(entry) - entry - 1);
+}
+
+void FlatIndex::toFile(uint32_t entry, com::fileindexer::File &file) const
+{
+    const EntryMeta &meta = static_cast<const EntryMeta *>(column(COLUMN_META))[entry];
+    if ( meta.fields & FIELD_NAME )
+        file.set_name(std::string(string(COLUMN_NAME, entry)));
+    if ( meta.fields & FIELD_MODIFIED_TIME )
+        file.set_modifiedtimens(static_cast<const int64_t *>(column(COLUMN_MODIFIED_TIME))[entry]);
+    if ( meta.fields & FIELD_PERMISSIONS )
+        file.set_permissions(meta.permissions);
+    if ( meta.fields & FIELD_TYPE )
+        file.set_type(static_cast<com::fileindexer::File::FileType>(meta.type));
+    if ( meta.fields & FIELD_HASH )
+        file.set_hash(std::string(string(COLUMN_HASH, entry)));
+    if ( meta.fields & FIELD_CHANGE_TIME )
+        file.set_changetimens(static_cast<const int64_t *>(column(COLUMN_CHANGE_TIME))[entry]);
+    if ( meta.fields & FIELD_DEVICE )
+        file.set_device(static_cast<const uint64_t *>(column(COLUMN_DEVICE))[entry]);
+    if ( meta.fields & FIELD_INODE )
+        file.set_inode(static_cast<const uint64_t *>(column(COLUMN_INODE))[entry]);
+    if ( meta.fields & FIELD_SIZE )
+        file.set_size(static_cast<const uint64_t *>(column(COLUMN_SIZE))[entry]);
+    if ( meta.fields & FIELD_HASH_ALGORITHM )
+        file.set_hashalgorithm(static_cast<com::fileindexer::File::HashAlgorithm>(meta.hashAlgorithm));
+    if ( meta.fields & FIELD_CHUNK_SIZE )
+        file.set_chunksize(static_cast<const uint64_t *>(column(COLUMN_CHUNK_SIZE))[entry]);
+
+    const auto &header = *static_cast<const FlatHeader *>(mMap);
+    const ChunkRange &chunks = static_cast<const ChunkRange *>(column(COLUMN_CHUNKS))[entry];
+    if ( chunks.count == 0 || chunks.first > header.chunkHashCount || chunks.count > header.chunkHashCount - chunks.first )
+        return;
+    const auto *chunkHashes = static_cast<const StringRef *>(column(COLUMN_CHUNK_HASHES));
+    const auto *strings = static_cast<const char *>(column(COLUMN_STRINGS));
+    file.mutable_chunkhashes()->Reserve(static_cast<int>(chunks.count));
+    for ( uint32_t i = chunks.first; i < chunks.first + chunks.count; ++i )
+    {
+        const StringRef &ref = chunkHashes[i];
+        if ( ref.offset() <= header.stringBytes && ref.length() <= header.stringBytes - ref.offset() )
+            file.add_chunkhashes(strings + ref.offset(), ref.length());
+    }
+}
+
+void FlatIndex::toFolderEntry(uint32_t entry, com::fileindexer::Folder &folder) const
+{
+    const EntryMeta &meta = static_cast<const EntryMeta *>(column(COLUMN_META))[entry];
+    if ( meta.fields & FIELD_NAME )
+        folder.set_name(std::string(string(COLUMN_NAME, entry)));
+    if ( meta.fields & FIELD_MODIFIED_TIME )
+        folder.set_modifiedtimens(static_cast<const int64_t *>(column(COLUMN_MODIFIED_TIME))[entry]);
+    if ( meta.fields & FIELD_PERMISSIONS )
+        folder.set_permissions(meta.permissions);
+    if ( meta.fields & FIELD_TYPE )
+        folder.set_type(static_cast<com::fileindexer::Folder::FileType>(meta.type));
+    if ( meta.fields & FIELD_CHANGE_TIME )
+        folder.set_changetimens(static_cast<const int64_t *>(column(COLUMN_CHANGE_TIME))[entry]);
+    if ( meta.fields & FIELD_HASH_ALGORITHM )
+        folder.set_hashalgorithm(static_cast<com::fileindexer::File::HashAlgorithm>(meta.hashAlgorithm));
+    if ( meta.fields & FIELD_DEVICE )
+        folder.set_chunkhashminfilesize(static_cast<const uint64_t *>(column(COLUMN_DEVICE))[entry]);
+    if ( meta.fields & FIELD_INODE )
+        folder.set_chunkhashsize(static_cast<const uint64_t *>(column(COLUMN_INODE))[entry]);
+    if ( meta.fields & FIELD_SIZE )
+        folder.set_logsequence(static_cast<const uint64_t *>(column(COLUMN_SIZE))[entry]);
+    if ( meta.fields & FIELD_CHUNK_SIZE )
+        folder.set_formatversion(static_cast<uint32_t>(static_cast<const uint64_t *>(column(COLUMN_CHUNK_SIZE))[entry]));
+}
+
+void FlatIndex::toFolder(uint32_t entry, com::fileindexer::Folder &folder) const
+{
+    toFolderEntry(entry, folder);
+    const uint32_t end = subtreeEnd(entry);
+    const uint32_t firstFolder = entry + 1 + fileCount(entry);
+    folder.mutable_files()->Reserve(static_cast<int>(firstFolder - entry - 1));
+    for ( uint32_t file = entry + 1; file < firstFolder; ++file )
+        toFile(file, *folder.add_files());
+    int folders = 0;
+    for ( uint32_t subfolder = firstFolder; subfolder < end; subfolder = subtreeEnd(subfolder) )
+        ++folders;
+    folder.mutable_folders()->Reserve(folders);
+    for ( uint32_t subfolder = firstFolder; subfolder < end; subfolder = subtreeEnd(subfolder) )
+        toFolder(subfolder, *folder.add_folders());
+}
+
+const void *FlatIndex::column(size_t index) const
+{
+    return static_cast<const char *>(mMap) + static_cast<const FlatHeader *>(mMap)->columnOffset[index];
+}
+
+std::string_view FlatIndex::string(size_t column, uint32_t entry) const
+{
+    const auto &header = *static_cast<const FlatHeader *>(mMap);
+    const StringRef &ref = static_cast<const StringRef *>(this->column(column))[entry];
+    if ( ref.offset() > header.stringBytes || ref.length() > header.stringBytes - ref.offset() )
+        return {};
+    return { static_cast<const char *>(this->column(COLUMN_STRINGS)) + ref.offset(), ref.length() };
+}
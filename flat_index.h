@@ -0,0 +1,148 @@
+// Section 1: Compilation Guards
+#ifndef _FLAT_INDEX_H_
+#define _FLAT_INDEX_H_
+
+// Section 2: Includes
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+#include "file.pb.h"
+#include "folder.pb.h"
+
+// Section 3: Defines and Macros
+constexpr const char *FLAT_INDEX_SUFFIX = ".flat";
+constexpr uint32_t FLAT_INDEX_VERSION = 2;
+constexpr uint32_t FLAT_INDEX_NO_ENTRY = UINT32_MAX;
+
+// Section 4: Classes
+/**
+ * Index file laid out flat so that it is read in place from a memory map, with no parsing.
+ * It is a cache of an index snapshot and its log, <index>.flat, valid only while both are
+ * the very files it was written from.
+ *
+ * Entries are numbered in pre-order, each folder followed by its files and then its
+ * subfolders, so the subtree of an entry is the range up to its subtreeEnd. Every field
+ * lives in a fixed-width column indexed by entry number, times in nanoseconds, strings as
+ * offset and length into one string table. For folders the device, inode, size and chunk size columns hold the
+ * folder-only chunkHashMinFileSize, chunkHashSize, logSequence and formatVersion. Names are
+ * full paths, as in memory, and a hash table over them finds an entry by path. Conversion
+ * to and from Folder is lossless, presence included.
+ */
+class FlatIndex {
+public:
+    FlatIndex() = default;
+    FlatIndex(const FlatIndex &) = delete;
+    FlatIndex &operator=(const FlatIndex &) = delete;
+    ~FlatIndex();
+
+    /**
+     * Gets the flat cache of an index file
+     * @param indexPath Index snapshot
+     * @return Path of its flat cache
+     */
+    static std::filesystem::path flatPath(const std::filesystem::path &indexPath);
+
+    /**
+     * Writes the flat cache of an index file
+     * @param indexPath Index snapshot, written along with its log
+     * @param index Tree the snapshot and its log hold
+     * @return 0 on success, negative on error
+     */
+    static int write(const std::filesystem::path &indexPath, const com::fileindexer::Folder &index);
+
+    /**
+     * Makes the flat cache of an index file valid for the index files as they are now,
+     * after they were rewritten with the content the flat cache holds
+     * @param indexPath Index snapshot
+     * @return 0 on success, negative on error
+     */
+    static int retarget(const std::filesystem::path &indexPath);
+
+    /**
+     * Checks whether the flat cache of an index file was written from its current snapshot and log
+     * @param indexPath Index snapshot
+     * @return true if open() would map it
+     */
+    static bool isCurrent(const std::filesystem::path &indexPath);
+
+    /**
+     * Maps the flat cache of an index file
+     * @param indexPath Index snapshot
+     * @return false if it is missing, stale or malformed
+     */
+    bool open(const std::filesystem::path &indexPath);
+
+    /**
+     * Gets the number of entries, the root being entry 0
+     * @return Entry count
+     */
+    uint32_t size() const { return mEntryCount; }
+
+    /**
+     * Finds an entry by name
+     * @param name Full path of the entry
+     * @return Entry number, FLAT_INDEX_NO_ENTRY if absent
+     */
+    uint32_t find(std::string_view name) const;
+
+    /**
+     * Checks whether an entry is a folder
+     * @param entry Entry number
+     * @return true for a folder, false for a file
+     */
+    bool isFolder(uint32_t entry) const;
+
+    /**
+     * Gets the name of an entry
+     * @param entry Entry number
+     * @return Full path, valid while the index is open
+     */
+    std::string_view name(uint32_t entry) const;
+
+    /**
+     * Gets the entry after the subtree of an entry, its next sibling if it has one
+     * @param entry Entry number
+     * @return Entry number, size() past the last entry
+     */
+    uint32_t subtreeEnd(uint32_t entry) const;
+
+    /**
+     * Gets the number of files of a folder, numbered right after it
+     * @param entry Folder entry number
+     * @return File count
+     */
+    uint32_t fileCount(uint32_t entry) const;
+
+    /**
+     * Converts a file entry
+     * @param entry File entry number
+     * @param file Filled with every field of the entry
+     */
+    void toFile(uint32_t entry, com::fileindexer::File &file) const;
+
+    /**
+     * Converts the own fields of a folder entry, without its files and subfolders
+     * @param entry Folder entry number
+     * @param folder Filled with the folder's own fields
+     */
+    void toFolderEntry(uint32_t entry, com::fileindexer::Folder &folder) const;
+
+    /**
+     * Converts a folder entry and its whole subtree
+     * @param entry Folder entry number
+     * @param folder Filled with the subtree, allocated on its arena
+     */
+    void toFolder(uint32_t entry, com::fileindexer::Folder &folder) const;
+
+private:
+    const void *column(size_t index) const;
+    std::string_view string(size_t column, uint32_t entry) const;
+
+    void *mMap = nullptr;
+    size_t mMapSize = 0;
+    uint32_t mEntryCount = 0;
+};
+
+#endif // _FLAT_INDEX_H_
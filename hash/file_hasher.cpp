@@ -0,0 +1,201 @@
+// *****************************************************************************
+// File Hasher Implementation
+// *****************************************************************************
+
+// Section 1: Includes
+// C++ Standard Library
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+// Project Includes
+#include "file_hasher.h"
+#include "file_reader.h"
+#include "md5_multi.h"
+#include <md5.h>
+#include <xxhash.h>
+
+// Section 2: Defines and Macros
+// (none)
+
+// Section 3: Static Variables
+FileHasher::Algorithm FileHasher::activeAlgorithm = FileHasher::Algorithm::MD5;
+
+namespace {
+
+class Md5Hasher : public FileHasher
+{
+public:
+    Md5Hasher() { MD5Init(&mCtx); }
+    void update(const uint8_t *data, size_t size) override { MD5Update(&mCtx, data, size); }
+    void finish(uint8_t *digest) override { MD5Final(digest, &mCtx); }
+
+private:
+    MD5_CTX mCtx;
+};
+
+class Xxh3Hasher : public FileHasher
+{
+public:
+    Xxh3Hasher() : mState(XXH3_createState()) { XXH3_128bits_reset(mState); }
+    ~Xxh3Hasher() override { XXH3_freeState(mState); }
+    Xxh3Hasher(const Xxh3Hasher&) = delete;
+    Xxh3Hasher& operator=(const Xxh3Hasher&) = delete;
+
+    void update(const uint8_t *data, size_t size) override { XXH3_128bits_update(mState, data, size); }
+    void finish(uint8_t *digest) override
+    {
+        // canonical form is big endian, so the hex string reads like xxhsum's
+        XXH128_canonical_t canonical;
+        XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(mState));
+        memcpy(digest, canonical.digest, FILE_HASHER_DIGEST_LENGTH);
+    }
+
+private:
+    XXH3_state_t *mState;
+};
+
+} // namespace
+
+// Section 4: FileHasher Implementation
+std::unique_ptr<FileHasher> FileHasher::create(Algorithm algorithm)
+{
+    switch ( algorithm )
+    {
+        case Algorithm::XXH3_128:
+            return std::make_unique<Xxh3Hasher>();
+        case Algorithm::MD5:
+        default:
+            return std::make_unique<Md5Hasher>();
+    }
+}
+
+std::string FileHasher::hashFile(const std::string &path, Algorithm algorithm, bool verbose)
+{
+    if ( verbose )
+        std::cout << std::filesystem::path( path ) << "\r\n";
+
+    auto hasher = create(algorithm);
+    const int result = FileReader::read(path.c_str(), [&hasher](const uint8_t *data, size_t size) {
+        hasher->update(data, size);
+    });
+
+    uint8_t digest[FILE_HASHER_DIGEST_LENGTH] = {};
+    if ( result == 0 )
+        hasher->finish(digest);
+    else if ( result != ENOENT )     // a file deleted since it was listed just keeps an empty digest
+        std::cout << "Open file " << path << " for read failed: " << strerror(result) << "\n";
+    return std::string(reinterpret_cast<const char *>(digest), FILE_HASHER_DIGEST_LENGTH);
+}
+
+std::vector<std::string> FileHasher::hashFiles(const std::vector<std::string> &paths, Algorithm algorithm, bool verbose)
+{
+    std::vector<std::string> digests;
+    digests.reserve(paths.size());
+    if ( batchSize(algorithm) < 2 )
+    {
+        for ( const auto &path : paths )
+            digests.push_back(hashFile(path, algorithm, verbose));
+        return digests;
+    }
+
+    // small files fit in memory all at once, read them all and hash them side by side
+    std::vector<std::vector<uint8_t>> contents(paths.size());
+    std::vector<const uint8_t *> data;
+    std::vector<size_t> sizes;
+    std::vector<size_t> readable;
+    for ( size_t i = 0; i < paths.size(); ++i )
+    {
+        if ( verbose )
+            std::cout << std::filesystem::path( paths[i] ) << "\r\n";
+
+        auto &content = contents[i];
+        const int result = FileReader::read(paths[i].c_str(), [&content](const uint8_t *chunk, size_t size) {
+            content.insert(content.end(), chunk, chunk + size);
+        });
+        if ( result != 0 )
+        {
+            if ( result != ENOENT )
+                std::cout << "Open file " << paths[i] << " for read failed: " << strerror(result) << "\n";
+            continue;
+        }
+        data.push_back(content.data());
+        sizes.push_back(content.size());
+        readable.push_back(i);
+    }
+
+    std::vector<uint8_t> readDigests(readable.size() * FILE_HASHER_DIGEST_LENGTH);
+    MD5MultiBuffer::digest(data.data(), sizes.data(), readable.size(), readDigests.data());
+
+    // unreadable files keep a zeroed digest, like hashFile()
+    std::vector<uint8_t> rawDigests(paths.size() * FILE_HASHER_DIGEST_LENGTH, 0);
+    for ( size_t i = 0; i < readable.size(); ++i )
+        memcpy(&rawDigests[readable[i] * FILE_HASHER_DIGEST_LENGTH], &readDigests[i * FILE_HASHER_DIGEST_LENGTH], FILE_HASHER_DIGEST_LENGTH);
+
+    for ( size_t i = 0; i < paths.size(); ++i )
+        digests.emplace_back(reinterpret_cast<const char *>(&rawDigests[i * FILE_HASHER_DIGEST_LENGTH]), FILE_HASHER_DIGEST_LENGTH);
+    return digests;
+}
+
+int FileHasher::hashRange(const std::string &path, uint64_t offset, uint64_t length, Algorithm algorithm, uint8_t *digest)
+{
+    auto hasher = create(algorithm);
+    const int result = FileReader::readRange(path.c_str(), offset, length, [&hasher](const uint8_t *data, size_t size) {
+        hasher->update(data, size);
+    });
+    if ( result == 0 )
+        hasher->finish(digest);
+    return result;
+}
+
+std::string FileHasher::combineChunks(Algorithm algorithm, const uint8_t *chunkDigests, size_t count)
+{
+    auto hasher = create(algorithm);
+    hasher->update(chunkDigests, count * FILE_HASHER_DIGEST_LENGTH);
+    uint8_t digest[FILE_HASHER_DIGEST_LENGTH];
+    hasher->finish(digest);
+    return std::string(reinterpret_cast<const char *>(digest), FILE_HASHER_DIGEST_LENGTH);
+}
+
+size_t FileHasher::batchSize(Algorithm algorithm)
+{
+    // xxh3 has no per-file setup worth amortizing and is already memory bound
+    return algorithm == Algorithm::MD5 ? MD5MultiBuffer::lanes() : 1;
+}
+
+std::string FileHasher::toHex(const std::string &digest)
+{
+    static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+    std::string hex(2 * digest.size(), '0');
+    for ( size_t i = 0; i < digest.size(); ++i )
+    {
+        const auto byte = static_cast<uint8_t>(digest[i]);
+        hex[2 * i] = HEX_DIGITS[byte >> 4];
+        hex[2 * i + 1] = HEX_DIGITS[byte & 0x0F];
+    }
+    return hex;
+}
+
+bool FileHasher::parseAlgorithm(const std::string &name, Algorithm &algorithm)
+{
+    if ( name == "md5" )
+        algorithm = Algorithm::MD5;
+    else if ( name == "xxh3-128" || name == "xxh3" )
+        algorithm = Algorithm::XXH3_128;
+    else
+        return false;
+    return true;
+}
+
+const char *FileHasher::algorithmName(Algorithm algorithm)
+{
+    switch ( algorithm )
+    {
+        case Algorithm::XXH3_128:
+            return "xxh3-128";
+        case Algorithm::MD5:
+        default:
+            return "md5";
+    }
+}
@@ -0,0 +1,161 @@
+// *****************************************************************************
+// File Hasher Header
+// *****************************************************************************
+
+#ifndef __FILE_HASHER_H__
+#define __FILE_HASHER_H__
+
+// Section 1: Includes
+// C++ Standard Library
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Section 2: Defines and Macros
+#define FILE_HASHER_DIGEST_LENGTH (16)
+#define FILE_HASHER_SMALL_FILE_BYTES (64 * 1024)
+
+// Section 3: Class Definition
+/**
+ * Streaming content hasher, one implementation per algorithm.
+ * Every algorithm produces a 128-bit digest, kept as its 16 raw bytes so the
+ * index, the hash cache and the wire format do not depend on the choice. Hex is
+ * for display only.
+ * The numeric values of Algorithm are stored in the index and the hash cache
+ * and must match com::fileindexer::File::HashAlgorithm.
+ */
+class FileHasher
+{
+public:
+    enum class Algorithm : uint8_t
+    {
+        MD5 = 0,        ///< what every index before the algorithm tag was hashed with
+        XXH3_128,       ///< non-cryptographic, several GB/s per core
+    };
+
+    virtual ~FileHasher() = default;
+
+    /**
+     * Feeds the next chunk of content
+     * @param data Chunk to hash
+     * @param size Number of bytes in the chunk
+     */
+    virtual void update(const uint8_t *data, size_t size) = 0;
+
+    /**
+     * Finishes the digest, the hasher is not usable afterwards
+     * @param digest Receives FILE_HASHER_DIGEST_LENGTH bytes
+     */
+    virtual void finish(uint8_t *digest) = 0;
+
+    /**
+     * Creates a hasher
+     * @param algorithm Algorithm to hash with
+     * @return New hasher
+     */
+    static std::unique_ptr<FileHasher> create(Algorithm algorithm);
+
+    /**
+     * Hashes a whole file through FileReader
+     * @param path File to hash
+     * @param algorithm Algorithm to hash with
+     * @param verbose Print the path before hashing
+     * @return Raw digest, all zeros when the file could not be read
+     */
+    static std::string hashFile(const std::string &path, Algorithm algorithm, bool verbose);
+
+    /**
+     * Hashes several small files together, which some algorithms do much faster than one by one
+     * @param paths Files to hash, expected to be at most FILE_HASHER_SMALL_FILE_BYTES each
+     * @param algorithm Algorithm to hash with
+     * @param verbose Print the paths before hashing
+     * @return Raw digest of every file, in the order of paths, all zeros for files that could not be read
+     */
+    static std::vector<std::string> hashFiles(const std::vector<std::string> &paths, Algorithm algorithm, bool verbose);
+
+    /**
+     * Hashes part of a file, one chunk of a chunk tree digest
+     * @param path File to hash
+     * @param offset First byte of the chunk
+     * @param length Chunk size, the last chunk of a file may be shorter
+     * @param algorithm Algorithm to hash with
+     * @param digest Receives FILE_HASHER_DIGEST_LENGTH bytes
+     * @return 0 on success, errno value on failure
+     */
+    static int hashRange(const std::string &path, uint64_t offset, uint64_t length, Algorithm algorithm, uint8_t *digest);
+
+    /**
+     * Combines the chunk digests of a file into its chunk tree digest
+     * @param algorithm Algorithm the chunks were hashed with
+     * @param chunkDigests FILE_HASHER_DIGEST_LENGTH bytes per chunk, in file order
+     * @param count Number of chunks
+     * @return Raw digest of the concatenated chunk digests
+     */
+    static std::string combineChunks(Algorithm algorithm, const uint8_t *chunkDigests, size_t count);
+
+    /**
+     * Gets how many small files hashFiles() hashes at once
+     * @param algorithm Algorithm to hash with
+     * @return Files per batch, 1 when batching brings nothing
+     */
+    static size_t batchSize(Algorithm algorithm);
+
+    /**
+     * Formats a digest for display
+     * @param digest Raw digest
+     * @return Hex digest
+     */
+    static std::string toHex(const std::string &digest);
+
+    /**
+     * Compares two digests, as two 64-bit words when both are FILE_HASHER_DIGEST_LENGTH bytes
+     * @param digestA Raw digest
+     * @param digestB Raw digest
+     * @return true if they are equal
+     */
+    static bool sameDigest(const std::string &digestA, const std::string &digestB)
+    {
+        if ( digestA.size() != FILE_HASHER_DIGEST_LENGTH || digestB.size() != FILE_HASHER_DIGEST_LENGTH )
+            return digestA == digestB;
+        uint64_t wordsA[2];
+        uint64_t wordsB[2];
+        memcpy(wordsA, digestA.data(), sizeof(wordsA));
+        memcpy(wordsB, digestB.data(), sizeof(wordsB));
+        return ( ( wordsA[0] ^ wordsB[0] ) | ( wordsA[1] ^ wordsB[1] ) ) == 0;
+    }
+
+    /**
+     * Sets the algorithm new digests are computed with
+     * @param algorithm Algorithm to use
+     */
+    static void setAlgorithm(Algorithm algorithm) { activeAlgorithm = algorithm; }
+
+    /**
+     * Gets the algorithm new digests are computed with
+     * @return Active algorithm
+     */
+    static Algorithm algorithm() { return activeAlgorithm; }
+
+    /**
+     * Parses an algorithm name
+     * @param name "md5" or "xxh3-128"
+     * @param algorithm Parsed algorithm
+     * @return true if the name is known
+     */
+    static bool parseAlgorithm(const std::string &name, Algorithm &algorithm);
+
+    /**
+     * Gets the name of an algorithm, as accepted by parseAlgorithm()
+     * @param algorithm Algorithm to name
+     * @return Algorithm name
+     */
+    static const char *algorithmName(Algorithm algorithm);
+
+private:
+    static Algorithm activeAlgorithm;
+};
+
+#endif // __FILE_HASHER_H__
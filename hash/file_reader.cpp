@@ -0,0 +1,231 @@
+// *****************************************************************************
+// File Reader Implementation
+// *****************************************************************************
+
+// Section 1: Includes
+// C++ Standard Library
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+
+// System Includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Project Includes
+#include "file_reader.h"
+
+// Section 2: Defines and Macros
+// (none)
+
+// Section 3: Static Variables
+FileReader::Mode FileReader::largeFileMode = FileReader::Mode::BUFFERED;
+uint64_t FileReader::largeFileBytes = FILE_READER_DEFAULT_LARGE_FILE_BYTES;
+
+namespace {
+
+struct FreeDeleter
+{
+    void operator()(uint8_t *buffer) const { free(buffer); }
+};
+
+struct ThreadBuffer
+{
+    std::unique_ptr<uint8_t, FreeDeleter> data;
+    size_t capacity = 0;
+};
+
+thread_local ThreadBuffer threadLocalBuffer;
+
+/**
+ * Closes a file descriptor when going out of scope
+ */
+class FdGuard
+{
+public:
+    explicit FdGuard(int fd) : mFd(fd) {}
+    ~FdGuard() { if ( mFd >= 0 ) close(mFd); }
+    FdGuard(const FdGuard&) = delete;
+    FdGuard& operator=(const FdGuard&) = delete;
+    int get() const { return mFd; }
+
+private:
+    int mFd;
+};
+
+} // namespace
+
+// Section 4: FileReader Implementation
+int FileReader::read(const char *path, const ChunkHandler &handler)
+{
+    struct stat fileInfo;
+    if ( stat(path, &fileInfo) != 0 )
+        return errno;
+
+    const uint64_t size = static_cast<uint64_t>(fileInfo.st_size);
+    return read(path, size >= largeFileBytes ? largeFileMode : Mode::BUFFERED, handler);
+}
+
+int FileReader::read(const char *path, Mode mode, const ChunkHandler &handler)
+{
+    const FdGuard fd(open(path, O_RDONLY | O_CLOEXEC));
+    if ( fd.get() < 0 )
+        return errno;
+
+    struct stat fileInfo;
+    if ( fstat(fd.get(), &fileInfo) != 0 )
+        return errno;
+    const uint64_t size = static_cast<uint64_t>(fileInfo.st_size);
+
+    int result = 0;
+    switch ( mode )
+    {
+        case Mode::DIRECT:
+            result = readDirect(path, fd.get(), size, handler);
+            break;
+        case Mode::MMAP:
+            result = readMapped(fd.get(), size, handler);
+            break;
+        case Mode::BUFFERED:
+        default:
+            posix_fadvise(fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+            result = readBuffered(fd.get(), 0, size, handler);
+            break;
+    }
+
+    // we will not read this file again soon, leave the page cache to whoever had it before
+    posix_fadvise(fd.get(), 0, 0, POSIX_FADV_DONTNEED);
+    return result;
+}
+
+int FileReader::readRange(const char *path, uint64_t offset, uint64_t length, const ChunkHandler &handler)
+{
+    const FdGuard fd(open(path, O_RDONLY | O_CLOEXEC));
+    if ( fd.get() < 0 )
+        return errno;
+
+    // several threads may read different ranges of one file, keep the hints to this range
+    posix_fadvise(fd.get(), static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_SEQUENTIAL);
+    const int result = readBuffered(fd.get(), offset, offset + length, handler, offset + length);
+    posix_fadvise(fd.get(), static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+    return result;
+}
+
+void FileReader::setLargeFileMode(Mode mode, uint64_t thresholdBytes)
+{
+    largeFileMode = mode;
+    largeFileBytes = thresholdBytes;
+}
+
+bool FileReader::parseMode(const std::string &name, Mode &mode)
+{
+    if ( name == "buffered" )
+        mode = Mode::BUFFERED;
+    else if ( name == "direct" )
+        mode = Mode::DIRECT;
+    else if ( name == "mmap" )
+        mode = Mode::MMAP;
+    else
+        return false;
+    return true;
+}
+
+int FileReader::readBuffered(int fd, uint64_t offset, uint64_t size, const ChunkHandler &handler, uint64_t end)
+{
+    uint8_t *buffer = threadBuffer(size - std::min(offset, size));
+    if ( buffer == nullptr )
+        return ENOMEM;
+    const size_t capacity = threadLocalBuffer.capacity;
+
+    while ( offset < end )
+    {
+        const size_t wanted = static_cast<size_t>(std::min<uint64_t>(capacity, end - offset));
+        const ssize_t bytesRead = pread(fd, buffer, wanted, static_cast<off_t>(offset));
+        if ( bytesRead < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return errno;
+        }
+        if ( bytesRead == 0 )
+            return 0;
+
+        handler(buffer, static_cast<size_t>(bytesRead));
+        offset += static_cast<uint64_t>(bytesRead);
+    }
+    return 0;
+}
+
+int FileReader::readDirect(const char *path, int fd, uint64_t size, const ChunkHandler &handler)
+{
+    const FdGuard directFd(open(path, O_RDONLY | O_CLOEXEC | O_DIRECT));
+    if ( directFd.get() < 0 )
+    {
+        // tmpfs and some network filesystems refuse O_DIRECT
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return readBuffered(fd, 0, size, handler);
+    }
+
+    uint8_t *buffer = threadBuffer(size);
+    if ( buffer == nullptr )
+        return ENOMEM;
+    const size_t capacity = threadLocalBuffer.capacity;
+    uint64_t offset = 0;
+
+    while ( true )
+    {
+        const ssize_t bytesRead = pread(directFd.get(), buffer, capacity, static_cast<off_t>(offset));
+        if ( bytesRead < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( errno != EINVAL )
+                return errno;
+            // a short read left the offset unaligned, finish through the page cache
+            posix_fadvise(fd, static_cast<off_t>(offset), 0, POSIX_FADV_SEQUENTIAL);
+            return readBuffered(fd, offset, size, handler);
+        }
+        if ( bytesRead == 0 )
+            return 0;
+
+        handler(buffer, static_cast<size_t>(bytesRead));
+        offset += static_cast<uint64_t>(bytesRead);
+    }
+}
+
+int FileReader::readMapped(int fd, uint64_t size, const ChunkHandler &handler)
+{
+    if ( size == 0 )
+        return 0;
+
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if ( mapping == MAP_FAILED )
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return readBuffered(fd, 0, size, handler);
+    }
+
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    const auto *data = static_cast<const uint8_t *>(mapping);
+    for ( uint64_t offset = 0; offset < size; offset += FILE_READER_MAX_CHUNK )
+        handler(data + offset, static_cast<size_t>(std::min<uint64_t>(FILE_READER_MAX_CHUNK, size - offset)));
+
+    munmap(mapping, size);
+    return 0;
+}
+
+uint8_t *FileReader::threadBuffer(uint64_t size)
+{
+    // grow to fit the file, never past the chunk size, and keep the buffer for the next file
+    const uint64_t wanted = std::clamp<uint64_t>((size + FILE_READER_ALIGNMENT - 1) & ~uint64_t(FILE_READER_ALIGNMENT - 1),
+                                                 FILE_READER_ALIGNMENT, FILE_READER_MAX_CHUNK);
+    if ( threadLocalBuffer.capacity < wanted )
+    {
+        threadLocalBuffer.data.reset(static_cast<uint8_t *>(aligned_alloc(FILE_READER_ALIGNMENT, wanted)));
+        threadLocalBuffer.capacity = threadLocalBuffer.data ? wanted : 0;
+    }
+    return threadLocalBuffer.data.get();
+}
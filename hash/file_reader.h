@@ -0,0 +1,93 @@
+// *****************************************************************************
+// File Reader Header
+// *****************************************************************************
+
+#ifndef __FILE_READER_H__
+#define __FILE_READER_H__
+
+// Section 1: Includes
+// C++ Standard Library
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Section 2: Defines and Macros
+#define FILE_READER_MAX_CHUNK (8 * 1024 * 1024)
+#define FILE_READER_ALIGNMENT (4096)
+#define FILE_READER_DEFAULT_LARGE_FILE_BYTES (64ULL * 1024 * 1024)
+
+// Section 3: Class Definition
+/**
+ * Sequential whole-file reader used by the hashers.
+ * Reads go through a per-thread buffer sized to the file (up to
+ * FILE_READER_MAX_CHUNK) that is reused across files. The kernel is told the
+ * access is sequential and the pages are dropped from the page cache once
+ * consumed, so hashing a whole tree does not evict everything else.
+ * Files above the large-file threshold can use O_DIRECT or mmap instead.
+ */
+class FileReader
+{
+public:
+    enum class Mode : uint8_t
+    {
+        BUFFERED = 0,   ///< read() with posix_fadvise hints
+        DIRECT,         ///< O_DIRECT into an aligned buffer, falls back to BUFFERED where unsupported
+        MMAP,           ///< mmap with madvise hints
+    };
+
+    using ChunkHandler = std::function<void(const uint8_t *data, size_t size)>;
+
+    /**
+     * Reads a whole file, picking the mode from its size
+     * @param path File to read
+     * @param handler Called for every chunk, in order
+     * @return 0 on success, errno value on failure
+     */
+    static int read(const char *path, const ChunkHandler &handler);
+
+    /**
+     * Reads a whole file with the given mode
+     * @param path File to read
+     * @param mode Mode to read with
+     * @param handler Called for every chunk, in order
+     * @return 0 on success, errno value on failure
+     */
+    static int read(const char *path, Mode mode, const ChunkHandler &handler);
+
+    /**
+     * Reads part of a file, always buffered
+     * @param path File to read
+     * @param offset First byte to read
+     * @param length Number of bytes to read, less are read if the file ends first
+     * @param handler Called for every chunk, in order
+     * @return 0 on success, errno value on failure
+     */
+    static int readRange(const char *path, uint64_t offset, uint64_t length, const ChunkHandler &handler);
+
+    /**
+     * Sets how files at or above the threshold are read, smaller files are always BUFFERED
+     * @param mode Mode for large files
+     * @param thresholdBytes Size from which a file counts as large
+     */
+    static void setLargeFileMode(Mode mode, uint64_t thresholdBytes);
+
+    /**
+     * Parses a mode name
+     * @param name "buffered", "direct" or "mmap"
+     * @param mode Parsed mode
+     * @return true if the name is known
+     */
+    static bool parseMode(const std::string &name, Mode &mode);
+
+private:
+    static int readBuffered(int fd, uint64_t offset, uint64_t size, const ChunkHandler &handler, uint64_t end = UINT64_MAX);
+    static int readDirect(const char *path, int fd, uint64_t size, const ChunkHandler &handler);
+    static int readMapped(int fd, uint64_t size, const ChunkHandler &handler);
+    static uint8_t *threadBuffer(uint64_t size);
+
+    static Mode largeFileMode;
+    static uint64_t largeFileBytes;
+};
+
+#endif // __FILE_READER_H__
@@ -1,6 +1,23 @@
 set (hash_src
+	hash/file_hasher.cpp
+	hash/file_reader.cpp
+	hash/hash_cache.cpp
+	hash/md5_multi.cpp
+	hash/md5_multi_avx2.cpp
+	hash/md5_multi_avx512.cpp
 	hash/md5_wrapper.cpp
 	)
 set (hash_hdr
+	hash/file_hasher.h
+	hash/file_reader.h
+	hash/hash_cache.h
+	hash/md5_multi.h
+	hash/md5_multi_kernel.h
 	hash/md5_wrapper.h
 	)
+
+# the multi-buffer MD5 kernels are built per instruction set and picked at run time
+if (CMAKE_SYSTEM_PROCESSOR MATCHES "x86_64|AMD64|amd64")
+	set_source_files_properties(hash/md5_multi_avx2.cpp PROPERTIES COMPILE_OPTIONS "-mavx2")
+	set_source_files_properties(hash/md5_multi_avx512.cpp PROPERTIES COMPILE_OPTIONS "-mavx512f")
+endif()
@@ -0,0 +1,252 @@
+// *****************************************************************************
+// Hash Cache Implementation
+// *****************************************************************************
+
+// Section 1: Includes
+// C++ Standard Library
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <unordered_set>
+
+// System Includes
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+// Project Includes
+#include "hash_cache.h"
+
+// Section 2: Defines and Macros
+#define HASH_CACHE_MAGIC "MPSHC002"
+#define HASH_CACHE_MAGIC_LENGTH (8)
+
+// Section 3: Helpers
+namespace {
+
+/**
+ * Holds an flock on the cache lock file for the lifetime of the object
+ */
+class CacheLock
+{
+public:
+    CacheLock(const std::filesystem::path &path, int operation) :
+        mFd(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600))
+    {
+        if ( mFd >= 0 && flock(mFd, operation) != 0 )
+        {
+            close(mFd);
+            mFd = -1;
+        }
+    }
+    ~CacheLock() { if ( mFd >= 0 ) close(mFd); }
+    CacheLock(const CacheLock&) = delete;
+    CacheLock& operator=(const CacheLock&) = delete;
+    bool locked() const { return mFd >= 0; }
+
+private:
+    int mFd;
+};
+
+} // namespace
+
+// Section 4: HashCache Implementation
+HashCache::HashCache(const std::filesystem::path &directory, uint64_t maxSizeBytes) :
+    mLogPath(directory / "hashes"),
+    mLockPath(directory / "hashes.lock"),
+    mMaxSizeBytes(maxSizeBytes),
+    mEnabled(false)
+{
+    if ( directory.empty() || maxSizeBytes < HASH_CACHE_MAGIC_LENGTH + sizeof(Record) )
+        return;
+
+    std::error_code errorCode;
+    std::filesystem::create_directories(directory, errorCode);
+    if ( errorCode.value() != 0 )
+    {
+        std::cerr << "Hash cache disabled, cannot create " << directory << ": " << errorCode.message() << "\r\n";
+        return;
+    }
+
+    const CacheLock lock(mLockPath, LOCK_SH);
+    if ( !lock.locked() )
+    {
+        std::cerr << "Hash cache disabled, cannot lock " << mLockPath << "\r\n";
+        return;
+    }
+
+    std::vector<Record> records;
+    readLog(records);
+    mDigests.reserve(records.size());
+    for ( const auto &record : records )
+        std::copy(std::begin(record.digest), std::end(record.digest), mDigests[record.key].begin());
+
+    mEnabled = true;
+}
+
+HashCache::~HashCache()
+{
+    flush();
+}
+
+std::filesystem::path HashCache::defaultDirectory()
+{
+    if ( const char *cacheHome = std::getenv("XDG_CACHE_HOME"); cacheHome != nullptr && *cacheHome != '\0' )
+        return std::filesystem::path(cacheHome) / "multi-pc-sync";
+    if ( const char *home = std::getenv("HOME"); home != nullptr && *home != '\0' )
+        return std::filesystem::path(home) / ".cache" / "multi-pc-sync";
+    return {};
+}
+
+size_t HashCache::KeyHash::operator()(const Key &key) const
+{
+    size_t seed = std::hash<uint64_t>{}(key.inode);
+    for ( const uint64_t value : { key.device, key.size, static_cast<uint64_t>(key.modifiedTimeNs), static_cast<uint64_t>(key.changeTimeNs), key.algorithm } )
+        seed ^= std::hash<uint64_t>{}(value) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+    return seed;
+}
+
+bool HashCache::lookup(const Key &key, std::string &digest)
+{
+    const std::lock_guard<std::mutex> lock(mMutex);
+    if ( !mEnabled )
+        return false;
+
+    const auto found = mDigests.find(key);
+    if ( found == mDigests.end() )
+        return false;
+
+    digest.assign(reinterpret_cast<const char *>(found->second.data()), found->second.size());
+    // remembered in memory only, compaction then keeps it as one of the newest entries
+    mUsed.insert(key);
+    return true;
+}
+
+void HashCache::insert(const Key &key, const std::string &digest)
+{
+    Record record{ .key = key, .digest = {} };
+    if ( digest.size() != HASH_CACHE_DIGEST_LENGTH )
+        return;
+    memcpy(record.digest, digest.data(), HASH_CACHE_DIGEST_LENGTH);
+
+    const std::lock_guard<std::mutex> lock(mMutex);
+    if ( !mEnabled )
+        return;
+
+    std::copy(std::begin(record.digest), std::end(record.digest), mDigests[key].begin());
+    mPending.push_back(record);
+}
+
+void HashCache::flush()
+{
+    const std::lock_guard<std::mutex> guard(mMutex);
+    if ( !mEnabled || mPending.empty() )
+        return;
+
+    const CacheLock lock(mLockPath, LOCK_EX);
+    if ( !lock.locked() )
+        return;
+
+    // another process may have appended or compacted since we loaded, only trust the file itself
+    std::error_code errorCode;
+    const uintmax_t logSize = std::filesystem::file_size(mLogPath, errorCode);
+    const bool appendable = errorCode.value() == 0 && logSize >= HASH_CACHE_MAGIC_LENGTH &&
+                            (logSize - HASH_CACHE_MAGIC_LENGTH) % sizeof(Record) == 0 &&
+                            logSize + mPending.size() * sizeof(Record) <= mMaxSizeBytes;
+
+    if ( appendable )
+    {
+        char magic[HASH_CACHE_MAGIC_LENGTH] = {};
+        std::ifstream header(mLogPath, std::ios::binary);
+        header.read(magic, HASH_CACHE_MAGIC_LENGTH);
+        if ( header.gcount() == HASH_CACHE_MAGIC_LENGTH && memcmp(magic, HASH_CACHE_MAGIC, HASH_CACHE_MAGIC_LENGTH) == 0 )
+        {
+            std::ofstream log(mLogPath, std::ios::binary | std::ios::app);
+            log.write(reinterpret_cast<const char *>(mPending.data()), static_cast<std::streamsize>(mPending.size() * sizeof(Record)));
+            log.flush();
+            if ( log )
+            {
+                mPending.clear();
+                return;
+            }
+            // a record cut short would misalign every one appended after it, the digests stay pending
+            log.close();
+            std::filesystem::resize_file(mLogPath, logSize, errorCode);
+            std::cerr << "Failed to append to hash cache " << mLogPath << "\r\n";
+            return;
+        }
+    }
+
+    std::vector<Record> records;
+    readLog(records);
+    records.insert(records.end(), mPending.begin(), mPending.end());
+    compact(records);
+
+    const std::filesystem::path tmpPath = mLogPath.string() + ".tmp";
+    {
+        std::ofstream log(tmpPath, std::ios::binary | std::ios::trunc);
+        log.write(HASH_CACHE_MAGIC, HASH_CACHE_MAGIC_LENGTH);
+        log.write(reinterpret_cast<const char *>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(Record)));
+        if ( !log )
+        {
+            std::cerr << "Failed to write hash cache " << tmpPath << "\r\n";
+            std::filesystem::remove(tmpPath, errorCode);
+            return;
+        }
+    }
+    std::filesystem::rename(tmpPath, mLogPath, errorCode);
+    if ( errorCode.value() != 0 )
+    {
+        std::cerr << "Failed to replace hash cache " << mLogPath << ": " << errorCode.message() << "\r\n";
+        return;
+    }
+    mPending.clear();
+}
+
+bool HashCache::readLog(std::vector<Record> &records) const
+{
+    std::ifstream log(mLogPath, std::ios::binary);
+    if ( !log )
+        return false;
+
+    char magic[HASH_CACHE_MAGIC_LENGTH] = {};
+    log.read(magic, HASH_CACHE_MAGIC_LENGTH);
+    if ( log.gcount() != HASH_CACHE_MAGIC_LENGTH || memcmp(magic, HASH_CACHE_MAGIC, HASH_CACHE_MAGIC_LENGTH) != 0 )
+        return false;
+
+    std::error_code errorCode;
+    const uintmax_t logSize = std::filesystem::file_size(mLogPath, errorCode);
+    if ( errorCode.value() != 0 )
+        return false;
+
+    // a torn last record from an interrupted append is dropped
+    records.resize((logSize - HASH_CACHE_MAGIC_LENGTH) / sizeof(Record));
+    log.read(reinterpret_cast<char *>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(Record)));
+    records.resize(static_cast<size_t>(log.gcount()) / sizeof(Record));
+    return true;
+}
+
+void HashCache::compact(std::vector<Record> &records) const
+{
+    // the entries this process looked up count as newer than any other, their own order kept
+    std::stable_partition(records.begin(), records.end(), [this](const Record &record) { return !mUsed.contains(record.key); });
+
+    // keep the last record of every key, newest first, until half the cap is used
+    const size_t maxRecords = (mMaxSizeBytes - HASH_CACHE_MAGIC_LENGTH) / sizeof(Record);
+    const size_t keepRecords = std::max<size_t>(1, maxRecords / 2);
+
+    std::unordered_set<Key, KeyHash> seen;
+    std::vector<Record> kept;
+    kept.reserve(std::min(records.size(), keepRecords));
+    for ( auto record = records.rbegin(); record != records.rend() && kept.size() < keepRecords; ++record )
+    {
+        if ( seen.insert(record->key).second )
+            kept.push_back(*record);
+    }
+    std::reverse(kept.begin(), kept.end());
+    records.swap(kept);
+}
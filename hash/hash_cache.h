@@ -0,0 +1,116 @@
+// *****************************************************************************
+// Hash Cache Header
+// *****************************************************************************
+
+#ifndef __HASH_CACHE_H__
+#define __HASH_CACHE_H__
+
+// Section 1: Includes
+// C++ Standard Library
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Section 2: Defines and Macros
+#define HASH_CACHE_DIGEST_LENGTH (16)
+
+// Section 3: Class Definition
+/**
+ * Content digests persisted outside of the sync roots, keyed by what the
+ * filesystem tells about a file without reading it. Survives index
+ * rebuilds and is shared by every sync root on the machine.
+ *
+ * The cache is an append-only log of fixed-size records. Lookups are served
+ * from memory, new digests are appended on flush() and the log is compacted
+ * down to its newest records once it grows past the size cap, the ones looked
+ * up by the compacting process counted as the newest. Concurrent processes
+ * serialize on a lock file next to the log.
+ */
+class HashCache
+{
+public:
+    struct Key
+    {
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+        int64_t modifiedTimeNs;
+        int64_t changeTimeNs;
+        uint64_t algorithm;     ///< FileHasher::Algorithm the digest is computed with
+        bool operator==(const Key &other) const = default;
+    };
+
+    /**
+     * Loads the cache
+     * @param directory Directory holding the cache files, created if missing
+     * @param maxSizeBytes Size the log is compacted under, 0 disables the cache
+     */
+    HashCache(const std::filesystem::path &directory, uint64_t maxSizeBytes);
+
+    /**
+     * Flushes the new digests
+     */
+    virtual ~HashCache();
+
+    HashCache(const HashCache&) = delete;
+    HashCache& operator=(const HashCache&) = delete;
+
+    /**
+     * Looks up the digest of a file
+     * @param key Identity of the file
+     * @param digest Raw digest, set on a hit
+     * @return true on a hit
+     */
+    bool lookup(const Key &key, std::string &digest);
+
+    /**
+     * Records the digest of a file
+     * @param key Identity of the file
+     * @param digest Raw digest of the file content, ignored unless HASH_CACHE_DIGEST_LENGTH bytes
+     */
+    void insert(const Key &key, const std::string &digest);
+
+    /**
+     * Appends the digests recorded since the last flush to the log
+     */
+    void flush();
+
+    /**
+     * Gets the default cache directory, $XDG_CACHE_HOME/multi-pc-sync or ~/.cache/multi-pc-sync
+     * @return Cache directory, empty when neither variable is set
+     */
+    static std::filesystem::path defaultDirectory();
+
+private:
+    struct Record
+    {
+        Key key;
+        uint8_t digest[HASH_CACHE_DIGEST_LENGTH];
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+
+    using Digest = std::array<uint8_t, HASH_CACHE_DIGEST_LENGTH>;
+
+    bool readLog(std::vector<Record> &records) const;
+    void compact(std::vector<Record> &records) const;
+
+    std::filesystem::path mLogPath;
+    std::filesystem::path mLockPath;
+    uint64_t mMaxSizeBytes;
+    bool mEnabled;
+    std::mutex mMutex;
+    std::unordered_map<Key, Digest, KeyHash> mDigests;
+    std::vector<Record> mPending;       ///< Records to append on the next flush
+    std::unordered_set<Key, KeyHash> mUsed;     ///< Keys looked up since loading, kept first at compaction
+};
+
+#endif // __HASH_CACHE_H__
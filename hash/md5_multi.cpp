@@ -0,0 +1,102 @@
+// *****************************************************************************
+// MD5 Multi-Buffer Implementation
+// *****************************************************************************
+
+// Section 1: Includes
+// C++ Standard Library
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+// Project Includes
+#include "md5_multi.h"
+#include "md5_multi_kernel.h"
+#include <md5.h>
+
+// Section 2: Defines and Macros
+// (none)
+
+// Section 3: Kernel Selection
+namespace {
+
+using Kernel = void (*)(const uint8_t *const *data, const size_t *sizes, uint8_t (*digests)[MD5_MULTI_DIGEST_LENGTH]);
+
+struct Dispatch
+{
+    Kernel kernel;      ///< nullptr for the scalar fallback
+    size_t lanes;
+};
+
+Dispatch selectKernel()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx512f") )
+        return { .kernel = md5MultiAvx512, .lanes = 16 };
+    if ( __builtin_cpu_supports("avx2") )
+        return { .kernel = md5MultiAvx2, .lanes = 8 };
+#endif
+    return { .kernel = nullptr, .lanes = 1 };
+}
+
+const Dispatch &dispatch()
+{
+    static const Dispatch selected = selectKernel();
+    return selected;
+}
+
+void scalarDigest(const uint8_t *data, size_t size, uint8_t *digest)
+{
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    MD5Update(&ctx, data, size);
+    MD5Final(digest, &ctx);
+}
+
+} // namespace
+
+// Section 4: MD5MultiBuffer Implementation
+size_t MD5MultiBuffer::lanes()
+{
+    return dispatch().lanes;
+}
+
+void MD5MultiBuffer::digest(const uint8_t *const *data, const size_t *sizes, size_t count, uint8_t *digests)
+{
+    const Dispatch &selected = dispatch();
+    if ( selected.kernel == nullptr || count < 2 )
+    {
+        for ( size_t i = 0; i < count; ++i )
+            scalarDigest(data[i], sizes[i], digests + i * MD5_MULTI_DIGEST_LENGTH);
+        return;
+    }
+
+    // a batch costs as much as its longest buffer, so batch buffers of similar size together
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [sizes](size_t a, size_t b) { return sizes[a] < sizes[b]; });
+
+    const uint8_t *laneData[MD5_MULTI_MAX_LANES];
+    size_t laneSizes[MD5_MULTI_MAX_LANES];
+    uint8_t laneDigests[MD5_MULTI_MAX_LANES][MD5_MULTI_DIGEST_LENGTH];
+    for ( size_t first = 0; first < count; first += selected.lanes )
+    {
+        const size_t used = std::min(selected.lanes, count - first);
+        if ( used == 1 )
+        {
+            scalarDigest(data[order[first]], sizes[order[first]], digests + order[first] * MD5_MULTI_DIGEST_LENGTH);
+            break;
+        }
+
+        // unused lanes hash an empty buffer that is thrown away
+        for ( size_t lane = 0; lane < selected.lanes; ++lane )
+        {
+            laneData[lane] = lane < used ? data[order[first + lane]] : nullptr;
+            laneSizes[lane] = lane < used ? sizes[order[first + lane]] : 0;
+        }
+        selected.kernel(laneData, laneSizes, laneDigests);
+        for ( size_t lane = 0; lane < used; ++lane )
+            memcpy(digests + order[first + lane] * MD5_MULTI_DIGEST_LENGTH, laneDigests[lane], MD5_MULTI_DIGEST_LENGTH);
+    }
+}
@@ -0,0 +1,44 @@
+// *****************************************************************************
+// MD5 Multi-Buffer Header
+// *****************************************************************************
+
+#ifndef __MD5_MULTI_H__
+#define __MD5_MULTI_H__
+
+// Section 1: Includes
+// C++ Standard Library
+#include <cstddef>
+#include <cstdint>
+
+// Section 2: Defines and Macros
+#define MD5_MULTI_MAX_LANES (16)
+
+// Section 3: Class Definition
+/**
+ * MD5 of many independent buffers at once.
+ * Small files spend most of their hashing time in per-file setup and the
+ * scalar compression function, so buffers are hashed 16 (AVX-512) or 8 (AVX2)
+ * at a time, one per vector lane. The kernel is picked from the CPU at run
+ * time and CPUs without either fall back to libmd one buffer at a time.
+ * Digests are bit-identical to MD5Calculator's.
+ */
+class MD5MultiBuffer
+{
+public:
+    /**
+     * Gets how many buffers the selected kernel hashes at once
+     * @return 16, 8, or 1 for the scalar fallback
+     */
+    static size_t lanes();
+
+    /**
+     * Hashes independent buffers
+     * @param data Buffers to hash
+     * @param sizes Size of every buffer in bytes
+     * @param count Number of buffers, any count is accepted
+     * @param digests Receives count * 16 bytes, the MD5 of every buffer in order
+     */
+    static void digest(const uint8_t *const *data, const size_t *sizes, size_t count, uint8_t *digests);
+};
+
+#endif // __MD5_MULTI_H__
@@ -0,0 +1,19 @@
+// *****************************************************************************
+// MD5 Multi-Buffer AVX2 Kernel
+// Built with the AVX2 instruction set enabled, only called after a CPU check.
+// *****************************************************************************
+
+// Section 1: Includes
+// Project Includes
+#include "md5_multi_kernel.h"
+
+// Section 2: Defines and Macros
+// (none)
+
+// Section 3: AVX2 Kernel
+#if defined(__x86_64__)
+void md5MultiAvx2(const uint8_t *const *data, const size_t *sizes, uint8_t (*digests)[MD5_MULTI_DIGEST_LENGTH])
+{
+    md5MultiLanes<Md5Lanes8>(data, sizes, digests);
+}
+#endif
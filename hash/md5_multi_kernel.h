@@ -0,0 +1,165 @@
+// *****************************************************************************
+// MD5 Multi-Buffer Kernel Header
+// Lane-parallel MD5 compression shared by the per-ISA translation units.
+//
+// Everything here has internal linkage on purpose: the including files are
+// compiled with -mavx2 / -mavx512f and nothing they instantiate may be merged
+// with, and then called from, code built for the baseline CPU. For the same
+// reason these files must not pull in the C++ standard library.
+// *****************************************************************************
+
+#ifndef __MD5_MULTI_KERNEL_H__
+#define __MD5_MULTI_KERNEL_H__
+
+// Section 1: Includes
+// C++ Standard Library
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Section 2: Defines and Macros
+#define MD5_MULTI_DIGEST_LENGTH (16)
+#define MD5_MULTI_BLOCK_LENGTH (64)
+
+// Section 3: Entry Points
+/**
+ * Hashes exactly 8 (AVX2) or 16 (AVX-512) independent messages in lockstep
+ * @param data Message of every lane, nullptr allowed for an empty lane
+ * @param sizes Size of every lane's message in bytes
+ * @param digests Receives the MD5 of every lane
+ */
+void md5MultiAvx2(const uint8_t *const *data, const size_t *sizes, uint8_t (*digests)[MD5_MULTI_DIGEST_LENGTH]);
+void md5MultiAvx512(const uint8_t *const *data, const size_t *sizes, uint8_t (*digests)[MD5_MULTI_DIGEST_LENGTH]);
+
+// Section 4: Kernel
+namespace {
+
+constexpr uint32_t MD5_MULTI_K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+constexpr unsigned MD5_MULTI_SHIFT[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+constexpr unsigned MD5_MULTI_WORD[64] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+    5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+    0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9,
+};
+
+typedef uint32_t Md5Lanes8 __attribute__((vector_size(8 * sizeof(uint32_t))));
+typedef uint32_t Md5Lanes16 __attribute__((vector_size(16 * sizeof(uint32_t))));
+
+/**
+ * Runs MD5 over one message per lane of Vector at once.
+ * Lanes whose message is shorter keep their state once their last block is
+ * done, so the batch costs as much as its longest message.
+ */
+template <typename Vector>
+inline void md5MultiLanes(const uint8_t *const *data, const size_t *sizes, uint8_t (*digests)[MD5_MULTI_DIGEST_LENGTH])
+{
+    constexpr size_t LANES = sizeof(Vector) / sizeof(uint32_t);
+
+    // padded last one or two blocks of every lane, MD5 is little endian like every target we build for
+    alignas(64) uint8_t tails[LANES][2 * MD5_MULTI_BLOCK_LENGTH];
+    size_t fullBlocks[LANES];
+    size_t totalBlocks[LANES];
+    size_t maxBlocks = 0;
+    for ( size_t lane = 0; lane < LANES; ++lane )
+    {
+        const size_t size = sizes[lane];
+        const size_t rest = size % MD5_MULTI_BLOCK_LENGTH;
+        const size_t tailBlocks = rest < MD5_MULTI_BLOCK_LENGTH - sizeof(uint64_t) ? 1 : 2;
+        const uint64_t bits = static_cast<uint64_t>(size) * 8;
+
+        memset(tails[lane], 0, sizeof(tails[lane]));
+        if ( rest != 0 )
+            memcpy(tails[lane], data[lane] + size - rest, rest);
+        tails[lane][rest] = 0x80;
+        memcpy(tails[lane] + tailBlocks * MD5_MULTI_BLOCK_LENGTH - sizeof(uint64_t), &bits, sizeof(bits));
+
+        fullBlocks[lane] = size / MD5_MULTI_BLOCK_LENGTH;
+        totalBlocks[lane] = fullBlocks[lane] + tailBlocks;
+        if ( totalBlocks[lane] > maxBlocks )
+            maxBlocks = totalBlocks[lane];
+    }
+
+    Vector a = Vector{} + 0x67452301U;
+    Vector b = Vector{} + 0xefcdab89U;
+    Vector c = Vector{} + 0x98badcfeU;
+    Vector d = Vector{} + 0x10325476U;
+
+    alignas(64) uint32_t words[16][LANES];
+    alignas(64) uint32_t active[LANES];
+    for ( size_t block = 0; block < maxBlocks; ++block )
+    {
+        // transpose the lanes' blocks so word i of every lane sits in one vector
+        for ( size_t lane = 0; lane < LANES; ++lane )
+        {
+            const uint8_t *source = tails[lane];
+            if ( block < fullBlocks[lane] )
+                source = data[lane] + block * MD5_MULTI_BLOCK_LENGTH;
+            else if ( block < totalBlocks[lane] )
+                source = tails[lane] + (block - fullBlocks[lane]) * MD5_MULTI_BLOCK_LENGTH;
+            uint32_t blockWords[16];
+            memcpy(blockWords, source, sizeof(blockWords));
+            for ( size_t word = 0; word < 16; ++word )
+                words[word][lane] = blockWords[word];
+            active[lane] = block < totalBlocks[lane] ? 0xFFFFFFFFU : 0;
+        }
+
+        Vector message[16];
+        for ( size_t word = 0; word < 16; ++word )
+            memcpy(&message[word], words[word], sizeof(Vector));
+        Vector mask;
+        memcpy(&mask, active, sizeof(Vector));
+
+        Vector aa = a, bb = b, cc = c, dd = d;
+#pragma GCC unroll 64
+        for ( unsigned step = 0; step < 64; ++step )
+        {
+            Vector f;
+            if ( step < 16 )
+                f = dd ^ (bb & (cc ^ dd));
+            else if ( step < 32 )
+                f = cc ^ (dd & (bb ^ cc));
+            else if ( step < 48 )
+                f = bb ^ cc ^ dd;
+            else
+                f = cc ^ (bb | ~dd);
+            f += aa + MD5_MULTI_K[step] + message[MD5_MULTI_WORD[step]];
+            aa = dd;
+            dd = cc;
+            cc = bb;
+            bb += (f << MD5_MULTI_SHIFT[step]) | (f >> (32 - MD5_MULTI_SHIFT[step]));
+        }
+
+        // finished lanes keep their final state
+        a += (aa & mask);
+        b += (bb & mask);
+        c += (cc & mask);
+        d += (dd & mask);
+    }
+
+    for ( size_t lane = 0; lane < LANES; ++lane )
+    {
+        const uint32_t state[4] = { a[lane], b[lane], c[lane], d[lane] };
+        memcpy(digests[lane], state, MD5_MULTI_DIGEST_LENGTH);
+    }
+}
+
+} // namespace
+
+#endif // __MD5_MULTI_KERNEL_H__
@@ -4,68 +4,45 @@
 
 // Section 1: Includes
 // C++ Standard Library
+#include <cerrno>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <filesystem>
-#include <fstream>  // IWYU pragma: keep
-#include <system_error>
 #include <string>
 #include <iostream>
 
 // Project Includes
+#include "file_reader.h"
 #include "md5_wrapper.h"
 #include <md5.h>
 
 // Section 2: Defines and Macros
-#define MAX_MD5SUM_BUFFERSIZE (256 * 1024 * 1024)
+// (none)
 
 // Section 3: MD5Calculator Implementation
 MD5Calculator::MD5Calculator(const char *path, bool verbose)
 {
     memset(mDigest.digest_native, 0, MD5_DIGEST_LENGHT_NATIVE*sizeof(uint64_t));
 
-    std::filesystem::path filepath( path );
-    if ( ! std::filesystem::exists(filepath) )
-        return;
-
     if ( verbose )
-        std::cout <<  filepath << "\r\n";
+        std::cout << std::filesystem::path( path ) << "\r\n";
 
-    std::error_code errorCode;
-    uintmax_t filesize = std::filesystem::file_size(filepath, errorCode);
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    const int result = FileReader::read(path, [&ctx](const uint8_t *data, size_t size) {
+        MD5Update(&ctx, data, size);
+    });
 
-    if ( errorCode.value() != 0 )
+    if ( result != 0 )
     {
-        std::cerr << errorCode.message() << "\r\n";
+        // a file deleted since it was listed just keeps an empty digest
+        if ( result != ENOENT )
+            std::cout << "Open file " << path << " for read failed: " << strerror(result) << "\n";
         return;
     }
 
-    std::filebuf filebuf;
-
-    if ( filebuf.open(path, std::ios::binary | std::ios::in) == nullptr )
-    {
-        std::cout << "Open file " << path << " for read failed\n";
-        return;
-    }
-    
-    MD5_CTX ctx;
-    MD5Init(&ctx);
-    auto * buffer = new uint8_t[MAX_MD5SUM_BUFFERSIZE];
-    while ( filesize != 0 )
-    {
-        //read the content into memory in max 256MiB chunks
-        size_t buffersize = std::min<long>(filesize, MAX_MD5SUM_BUFFERSIZE);
-        auto dataread = filebuf.sgetn(reinterpret_cast<char*>(buffer), buffersize);
-        MD5Update(&ctx, buffer, dataread);
-        
-        filesize -= dataread;
-    }
-    delete[] buffer;
-	filebuf.close();
-    
     MD5Final(mDigest.digest_bytes, &ctx);
-
 }
 
 MD5Calculator::MD5Calculator( const std::string &path, bool verbose ) : 
@@ -0,0 +1,221 @@
+// Section 1: Main Header
+#include "hash_pipeline.h"
+
+// Section 2: Includes
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+// Section 3: Defines and Macros
+// (none)
+
+// Section 4: Static Variables
+// (none)
+
+// Section 5: Constructors and Destructors
+HashPipeline::HashPipeline(unsigned workers, HashCache *cache, size_t queueDepth) :
+    mCache( cache ),
+    mQueueDepth( queueDepth == 0 ? 1 : queueDepth ),
+    mInFlight( 0 ),
+    mQuit( false )
+{
+    if ( workers == 0 )
+        workers = 1;
+
+    for ( unsigned i = 0; i < workers; ++i )
+        mThreads.emplace_back(&HashPipeline::workerLoop, this);
+}
+
+HashPipeline::~HashPipeline()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mJobAvailable.notify_all();
+    for ( auto &thread : mThreads )
+        thread.join();
+}
+
+// Section 6: Static Methods
+void HashPipeline::hashInto(const HashJob &job, HashCache *cache)
+{
+    if ( job.chunkSize != 0 )
+    {
+        const auto tree = makeChunkTree(job);
+        for ( size_t i = 0; i < tree->chunks; ++i )
+            hashChunk({ .tree = tree, .index = i });
+        return;
+    }
+
+    // the scanner hands out absolute paths already, symlinks are followed by open()
+    storeDigest(job, FileHasher::hashFile(job.path.string(), job.algorithm, job.verbose), cache);
+}
+
+std::shared_ptr<HashPipeline::ChunkTree> HashPipeline::makeChunkTree(HashJob job)
+{
+    auto tree = std::make_shared<ChunkTree>();
+    tree->chunks = std::max<uint64_t>(1, (job.cacheKey.size + job.chunkSize - 1) / job.chunkSize);
+    tree->digests.resize(tree->chunks * FILE_HASHER_DIGEST_LENGTH);
+    tree->remaining = tree->chunks;
+    tree->error = 0;
+    tree->job = std::move(job);
+    return tree;
+}
+
+void HashPipeline::hashChunk(const ChunkWork &work)
+{
+    ChunkTree &tree = *work.tree;
+    const HashJob &job = tree.job;
+    if ( work.index == 0 && job.verbose )
+        std::cout << job.path << "\r\n";
+
+    // the last chunk reads up to the end of the file, wherever that is by now
+    const int result = FileHasher::hashRange(job.path.string(), work.index * job.chunkSize, job.chunkSize, job.algorithm,
+                                             &tree.digests[work.index * FILE_HASHER_DIGEST_LENGTH]);
+    if ( result != 0 )
+    {
+        int none = 0;
+        tree.error.compare_exchange_strong(none, result);
+    }
+    if ( tree.remaining.fetch_sub(1) != 1 )
+        return;
+
+    // last chunk done, every other chunk's digest is visible through the acq_rel decrement
+    auto *entry = job.entry;
+    entry->set_hashalgorithm(static_cast<com::fileindexer::File::HashAlgorithm>(job.algorithm));
+    entry->clear_chunkhashes();
+    if ( tree.error != 0 )
+    {
+        // same as an unreadable file hashed whole: an empty digest that is hashed again next time
+        if ( tree.error != ENOENT )
+            std::cout << "Open file " << job.path.string() << " for read failed: " << strerror(tree.error) << "\n";
+        entry->set_hash(std::string(FILE_HASHER_DIGEST_LENGTH, '\0'));
+        return;
+    }
+    *entry->mutable_hash() = FileHasher::combineChunks(job.algorithm, tree.digests.data(), tree.chunks);
+    for ( size_t i = 0; i < tree.chunks; ++i )
+        entry->add_chunkhashes(&tree.digests[i * FILE_HASHER_DIGEST_LENGTH], FILE_HASHER_DIGEST_LENGTH);
+}
+
+void HashPipeline::hashBatch(const std::vector<HashJob> &batch, HashCache *cache)
+{
+    std::vector<std::string> paths;
+    paths.reserve(batch.size());
+    for ( const auto &job : batch )
+        paths.push_back(job.path.string());
+
+    // every job of a batch shares the algorithm and the verbosity of the walk
+    const auto digests = FileHasher::hashFiles(paths, batch.front().algorithm, batch.front().verbose);
+    for ( size_t i = 0; i < batch.size(); ++i )
+        storeDigest(batch[i], digests[i], cache);
+}
+
+bool HashPipeline::isSmall(const HashJob &job)
+{
+    return job.cacheKey.size <= FILE_HASHER_SMALL_FILE_BYTES;
+}
+
+void HashPipeline::storeDigest(const HashJob &job, const std::string &digest, HashCache *cache)
+{
+    *job.entry->mutable_hash() = digest;
+    job.entry->set_hashalgorithm(static_cast<com::fileindexer::File::HashAlgorithm>(job.algorithm));
+    // an unreadable file leaves the digest zeroed, that must not be remembered
+    if ( cache != nullptr && digest.find_first_not_of('\0') != std::string::npos )
+        cache->insert(job.cacheKey, digest);
+}
+
+// Section 7: Public/Protected/Private Methods
+void HashPipeline::enqueue(HashJob job)
+{
+    if ( job.chunkSize != 0 )
+    {
+        // one huge file is spread over every worker instead of holding one of them for minutes
+        // its chunks are queued as room frees up, under the same bound as whole files
+        const auto tree = makeChunkTree(std::move(job));
+        for ( size_t i = 0; i < tree->chunks; )
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mChunkSpaceAvailable.wait(lock, [this] { return mChunks.size() < mQueueDepth; });
+                for ( ; i < tree->chunks && mChunks.size() < mQueueDepth; ++i )
+                    mChunks.push_back({ .tree = tree, .index = i });
+            }
+            mJobAvailable.notify_all();
+        }
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mSpaceAvailable.wait(lock, [this] { return mJobs.size() < mQueueDepth; });
+        mJobs.push_back(std::move(job));
+    }
+    mJobAvailable.notify_one();
+}
+
+void HashPipeline::wait()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdle.wait(lock, [this] { return mJobs.empty() && mChunks.empty() && mInFlight == 0; });
+}
+
+void HashPipeline::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while ( true )
+    {
+        mJobAvailable.wait(lock, [this] { return mQuit || !mJobs.empty() || !mChunks.empty(); });
+        if ( !mChunks.empty() )
+        {
+            const ChunkWork work = std::move(mChunks.front());
+            mChunks.pop_front();
+            ++mInFlight;
+            lock.unlock();
+            mChunkSpaceAvailable.notify_one();
+
+            hashChunk(work);
+
+            lock.lock();
+            --mInFlight;
+            if ( mJobs.empty() && mChunks.empty() && mInFlight == 0 )
+                mIdle.notify_all();
+            continue;
+        }
+        if ( mJobs.empty() )
+            return;
+
+        // small files queued back to back, typically from one directory, are hashed together
+        std::vector<HashJob> batch;
+        batch.push_back(std::move(mJobs.front()));
+        mJobs.pop_front();
+        if ( isSmall(batch.front()) )
+        {
+            const size_t batchSize = FileHasher::batchSize(batch.front().algorithm);
+            while ( batch.size() < batchSize && !mJobs.empty() && isSmall(mJobs.front()) &&
+                    mJobs.front().algorithm == batch.front().algorithm )
+            {
+                batch.push_back(std::move(mJobs.front()));
+                mJobs.pop_front();
+            }
+        }
+        mInFlight += batch.size();
+        lock.unlock();
+        if ( batch.size() == 1 )
+            mSpaceAvailable.notify_one();
+        else
+            mSpaceAvailable.notify_all();
+
+        if ( batch.size() == 1 )
+            hashInto(batch.front(), mCache);
+        else
+            hashBatch(batch, mCache);
+
+        lock.lock();
+        mInFlight -= batch.size();
+        if ( mJobs.empty() && mChunks.empty() && mInFlight == 0 )
+            mIdle.notify_all();
+    }
+}
@@ -0,0 +1,125 @@
+// Section 1: Compilation Guards
+#ifndef _HASH_PIPELINE_H_
+#define _HASH_PIPELINE_H_
+
+// Section 2: Includes
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "file.pb.h"
+#include "file_hasher.h"
+#include "hash_cache.h"
+
+// Section 3: Defines and Macros
+constexpr size_t HASH_PIPELINE_QUEUE_DEPTH = 1024;
+
+// Section 4: Classes
+/**
+ * Hashing stage of the indexer.
+ * The directory walk queues the files whose content must be hashed and keeps
+ * scanning, a fixed set of workers drains the queue and writes the digests
+ * back into the index entries. The queue is bounded so a fast walk over a
+ * slow disk does not pile up the whole tree in memory. Runs of small files are
+ * handed to a worker together so multi-buffer hashers can take them at once,
+ * files hashed as a chunk tree are split so every worker can take a chunk.
+ */
+class HashPipeline {
+public:
+    /**
+     * File to hash
+     */
+    struct HashJob {
+        std::filesystem::path path;         ///< Path of the file to hash
+        com::fileindexer::File *entry;      ///< Index entry receiving the digest
+        HashCache::Key cacheKey;            ///< Identity the digest is cached under
+        FileHasher::Algorithm algorithm;    ///< Algorithm to hash with
+        uint64_t chunkSize;                 ///< 0 hashes the whole file, otherwise hashes it as a chunk tree of this chunk size
+        bool verbose;                       ///< Whether to print the file being hashed
+    };
+
+    /**
+     * Starts the hash workers
+     * @param workers Number of files hashed concurrently
+     * @param cache Cache receiving the computed digests, nullptr for none
+     * @param queueDepth Number of queued files, and apart from them of queued chunks, after which enqueue blocks
+     */
+    HashPipeline(unsigned workers, HashCache *cache, size_t queueDepth = HASH_PIPELINE_QUEUE_DEPTH);
+
+    /**
+     * Finishes the queued files and joins the workers
+     */
+    ~HashPipeline();
+
+    HashPipeline(const HashPipeline&) = delete;
+    HashPipeline& operator=(const HashPipeline&) = delete;
+
+    /**
+     * Queues a file to hash, blocks while the queue is full, or for a chunk tree while its chunks do not fit
+     * @param job File to hash, its entry must stay valid until wait() returns
+     */
+    void enqueue(HashJob job);
+
+    /**
+     * Blocks until every queued file has been hashed
+     */
+    void wait();
+
+    /**
+     * Gets the number of hash workers
+     * @return Worker count
+     */
+    [[nodiscard]] unsigned size() const { return static_cast<unsigned>(mThreads.size()); }
+
+    /**
+     * Hashes a file and stores the digest in its index entry
+     * @param job File to hash
+     * @param cache Cache receiving the digest, nullptr for none
+     */
+    static void hashInto(const HashJob &job, HashCache *cache);
+
+private:
+    /**
+     * Chunk tree digest being computed, shared by its chunks
+     */
+    struct ChunkTree {
+        HashJob job;
+        size_t chunks;
+        std::vector<uint8_t> digests;       ///< FILE_HASHER_DIGEST_LENGTH bytes per chunk
+        std::atomic<size_t> remaining;      ///< Chunks not hashed yet, the last one combines the tree
+        std::atomic<int> error;             ///< First errno of a chunk read, 0 if none
+    };
+    struct ChunkWork {
+        std::shared_ptr<ChunkTree> tree;
+        size_t index;
+    };
+
+    void workerLoop();
+    static std::shared_ptr<ChunkTree> makeChunkTree(HashJob job);
+    static void hashChunk(const ChunkWork &work);
+    static void hashBatch(const std::vector<HashJob> &batch, HashCache *cache);
+    static bool isSmall(const HashJob &job);
+    static void storeDigest(const HashJob &job, const std::string &digest, HashCache *cache);
+
+    HashCache *mCache;
+    std::deque<HashJob> mJobs;
+    std::deque<ChunkWork> mChunks;  ///< Chunks of the files being hashed as chunk trees, served before mJobs
+    size_t mQueueDepth;
+    size_t mInFlight;       ///< Jobs popped by a worker and not yet written back
+    bool mQuit;
+    std::mutex mMutex;
+    std::condition_variable mJobAvailable;
+    std::condition_variable mSpaceAvailable;
+    std::condition_variable mChunkSpaceAvailable;
+    std::condition_variable mIdle;
+    std::vector<std::thread> mThreads;
+};
+
+#endif // _HASH_PIPELINE_H_
@@ -0,0 +1,700 @@
+// Section 1: Main Header
+#include "index_log.h"
+
+// Section 2: Includes
+#include <climits>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/wire_format.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include "flat_index.h"
+
+// Section 3: Defines and Macros
+constexpr const char *INDEX_LOG_SUFFIX = ".log";
+constexpr const char *INDEX_LOG_TMP_SUFFIX = ".tmp";            // snapshot written by the indexer
+constexpr const char *INDEX_LOG_COMPACT_SUFFIX = ".compact";    // snapshot or log written by a compaction
+constexpr size_t INDEX_LOG_FRAME_BYTES = 4;
+constexpr int INDEX_LOG_MAX_NESTING = 8192;     // a Folder and its File per directory level, deeper than PATH_MAX allows
+
+// Section 4: Static Variables
+namespace {
+
+std::mutex indexFilesMutex;     // renames, appends and log rewrites of every index file in the process
+std::mutex compactionMutex;     // one compaction at a time, they share their temporary names
+
+} // namespace
+
+// Section 5: Helpers
+namespace {
+
+using google::protobuf::internal::WireFormat;
+using google::protobuf::internal::WireFormatLite;
+
+bool readFile(const std::filesystem::path &path, std::string &content)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if ( !file )
+        return false;
+    file.seekg(0, std::ios::end);
+    content.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    return static_cast<bool>(file.read(content.data(), static_cast<std::streamsize>(content.size())));
+}
+
+bool parseSnapshot(std::istream &snapshotFile, com::fileindexer::Folder &index)
+{
+    // the default recursion limit of 100 rejects any tree deeper than about 100 directories
+    google::protobuf::io::IstreamInputStream rawInput(&snapshotFile);
+    google::protobuf::io::CodedInputStream input(&rawInput);
+    input.SetRecursionLimit(INDEX_LOG_MAX_NESTING);
+    return index.ParseFromCodedStream(&input) && input.ConsumedEntireMessage();
+}
+
+bool writeAll(int fd, const std::string &content)
+{
+    size_t written = 0;
+    while ( written < content.size() )
+    {
+        const ssize_t result = write(fd, content.data() + written, content.size() - written);
+        if ( result < 0 && errno == EINTR )
+            continue;
+        if ( result <= 0 )
+            return false;
+        written += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+bool writeFile(const std::filesystem::path &path, const std::string &content, bool durable)
+{
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ( fd < 0 )
+        return false;
+    const bool written = writeAll(fd, content) && ( !durable || fdatasync(fd) == 0 );
+    return close(fd) == 0 && written;
+}
+
+/**
+ * Gets the name an entry is stored under
+ * @param path Full path of the entry
+ * @param parent Full path of the folder holding it
+ * @return Path relative to the folder, the full path for an entry not below it, a view of path
+ */
+std::string_view relativeName(const std::string &path, const std::string &parent)
+{
+    const size_t prefix = parent.ends_with('/') ? parent.size() : parent.size() + 1;
+    if ( path.size() > prefix && path[prefix - 1] == '/' && path.starts_with(parent) )
+        return std::string_view(path).substr(prefix);
+    return path;
+}
+
+/**
+ * Turns the name an entry is stored under into its full path
+ * @param parent Full path of the folder holding it
+ * @param name Stored name, a full path in indexes of an older format, replaced by the full path
+ */
+void toEntryPath(const std::string &parent, std::string &name)
+{
+    if ( name.starts_with('/') )
+        return;
+    // built at its final size, a whole index of names is rebuilt on load
+    std::string path;
+    path.reserve(parent.size() + 1 + name.size());
+    path += parent;
+    if ( !parent.ends_with('/') )
+        path += '/';
+    path += name;
+    name.swap(path);
+}
+
+/**
+ * Parses a time in the text form of formats before INDEX_FORMAT_TIME_NS, UTC
+ * Example input: "2025-07-14_12:48.08.212691030"
+ * @return false if it is malformed
+ */
+bool parseTextTime(const std::string &text, int64_t &timeNs)
+{
+    int year = 0;
+    int month = 0;
+    int day = 0;
+    int hour = 0;
+    int min = 0;
+    int sec = 0;
+    long nsec = 0;
+    if ( sscanf(text.c_str(), "%d-%d-%d_%d:%d.%d.%ld", &year, &month, &day, &hour, &min, &sec, &nsec) != 7 )
+        return false;
+    struct tm time = {};
+    time.tm_year = year - 1900;
+    time.tm_mon = month - 1;
+    time.tm_mday = day;
+    time.tm_hour = hour;
+    time.tm_min = min;
+    time.tm_sec = sec;
+    timeNs = static_cast<int64_t>(timegm(&time)) * 1000000000LL + nsec;
+    return true;
+}
+
+template <typename Entry>
+void loadTimes(Entry &entry)
+{
+    int64_t timeNs = 0;
+    if ( entry.has_modifiedtime() && parseTextTime(entry.modifiedtime(), timeNs) )
+        entry.set_modifiedtimens(timeNs);
+    if ( entry.has_changetime() && parseTextTime(entry.changetime(), timeNs) )
+        entry.set_changetimens(timeNs);
+    entry.clear_modifiedtime();
+    entry.clear_changetime();
+}
+
+/**
+ * Decodes a digest in the hex form of formats before INDEX_FORMAT_RAW_DIGESTS, in place
+ * @return false if it is malformed
+ */
+bool parseTextDigest(std::string &digest)
+{
+    // MD5 digests were printed as two words, the second one without its leading zeros
+    constexpr size_t WORD_DIGITS = 16;
+    if ( digest.size() > WORD_DIGITS && digest.size() < 2 * WORD_DIGITS )
+        digest.insert(WORD_DIGITS, 2 * WORD_DIGITS - digest.size(), '0');
+    if ( digest.size() != 2 * WORD_DIGITS )
+        return false;
+    std::string raw(WORD_DIGITS, '\0');
+    for ( size_t i = 0; i < raw.size(); ++i )
+    {
+        int byte = 0;
+        for ( const char digit : { digest[2 * i], digest[2 * i + 1] } )
+        {
+            const int value = digit >= '0' && digit <= '9' ? digit - '0' :
+                              digit >= 'a' && digit <= 'f' ? digit - 'a' + 10 : -1;
+            if ( value < 0 )
+                return false;
+            byte = byte << 4 | value;
+        }
+        raw[i] = static_cast<char>(byte);
+    }
+    digest.swap(raw);
+    return true;
+}
+
+template <typename Entry>
+void loadOwnFields(const std::string *parent, Entry &entry, uint32_t formatVersion)
+{
+    if ( parent != nullptr && formatVersion >= INDEX_FORMAT_RELATIVE_NAMES && entry.has_name() )
+        toEntryPath(*parent, *entry.mutable_name());
+    if ( formatVersion < INDEX_FORMAT_TIME_NS )
+        loadTimes(entry);
+}
+
+/**
+ * Turns the entries below a folder as stored into their form in memory
+ */
+void loadEntries(com::fileindexer::Folder &folder, uint32_t formatVersion)
+{
+    for ( auto &file : *folder.mutable_files() )
+        IndexLog::loadEntry(&folder.name(), file, formatVersion);
+    for ( auto &subfolder : *folder.mutable_folders() )
+    {
+        IndexLog::loadEntry(&folder.name(), subfolder, formatVersion);
+        loadEntries(subfolder, formatVersion);
+    }
+}
+
+/**
+ * Serializes an index tree as it is stored, the entries below the root named relative to their
+ * parent. The tree is only read: each entry is written field by field, its stored name in place
+ * of its full path, after a first pass has measured every folder as stored.
+ */
+class StoredTreeWriter {
+public:
+    explicit StoredTreeWriter(const com::fileindexer::Folder &index) : mIndex(index) { mSize = measureFolder(index, nullptr); }
+    StoredTreeWriter(const StoredTreeWriter &) = delete;
+    StoredTreeWriter &operator=(const StoredTreeWriter &) = delete;
+
+    bool write(int fd)
+    {
+        // as SerializeToFileDescriptor(), a message is at most 2 GiB
+        if ( mSize > static_cast<size_t>(INT_MAX) )
+            return false;
+        google::protobuf::io::FileOutputStream rawOutput(fd);
+        bool written = false;
+        {
+            google::protobuf::io::CodedOutputStream output(&rawOutput);
+            mNext = 1;
+            writeFolder(mIndex, nullptr, output);
+            written = !output.HadError();
+        }
+        return rawOutput.Flush() && written;
+    }
+
+private:
+    static std::string_view storedName(const std::string &name, const std::string *parent)
+    {
+        return parent != nullptr ? relativeName(name, *parent) : std::string_view(name);
+    }
+
+    static size_t nameFieldSize(size_t nameSize)
+    {
+        return WireFormatLite::TagSize(com::fileindexer::File::kNameFieldNumber, WireFormatLite::TYPE_STRING) +
+               WireFormatLite::LengthDelimitedSize(nameSize);
+    }
+
+    static size_t entryFieldSize(int fieldNumber, size_t entrySize)
+    {
+        return WireFormatLite::TagSize(fieldNumber, WireFormatLite::TYPE_MESSAGE) + WireFormatLite::LengthDelimitedSize(entrySize);
+    }
+
+    static void writeLengthDelimited(int fieldNumber, size_t size, google::protobuf::io::CodedOutputStream &output)
+    {
+        WireFormatLite::WriteTag(fieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, &output);
+        output.WriteVarint32(static_cast<uint32_t>(size));
+    }
+
+    // the own fields of a folder, all but its subfolders and files
+    static bool isOwnField(const google::protobuf::FieldDescriptor *field)
+    {
+        return field->number() != com::fileindexer::Folder::kFoldersFieldNumber &&
+               field->number() != com::fileindexer::Folder::kFilesFieldNumber;
+    }
+
+    size_t measureFile(const com::fileindexer::File &file, const std::string &parent) const
+    {
+        const size_t size = file.ByteSizeLong();
+        if ( !file.has_name() )
+            return size;
+        return size - nameFieldSize(file.name().size()) + nameFieldSize(relativeName(file.name(), parent).size());
+    }
+
+    // in the order writeFolder() visits the folders: its own fields, its files, then its subfolders
+    size_t measureFolder(const com::fileindexer::Folder &folder, const std::string *parent)
+    {
+        const size_t slot = mFolderSizes.size();
+        mFolderSizes.push_back(0);
+        size_t size = 0;
+        mFields.clear();
+        folder.GetReflection()->ListFields(folder, &mFields);
+        for ( const auto *field : mFields )
+        {
+            if ( field->number() == com::fileindexer::Folder::kNameFieldNumber )
+                size += nameFieldSize(storedName(folder.name(), parent).size());
+            else if ( isOwnField(field) )
+                size += WireFormat::FieldByteSize(field, folder);
+        }
+        for ( const auto &file : folder.files() )
+            size += entryFieldSize(com::fileindexer::Folder::kFilesFieldNumber, measureFile(file, folder.name()));
+        for ( const auto &subfolder : folder.folders() )
+            size += entryFieldSize(com::fileindexer::Folder::kFoldersFieldNumber, measureFolder(subfolder, &folder.name()));
+        mFolderSizes[slot] = size;
+        return size;
+    }
+
+    void writeFolder(const com::fileindexer::Folder &folder, const std::string *parent, google::protobuf::io::CodedOutputStream &output)
+    {
+        mFields.clear();
+        folder.GetReflection()->ListFields(folder, &mFields);
+        for ( const auto *field : mFields )
+        {
+            if ( field->number() == com::fileindexer::Folder::kNameFieldNumber )
+            {
+                const std::string_view name = storedName(folder.name(), parent);
+                writeLengthDelimited(field->number(), name.size(), output);
+                output.WriteRaw(name.data(), static_cast<int>(name.size()));
+            }
+            else if ( isOwnField(field) )
+                WireFormat::SerializeFieldWithCachedSizes(field, folder, &output);
+        }
+        for ( const auto &file : folder.files() )
+        {
+            // copied into a message kept across files, whose strings keep their capacity
+            mFile = file;
+            if ( file.has_name() )
+            {
+                const std::string_view name = relativeName(file.name(), folder.name());
+                mFile.mutable_name()->assign(name.data(), name.size());
+            }
+            writeLengthDelimited(com::fileindexer::Folder::kFilesFieldNumber, mFile.ByteSizeLong(), output);
+            mFile.SerializeWithCachedSizes(&output);
+        }
+        for ( const auto &subfolder : folder.folders() )
+        {
+            writeLengthDelimited(com::fileindexer::Folder::kFoldersFieldNumber, mFolderSizes[mNext++], output);
+            writeFolder(subfolder, &folder.name(), output);
+        }
+    }
+
+    const com::fileindexer::Folder &mIndex;
+    size_t mSize = 0;
+    std::vector<size_t> mFolderSizes;   ///< Stored size of every folder, in the order they are written
+    size_t mNext = 0;                   ///< Next subfolder to write, in mFolderSizes
+    std::vector<const google::protobuf::FieldDescriptor *> mFields;
+    com::fileindexer::File mFile;       ///< Stored form of the file being written
+};
+
+bool writeMessage(const std::filesystem::path &path, com::fileindexer::Folder &index, bool durable)
+{
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ( fd < 0 )
+        return false;
+    index.set_formatversion(INDEX_FORMAT_VERSION);
+    StoredTreeWriter writer(index);
+    const bool written = writer.write(fd) && ( !durable || fdatasync(fd) == 0 );
+    return close(fd) == 0 && written;
+}
+
+void appendFrame(std::string &records, std::string_view record)
+{
+    const auto size = static_cast<uint32_t>(record.size());
+    for ( size_t i = 0; i < INDEX_LOG_FRAME_BYTES; ++i )
+        records += static_cast<char>( ( size >> ( 8 * i ) ) & 0xFF );
+    records += record;
+}
+
+/**
+ * Gets the next record of a log
+ * @return false at the end of the log or at a record cut short
+ */
+bool nextFrame(const std::string &log, size_t &offset, std::string_view &record)
+{
+    if ( log.size() - offset < INDEX_LOG_FRAME_BYTES )
+        return false;
+    uint32_t size = 0;
+    for ( size_t i = 0; i < INDEX_LOG_FRAME_BYTES; ++i )
+        size |= static_cast<uint32_t>(static_cast<unsigned char>(log[offset + i])) << ( 8 * i );
+    if ( log.size() - offset - INDEX_LOG_FRAME_BYTES < size )
+        return false;
+    record = std::string_view(log).substr(offset + INDEX_LOG_FRAME_BYTES, size);
+    offset += INDEX_LOG_FRAME_BYTES + size;
+    return true;
+}
+
+/**
+ * Copies a folder's own fields, and its files if asked, but not its subfolders.
+ * The content is set aside during the copy rather than copied and dropped.
+ */
+void copyFolderEntry(com::fileindexer::Folder &from, com::fileindexer::Folder &to, bool withFiles)
+{
+    // on the arena of the folder, a swap across arenas would copy
+    google::protobuf::RepeatedPtrField<com::fileindexer::Folder> subfolders(from.GetArena());
+    google::protobuf::RepeatedPtrField<com::fileindexer::File> files(from.GetArena());
+    subfolders.Swap(from.mutable_folders());
+    if ( !withFiles )
+        files.Swap(from.mutable_files());
+    to = from;
+    subfolders.Swap(from.mutable_folders());
+    if ( !withFiles )
+        files.Swap(from.mutable_files());
+}
+
+bool isBelow(const std::string &path, const std::string &folder)
+{
+    return path.size() > folder.size() && path[folder.size()] == '/' && path.starts_with(folder);
+}
+
+bool sameFile(const struct stat &a, const struct stat &b)
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+} // namespace
+
+// Section 6: Static Methods
+std::filesystem::path IndexLog::logPath(const std::filesystem::path &indexPath)
+{
+    return indexPath.string() + INDEX_LOG_SUFFIX;
+}
+
+std::string IndexLog::indexName(const std::string &name)
+{
+    std::string index = name;
+    for ( const std::string_view suffix : { INDEX_LOG_COMPACT_SUFFIX, INDEX_LOG_TMP_SUFFIX, FLAT_INDEX_SUFFIX, INDEX_LOG_SUFFIX } )
+    {
+        if ( index.ends_with(suffix) )
+            index.resize(index.size() - suffix.size());
+    }
+    return index;
+}
+
+void IndexLog::loadEntry(const std::string *parent, com::fileindexer::File &entry, uint32_t formatVersion)
+{
+    loadOwnFields(parent, entry, formatVersion);
+    // a digest that does not decode is dropped, the file is hashed again once it changes
+    if ( formatVersion < INDEX_FORMAT_RAW_DIGESTS && entry.has_hash() && !parseTextDigest(*entry.mutable_hash()) )
+        entry.clear_hash();
+}
+
+void IndexLog::loadEntry(const std::string *parent, com::fileindexer::Folder &entry, uint32_t formatVersion)
+{
+    loadOwnFields(parent, entry, formatVersion);
+}
+
+bool IndexLog::load(const std::filesystem::path &indexPath, com::fileindexer::Folder &index)
+{
+    {
+        std::ifstream snapshotFile(indexPath, std::ios::in | std::ios::binary);
+        if ( !snapshotFile || !parseSnapshot(snapshotFile, index) )
+            return false;
+    }
+    // written by a newer version, the next walk builds it again
+    const uint32_t formatVersion = index.formatversion();
+    if ( formatVersion > INDEX_FORMAT_VERSION )
+        return false;
+    loadEntry(nullptr, index, formatVersion);
+    loadEntries(index, formatVersion);
+
+    std::string log;
+    uint64_t sequence = index.logsequence();
+    if ( readFile(logPath(indexPath), log) )
+    {
+        // records are swapped into the index, so they are parsed on its arena
+        com::fileindexer::Folder heapRecord;
+        com::fileindexer::Folder &record = index.GetArena() == nullptr ? heapRecord :
+            *google::protobuf::Arena::CreateMessage<com::fileindexer::Folder>(index.GetArena());
+        size_t offset = 0;
+        std::string_view frame;
+        while ( nextFrame(log, offset, frame) )
+        {
+            if ( !record.ParseFromArray(frame.data(), static_cast<int>(frame.size())) )
+                return false;
+            if ( record.logsequence() <= sequence )
+                continue;   // already in the snapshot, the compaction that wrote it was cut short
+            if ( record.formatversion() > INDEX_FORMAT_VERSION )
+                return false;
+            loadEntry(nullptr, record, record.formatversion());
+            loadEntries(record, record.formatversion());
+            record.clear_formatversion();
+            if ( record.logsequence() != sequence + 1 || !applyRecord(index, record) )
+                return false;
+            ++sequence;
+        }
+    }
+    index.set_logsequence(sequence);
+    // a record of the root replaced its fields, the format is still the snapshot's
+    if ( formatVersion != 0 )
+        index.set_formatversion(formatVersion);
+    else
+        index.clear_formatversion();
+    return true;
+}
+
+bool IndexLog::applyRecord(com::fileindexer::Folder &index, com::fileindexer::Folder &record)
+{
+    com::fileindexer::Folder *target = &index;
+    while ( target->name() != record.name() )
+    {
+        com::fileindexer::Folder *below = nullptr;
+        for ( auto &folder : *target->mutable_folders() )
+        {
+            if ( record.name() == folder.name() || isBelow(record.name(), folder.name()) )
+            {
+                below = &folder;
+                break;
+            }
+        }
+        if ( below == nullptr )
+            return false;
+        target = below;
+    }
+
+    // the record lists the subfolders, the ones already known keep their content
+    std::unordered_map<std::string, com::fileindexer::Folder *> known;
+    known.reserve(target->folders_size());
+    for ( auto &folder : *target->mutable_folders() )
+        known.emplace(folder.name(), &folder);
+    for ( auto &folder : *record.mutable_folders() )
+    {
+        const auto entry = known.find(folder.name());
+        if ( entry == known.end() )
+            continue;
+        folder.mutable_folders()->Swap(entry->second->mutable_folders());
+        folder.mutable_files()->Swap(entry->second->mutable_files());
+        known.erase(entry);
+    }
+    target->Swap(&record);
+    if ( target != &index )
+        target->clear_logsequence();
+    return true;
+}
+
+void IndexLog::appendRecord(std::string &records, com::fileindexer::Folder &folder, uint64_t sequence)
+{
+    com::fileindexer::Folder record;
+    copyFolderEntry(folder, record, true);
+    for ( auto &subfolder : *folder.mutable_folders() )
+        copyFolderEntry(subfolder, *record.add_folders(), false);
+    // the record keeps its full path, it is all applyRecord() needs to find its folder
+    for ( auto &file : *record.mutable_files() )
+    {
+        if ( file.has_name() )
+            file.set_name(std::string(relativeName(file.name(), record.name())));
+    }
+    for ( auto &subfolder : *record.mutable_folders() )
+    {
+        if ( subfolder.has_name() )
+            subfolder.set_name(std::string(relativeName(subfolder.name(), record.name())));
+    }
+    record.set_formatversion(INDEX_FORMAT_VERSION);
+    record.set_logsequence(sequence);
+    appendFrame(records, record.SerializeAsString());
+}
+
+int IndexLog::append(const std::filesystem::path &indexPath, const std::string &records)
+{
+    std::lock_guard<std::mutex> lock(indexFilesMutex);
+    const int fd = open(logPath(indexPath).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if ( fd < 0 )
+        return -1;
+    struct stat before {};
+    bool written = fstat(fd, &before) == 0 && writeAll(fd, records);
+    // a record cut short in the middle of the log would hide every record after it
+    if ( !written )
+        (void)ftruncate(fd, before.st_size);
+    if ( close(fd) != 0 )
+        written = false;
+    return written ? 0 : -1;
+}
+
+int IndexLog::writeSnapshot(const std::filesystem::path &indexPath, com::fileindexer::Folder &index)
+{
+    const std::filesystem::path tmpPath = indexPath.string() + INDEX_LOG_TMP_SUFFIX;
+    if ( !writeMessage(tmpPath, index, false) )
+        return -1;
+
+    // removed then renamed: renaming over it makes ext4 flush the new snapshot first, and
+    // a crash in between leaves no index, which the next walk builds again
+    std::lock_guard<std::mutex> lock(indexFilesMutex);
+    std::error_code errorCode;
+    std::filesystem::remove(indexPath, errorCode);
+    std::filesystem::rename(tmpPath, indexPath, errorCode);
+    if ( errorCode )
+        return -1;
+    std::filesystem::remove(logPath(indexPath), errorCode);
+    return 0;
+}
+
+bool IndexLog::hasLog(const std::filesystem::path &indexPath)
+{
+    struct stat logStat {};
+    return stat(logPath(indexPath).c_str(), &logStat) == 0 && logStat.st_size > 0;
+}
+
+bool IndexLog::needsCompaction(const std::filesystem::path &indexPath)
+{
+    struct stat snapshotStat {};
+    struct stat logStat {};
+    if ( stat(indexPath.c_str(), &snapshotStat) != 0 || stat(logPath(indexPath).c_str(), &logStat) != 0 )
+        return false;
+    const auto logBytes = static_cast<uint64_t>(logStat.st_size);
+    return logBytes >= INDEX_LOG_COMPACT_MIN_BYTES &&
+           logBytes * INDEX_LOG_COMPACT_DIVISOR > static_cast<uint64_t>(snapshotStat.st_size);
+}
+
+int IndexLog::compact(const std::filesystem::path &indexPath)
+{
+    std::lock_guard<std::mutex> compactionLock(compactionMutex);
+    struct stat snapshotStat {};
+    if ( stat(indexPath.c_str(), &snapshotStat) != 0 )
+        return -1;
+    if ( !hasLog(indexPath) )
+        return 0;
+
+    // the snapshot only changes by rename, the log only grows: both can be read without the lock
+    com::fileindexer::Folder index;
+    if ( !load(indexPath, index) )
+        return -1;
+    const std::filesystem::path tmpPath = indexPath.string() + INDEX_LOG_COMPACT_SUFFIX;
+    if ( !writeMessage(tmpPath, index, true) )
+        return -1;
+
+    std::lock_guard<std::mutex> lock(indexFilesMutex);
+    std::error_code errorCode;
+    struct stat currentStat {};
+    if ( stat(indexPath.c_str(), &currentStat) != 0 || !sameFile(snapshotStat, currentStat) )
+    {
+        // replaced meanwhile by a newer snapshot, this one is already outdated
+        std::filesystem::remove(tmpPath, errorCode);
+        return 0;
+    }
+    std::filesystem::rename(tmpPath, indexPath, errorCode);
+    if ( errorCode )
+        return -1;
+
+    // keep the records appended since the log was read
+    std::string log;
+    std::string kept;
+    if ( readFile(logPath(indexPath), log) )
+    {
+        size_t offset = 0;
+        std::string_view frame;
+        com::fileindexer::Folder record;
+        while ( nextFrame(log, offset, frame) )
+        {
+            if ( record.ParseFromArray(frame.data(), static_cast<int>(frame.size())) &&
+                 record.logsequence() > index.logsequence() )
+                appendFrame(kept, frame);
+        }
+    }
+    if ( kept.empty() )
+    {
+        std::filesystem::remove(logPath(indexPath), errorCode);
+        return 0;
+    }
+    const std::filesystem::path tmpLogPath = logPath(indexPath).string() + INDEX_LOG_COMPACT_SUFFIX;
+    if ( !writeFile(tmpLogPath, kept, true) )
+        return -1;
+    std::filesystem::rename(tmpLogPath, logPath(indexPath), errorCode);
+    return errorCode ? -1 : 0;
+}
+
+void IndexLog::rotate(const std::filesystem::path &indexPath, const std::filesystem::path &rotatedPath)
+{
+    std::lock_guard<std::mutex> lock(indexFilesMutex);
+    std::error_code errorCode;
+    std::filesystem::remove(rotatedPath, errorCode);
+    std::filesystem::remove(logPath(rotatedPath), errorCode);
+    std::filesystem::remove(FlatIndex::flatPath(rotatedPath), errorCode);
+    std::filesystem::rename(indexPath, rotatedPath, errorCode);
+    if ( errorCode )
+        return;
+    std::filesystem::rename(logPath(indexPath), logPath(rotatedPath), errorCode);
+    // renamed files keep their identity, the flat cache stays valid for the rotated index
+    std::filesystem::rename(FlatIndex::flatPath(indexPath), FlatIndex::flatPath(rotatedPath), errorCode);
+
+    // snapshots are never written in place, the link stays what was rotated until replaced
+    std::filesystem::create_hard_link(rotatedPath, indexPath, errorCode);
+    if ( errorCode )
+        return;     // no link on this filesystem, the index is built again
+    if ( std::filesystem::exists(logPath(rotatedPath)) &&
+         !std::filesystem::copy_file(logPath(rotatedPath), logPath(indexPath), errorCode) )
+        std::filesystem::remove(indexPath, errorCode);
+}
+
+bool IndexLog::duplicate(const std::filesystem::path &indexPath, const std::filesystem::path &copyPath)
+{
+    std::lock_guard<std::mutex> lock(indexFilesMutex);
+    std::error_code errorCode;
+    std::filesystem::remove(copyPath, errorCode);
+    std::filesystem::remove(logPath(copyPath), errorCode);
+    std::filesystem::create_hard_link(indexPath, copyPath, errorCode);
+    if ( errorCode )
+        return false;
+    if ( std::filesystem::exists(logPath(indexPath)) &&
+         !std::filesystem::copy_file(logPath(indexPath), logPath(copyPath), errorCode) )
+    {
+        std::filesystem::remove(copyPath, errorCode);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,142 @@
+// Section 1: Compilation Guards
+#ifndef _INDEX_LOG_H_
+#define _INDEX_LOG_H_
+
+// Section 2: Includes
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "folder.pb.h"
+
+// Section 3: Defines and Macros
+constexpr uint64_t INDEX_LOG_COMPACT_DIVISOR = 4;           // compact once the log outgrows a quarter of the snapshot
+constexpr uint64_t INDEX_LOG_COMPACT_MIN_BYTES = 1ULL << 20; // and is worth the rewrite
+constexpr uint32_t INDEX_FORMAT_RELATIVE_NAMES = 2;         // names stored relative to their parent folder
+constexpr uint32_t INDEX_FORMAT_TIME_NS = 3;                // times stored as nanoseconds rather than text
+constexpr uint32_t INDEX_FORMAT_RAW_DIGESTS = 4;            // file digests stored raw rather than as hex
+constexpr uint32_t INDEX_FORMAT_VERSION = INDEX_FORMAT_RAW_DIGESTS;
+
+// Section 4: Classes
+/**
+ * Storage of an index file as a snapshot plus an append-only log.
+ * The snapshot is the serialized Folder tree, never modified in place: it is
+ * only ever replaced by a new file, so it can be hard linked (.last_run).
+ * Changes are appended to <index>.log as records, each a Folder holding one
+ * directory's own fields, its files and its subfolders without their content,
+ * numbered by logSequence. Loading replays the records numbered past the
+ * snapshot's logSequence. Compaction writes the replayed tree as the new
+ * snapshot and drops the records it includes.
+ *
+ * Records are framed by their size as 4 bytes little endian. A record cut
+ * short by a crash ends the log, the save it belonged to never completed.
+ *
+ * In memory every entry is named by its full path. On disk, from the format of
+ * INDEX_FORMAT_RELATIVE_NAMES, only the root and each record keep the full path, the
+ * entries below them are named relative to their parent. Snapshots and records
+ * without a formatVersion hold full paths and load as they are. Times are held in
+ * nanoseconds and digests raw; the text times of formats before INDEX_FORMAT_TIME_NS
+ * and the hex digests of formats before INDEX_FORMAT_RAW_DIGESTS are converted on load.
+ */
+class IndexLog {
+public:
+    /**
+     * Gets the log of an index file
+     * @param indexPath Index snapshot
+     * @return Path of its log
+     */
+    static std::filesystem::path logPath(const std::filesystem::path &indexPath);
+
+    /**
+     * Gets the index file a log or temporary file belongs to
+     * @param name Entry name
+     * @return Name of the index file, the name itself for anything else
+     */
+    static std::string indexName(const std::string &name);
+
+    /**
+     * Turns the own fields of an entry as stored into their form in memory: its full path
+     * as name, its times in nanoseconds and its digest raw
+     * @param parent Full path of the folder holding it, nullptr for the root
+     * @param entry Entry as parsed, its subfolders and files left as they are
+     * @param formatVersion formatVersion of the snapshot or record it was stored in
+     */
+    static void loadEntry(const std::string *parent, com::fileindexer::File &entry, uint32_t formatVersion);
+    static void loadEntry(const std::string *parent, com::fileindexer::Folder &entry, uint32_t formatVersion);
+
+    /**
+     * Loads an index snapshot and replays its log
+     * @param indexPath Index snapshot
+     * @param index Loaded tree, its logSequence set to the last record applied and its
+     *              formatVersion the one of the snapshot
+     * @return false if the snapshot is missing or unreadable or the log does not apply to it
+     */
+    static bool load(const std::filesystem::path &indexPath, com::fileindexer::Folder &index);
+
+    /**
+     * Serializes the record of a folder
+     * @param records Buffer the framed record is appended to
+     * @param folder Folder whose own fields, files and subfolder entries to record, left as it was
+     * @param sequence Record number
+     */
+    static void appendRecord(std::string &records, com::fileindexer::Folder &folder, uint64_t sequence);
+
+    /**
+     * Appends records to the log of an index file
+     * @param indexPath Index snapshot
+     * @param records Framed records from appendRecord()
+     * @return 0 on success, negative on error
+     */
+    static int append(const std::filesystem::path &indexPath, const std::string &records);
+
+    /**
+     * Replaces the snapshot of an index file and drops its log
+     * @param indexPath Index snapshot
+     * @param index Tree to write, its logSequence being the last record it includes, left as it
+     *              was but for its formatVersion set to the one written
+     * @return 0 on success, negative on error
+     */
+    static int writeSnapshot(const std::filesystem::path &indexPath, com::fileindexer::Folder &index);
+
+    /**
+     * Checks whether an index file has records not in its snapshot
+     * @param indexPath Index snapshot
+     * @return true if its log is not empty
+     */
+    static bool hasLog(const std::filesystem::path &indexPath);
+
+    /**
+     * Checks whether the log outgrew its snapshot
+     * @param indexPath Index snapshot
+     * @return true if compact() is worth it
+     */
+    static bool needsCompaction(const std::filesystem::path &indexPath);
+
+    /**
+     * Folds the log into a new snapshot, atomically replacing the old one.
+     * Reads and writes the files only, records appended meanwhile are kept.
+     * @param indexPath Index snapshot
+     * @return 0 on success or nothing to do, negative on error
+     */
+    static int compact(const std::filesystem::path &indexPath);
+
+    /**
+     * Moves an index file, its log and its flat cache to another name, leaving a hard link of the index and log at the old name
+     * @param indexPath Index snapshot to rotate
+     * @param rotatedPath Name it moves to, replaced
+     */
+    static void rotate(const std::filesystem::path &indexPath, const std::filesystem::path &rotatedPath);
+
+    /**
+     * Makes another name hold the same index as an index file, without writing it again
+     * @param indexPath Index snapshot
+     * @param copyPath Name that gets a hard link of the snapshot and a copy of the log, replaced
+     * @return false if the snapshot could not be linked, copyPath is then absent
+     */
+    static bool duplicate(const std::filesystem::path &indexPath, const std::filesystem::path &copyPath);
+
+private:
+    static bool applyRecord(com::fileindexer::Folder &index, com::fileindexer::Folder &record);
+};
+
+#endif // _INDEX_LOG_H_
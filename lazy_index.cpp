@@ -0,0 +1,173 @@
+// Section 1: Main Header
+#include "lazy_index.h"
+
+// Section 2: Includes
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include "index_log.h"
+
+// Section 3: Defines and Macros
+// (none)
+
+// Section 4: Static Variables
+// (none)
+
+// Section 5: Helpers
+namespace {
+
+using google::protobuf::internal::WireFormatLite;
+
+/**
+ * Walks the fields of a serialized folder without parsing its subtree
+ * @param message Serialized Folder
+ * @param ownFields Merged with the folder's own fields, nullptr to skip them
+ * @param folders Gets the serialized subfolders, nullptr to skip them
+ * @param files Gets the serialized files, nullptr to skip them
+ * @return false if the message is malformed
+ */
+bool splitFolder(std::string_view message, com::fileindexer::Folder *ownFields,
+                 std::vector<std::string_view> *folders, std::vector<std::string_view> *files)
+{
+    const auto *data = reinterpret_cast<const uint8_t *>(message.data());
+    google::protobuf::io::CodedInputStream input(data, static_cast<int>(message.size()));
+    // the own fields are serialized in runs around the child entries, each run merged at once
+    int ownStart = 0;
+    auto mergeOwnFields = [&](int ownEnd) {
+        if ( ownFields == nullptr || ownEnd == ownStart )
+            return true;
+        google::protobuf::io::CodedInputStream ownInput(data + ownStart, ownEnd - ownStart);
+        return ownFields->MergeFromCodedStream(&ownInput);
+    };
+
+    while ( true )
+    {
+        const int fieldStart = input.CurrentPosition();
+        const uint32_t tag = input.ReadTag();
+        if ( tag == 0 )
+            return input.ConsumedEntireMessage() && mergeOwnFields(fieldStart);
+
+        const int field = WireFormatLite::GetTagFieldNumber(tag);
+        if ( ( field != com::fileindexer::Folder::kFoldersFieldNumber && field != com::fileindexer::Folder::kFilesFieldNumber ) ||
+             WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED )
+        {
+            if ( !WireFormatLite::SkipField(&input, tag) )
+                return false;
+            continue;
+        }
+
+        if ( !mergeOwnFields(fieldStart) )
+            return false;
+        uint32_t length = 0;
+        if ( !input.ReadVarint32(&length) )
+            return false;
+        const int childStart = input.CurrentPosition();
+        if ( !input.Skip(static_cast<int>(length)) )
+            return false;
+        auto *children = field == com::fileindexer::Folder::kFoldersFieldNumber ? folders : files;
+        if ( children != nullptr )
+            children->emplace_back(message.substr(static_cast<size_t>(childStart), length));
+        ownStart = input.CurrentPosition();
+    }
+}
+
+} // namespace
+
+// Section 6: Static Methods
+// (none)
+
+// Section 7: Public/Protected/Private Methods
+LazyIndex::~LazyIndex()
+{
+    if ( mMap != nullptr )
+        munmap(mMap, mMapSize);
+}
+
+bool LazyIndex::open(const std::filesystem::path &indexPath, com::fileindexer::Folder &root)
+{
+    // records of a log replace whole folders, they only apply to a parsed tree
+    if ( IndexLog::hasLog(indexPath) )
+        return false;
+    const int fd = ::open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if ( fd < 0 )
+        return false;
+    struct stat status {};
+    void *map = MAP_FAILED;
+    // a protobuf message is at most 2 GiB, a larger snapshot never parses anyway
+    if ( fstat(fd, &status) == 0 && status.st_size > 0 && status.st_size <= INT_MAX )
+        map = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED )
+        return false;
+
+    const std::string_view message(static_cast<const char *>(map), static_cast<size_t>(status.st_size));
+    if ( !splitFolder(message, &root, nullptr, nullptr) )
+    {
+        munmap(map, static_cast<size_t>(status.st_size));
+        root.Clear();
+        return false;
+    }
+    if ( root.formatversion() > INDEX_FORMAT_VERSION )
+    {
+        munmap(map, static_cast<size_t>(status.st_size));
+        root.Clear();
+        return false;
+    }
+    root.set_logsequence(root.logsequence());   // as IndexLog::load() leaves it, with no record to replay
+    mFormatVersion = root.formatversion();
+    IndexLog::loadEntry(nullptr, root, mFormatVersion);
+    if ( mMap != nullptr )
+        munmap(mMap, mMapSize);
+    mMap = map;
+    mMapSize = static_cast<size_t>(status.st_size);
+    mPending.clear();
+    mPending.emplace(&root, message);
+    return true;
+}
+
+bool LazyIndex::expand(com::fileindexer::Folder &folder)
+{
+    const auto pending = mPending.find(&folder);
+    if ( pending == mPending.end() )
+        return false;
+    const std::string_view message = pending->second;
+    mPending.erase(pending);
+
+    std::vector<std::string_view> subfolders;
+    std::vector<std::string_view> files;
+    if ( !splitFolder(message, nullptr, &subfolders, &files) )
+        return true;    // malformed, the folder stays without content
+
+    folder.mutable_files()->Reserve(static_cast<int>(files.size()));
+    for ( const auto &file : files )
+    {
+        auto *entry = folder.add_files();
+        if ( !entry->ParseFromArray(file.data(), static_cast<int>(file.size())) )
+            folder.mutable_files()->RemoveLast();
+        else
+            IndexLog::loadEntry(&folder.name(), *entry, mFormatVersion);
+    }
+    folder.mutable_folders()->Reserve(static_cast<int>(subfolders.size()));
+    for ( const auto &subfolder : subfolders )
+    {
+        // the own fields only, names are all a lookup needs to pass through a folder
+        auto *entry = folder.add_folders();
+        if ( !splitFolder(subfolder, entry, nullptr, nullptr) )
+        {
+            folder.mutable_folders()->RemoveLast();
+            continue;
+        }
+        IndexLog::loadEntry(&folder.name(), *entry, mFormatVersion);
+        mPending.emplace(entry, subfolder);
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+// Section 1: Compilation Guards
+#ifndef _LAZY_INDEX_H_
+#define _LAZY_INDEX_H_
+
+// Section 2: Includes
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <unordered_map>
+
+#include "folder.pb.h"
+
+// Section 3: Defines and Macros
+// (none)
+
+// Section 4: Classes
+/**
+ * Index snapshot parsed as it is looked up, one folder level at a time, from a memory map.
+ * Opening parses the root's own fields only. Expanding a folder parses its files and the
+ * own fields of its subfolders, whose content stays in the map until they are expanded
+ * in turn. Expanding also brings the entries it parses to their form in memory: full paths
+ * as names, times as int64 nanoseconds and raw digests. Only for a snapshot without a log,
+ * such as an index received from the peer.
+ */
+class LazyIndex {
+public:
+    LazyIndex() = default;
+    LazyIndex(const LazyIndex &) = delete;
+    LazyIndex &operator=(const LazyIndex &) = delete;
+    ~LazyIndex();
+
+    /**
+     * Maps an index snapshot
+     * @param indexPath Index snapshot
+     * @param root Filled with the own fields of the root, allocated on its arena
+     * @return false if it is missing, has a log or is malformed
+     */
+    bool open(const std::filesystem::path &indexPath, com::fileindexer::Folder &root);
+
+    /**
+     * Parses the files and subfolder entries of a folder, unless already done
+     * @param folder Folder of the tree filled by open() or by an earlier expand()
+     * @return true if it was parsed by this call
+     */
+    bool expand(com::fileindexer::Folder &folder);
+
+private:
+    void *mMap = nullptr;
+    size_t mMapSize = 0;
+    uint32_t mFormatVersion = 0;    ///< formatVersion of the snapshot, the format its entries are stored in
+    std::unordered_map<const com::fileindexer::Folder *, std::string_view> mPending;  ///< Folders not expanded yet, by their serialized message
+};
+
+#endif // _LAZY_INDEX_H_
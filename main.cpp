@@ -21,6 +21,10 @@
 #include <bits/getopt_core.h>
 
 // Project Includes
+#include "change_journal.h"
+#include "directory_indexer.h"
+#include "file_hasher.h"
+#include "file_reader.h"
 #include "network_thread.h"
 #include "program_options.h"
 #include "tcp_command.h"
@@ -33,6 +37,12 @@ int main(int argc, char *argv[])
     const auto opts = ProgramOptions::parseArgs(argc, argv);
     TcpCommand::setRateLimit(opts.rate_limit);  // Set global rate limit
     TcpCommand::setMaxFileSize(opts.max_file_size_bytes);  // Set configurable max file size
+    DirectoryIndexer::setIndexThreads(opts.index_threads);  // Set parallel indexing thread count
+    DirectoryIndexer::setHashThreads(opts.hash_threads);    // Set hash worker count
+    DirectoryIndexer::setHashCache(opts.hash_cache_dir, opts.hash_cache_max_size_bytes);  // Set persistent hash cache
+    FileReader::setLargeFileMode(opts.hash_io_mode, opts.hash_io_large_file_bytes);  // Set large file read mode for hashing
+    FileHasher::setAlgorithm(opts.hash_algorithm);  // Set content hash algorithm
+    DirectoryIndexer::setChunkHashing(opts.chunk_hash_min_file_bytes, opts.chunk_hash_bytes);  // Set chunk tree hashing of huge files
 
     if (opts.ip.empty() && opts.mode == ProgramOptions::MODE_CLIENT)
     {
@@ -40,7 +50,21 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    if (opts.mode == ProgramOptions::MODE_SERVER)
+    // lives as long as the process, indexing reads what it journals
+    ChangeJournal watcher(opts.path);
+    if (opts.watch)
+    {
+        if (!watcher.start())
+            return -1;
+        std::cout << termcolor::green << "Watching " << opts.path << " for changes" << "\r\n" << termcolor::reset;
+    }
+
+    if (opts.mode == ProgramOptions::MODE_WATCH)
+    {
+        while (true)
+            std::this_thread::sleep_for(std::chrono::hours(1));
+    }
+    else if (opts.mode == ProgramOptions::MODE_SERVER)
     {
         // Server mode
         auto *server = new ServerThread(opts);
@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <array>
+#include <charconv>
 #include <utility> // for std::pair
 
 // Third-Party Includes
@@ -23,16 +24,29 @@
 
 // Section 5: Constructors and Destructors
 ProgramOptions::ProgramOptions(int argc, char *argv[])
-    : path(argv[argc - 1]), rate_limit(0.0F), auto_sync(false), dry_run(false), exit_after_sync(false), config_file(std::nullopt) {}
+    : path(argv[argc - 1]), rate_limit(0.0F), auto_sync(false), dry_run(false), exit_after_sync(false), watch(false), config_file(std::nullopt), index_threads(0), hash_threads(0) {}
 
 // Section 6: Static Methods
 // (none)
 
 // Section 7: Public/Protected/Private Methods
+/**
+ * Parses the value of a thread count option
+ * @param text Value given on the command line
+ * @param threads Set to the parsed count
+ * @return false if it is not a plain non-negative number
+ */
+static bool parseThreadCount(const char *text, unsigned &threads)
+{
+    const char *end = text + std::strlen(text);
+    const auto [parsed, error] = std::from_chars(text, end, threads);
+    return text != end && error == std::errc() && parsed == end;
+}
+
 void printusage()
 {
 	std::cout << termcolor::white << "Usage:" << "\r\n" << termcolor::reset;
-	std::cout << termcolor::white << "\t" << "multi-pc-sync [-s <serverip:port> | -d <port>] [-r rate] [-y] [--cfg=<cfgfile>] [--dry-run] [--print-before-sync] [--exit-after-sync] <path>" << "\r\n" << termcolor::reset;
+	std::cout << termcolor::white << "\t" << "multi-pc-sync [-s <serverip:port> | -d <port>] [-r rate] [-y] [--cfg=<cfgfile>] [--dry-run] [--print-before-sync] [--exit-after-sync] [--index-threads=<n>] [--hash-threads=<n>] [--watch] <path>" << "\r\n" << termcolor::reset;
 	std::cout << termcolor::white << "\t" << "-s" << "\t" << "connect to <serverip:port>, indexes the path and synchronizes folders" << "\r\n" << termcolor::reset;
 	std::cout << termcolor::white << "\t" << "-d" << "\t" << "start a synchronization daemon on <port> for <path>" << "\r\n" << termcolor::reset;
 	std::cout << termcolor::white << "\t" << "-r" << "\t" << "limit TCP command rate (Hz), 0 means unlimited (default: 0)" << "\r\n" << termcolor::reset;
@@ -41,6 +55,9 @@ void printusage()
 	std::cout << termcolor::white << "\t" << "--cfg=<cfgfile>" << "\t" << "path to configuration file for additional options" << "\r\n" << termcolor::reset;
 	std::cout << termcolor::white << "\t" << "--dry-run" << "\t" << "print commands but don't execute them" << "\r\n" << termcolor::reset;
 	std::cout << termcolor::white << "\t" << "--exit-after-sync" << "\t" << "exit server after sending SyncDoneCmd (for unit testing)" << "\r\n" << termcolor::reset;
+	std::cout << termcolor::white << "\t" << "--index-threads=<n>" << "\t" << "threads indexing subfolders, and planning the subtrees of a large sync, in parallel, 0 means one per core (default: 0)" << "\r\n" << termcolor::reset;
+	std::cout << termcolor::white << "\t" << "--hash-threads=<n>" << "\t" << "files hashed concurrently while indexing, 0 means one per core (default: 0)" << "\r\n" << termcolor::reset;
+	std::cout << termcolor::white << "\t" << "--watch" << "\t" << "journal changes under <path> so indexing only lists changed folders, with -d next to the server, alone as a daemon for the clients" << "\r\n" << termcolor::reset;
 	exit(0);
 }
 
@@ -74,12 +91,18 @@ ProgramOptions ProgramOptions::parseArgs(int argc, char *argv[])
     static constexpr int kExitAfterSyncOption = 2;
     static constexpr int kConfigFileOption = 3;
     static constexpr int kPrintBeforeSyncOption = 4;
+    static constexpr int kIndexThreadsOption = 5;
+    static constexpr int kHashThreadsOption = 6;
+    static constexpr int kWatchOption = 7;
     
-    static constexpr std::array<option, 5> long_options{{
+    static constexpr std::array<option, 8> long_options{{
         {.name = "dry-run", .has_arg = no_argument, .flag = nullptr, .val = kDryRunOption},
         {.name = "exit-after-sync", .has_arg = no_argument, .flag = nullptr, .val = kExitAfterSyncOption},
         {.name = "cfg", .has_arg = required_argument, .flag = nullptr, .val = kConfigFileOption},
         {.name = "print-before-sync", .has_arg = no_argument, .flag = nullptr, .val = kPrintBeforeSyncOption},
+        {.name = "index-threads", .has_arg = required_argument, .flag = nullptr, .val = kIndexThreadsOption},
+        {.name = "hash-threads", .has_arg = required_argument, .flag = nullptr, .val = kHashThreadsOption},
+        {.name = "watch", .has_arg = no_argument, .flag = nullptr, .val = kWatchOption},
         {.name = nullptr, .has_arg = 0, .flag = nullptr, .val = 0}
     }};
     
@@ -131,11 +154,35 @@ ProgramOptions ProgramOptions::parseArgs(int argc, char *argv[])
             opts.dry_run = true;
             opts.auto_sync = true;
             break;
+        case kIndexThreadsOption:
+            if (!parseThreadCount(optarg, opts.index_threads)) {
+                std::cout << termcolor::red << "--index-threads expects a number of threads: " << optarg << "\r\n" << termcolor::reset;
+                printusage();
+            }
+            break;
+        case kHashThreadsOption:
+            if (!parseThreadCount(optarg, opts.hash_threads)) {
+                std::cout << termcolor::red << "--hash-threads expects a number of threads: " << optarg << "\r\n" << termcolor::reset;
+                printusage();
+            }
+            break;
+        case kWatchOption:
+            opts.watch = true;
+            break;
         default:
         case '?':
             printusage();
         }
     }
+    // the client process exits after one sync, its journal has to be kept by a process of its own
+    if ( opts.watch && opts.mode == ProgramOptions::MODE_CLIENT )
+    {
+        std::cout << termcolor::red << "--watch runs with -d or on its own, start it as a separate process next to the client" << "\r\n" << termcolor::reset;
+        exit(0);
+    }
+    if ( opts.watch && opts.port == -1 )
+        opts.mode = ProgramOptions::MODE_WATCH;
+
     // Parse config file if provided
     if (opts.config_file) {
         opts.parseConfigFile();
@@ -190,6 +237,24 @@ void ProgramOptions::parseConfigFile() {
         // Parse the values based on keys
         if (key == "MAX_FILE_SIZE_BYTES") {
             max_file_size_bytes = std::stoull(value);
+        } else if (key == "HASH_CACHE_DIR") {
+            hash_cache_dir = value;
+        } else if (key == "HASH_CACHE_MAX_SIZE_BYTES") {
+            hash_cache_max_size_bytes = std::stoull(value);
+        } else if (key == "HASH_IO_MODE") {
+            if (!FileReader::parseMode(value, hash_io_mode)) {
+                std::cerr << termcolor::red << "Unknown HASH_IO_MODE: " << value << ", expected buffered, direct or mmap" << "\r\n" << termcolor::reset;
+            }
+        } else if (key == "HASH_IO_LARGE_FILE_BYTES") {
+            hash_io_large_file_bytes = std::stoull(value);
+        } else if (key == "HASH_ALGORITHM") {
+            if (!FileHasher::parseAlgorithm(value, hash_algorithm)) {
+                std::cerr << termcolor::red << "Unknown HASH_ALGORITHM: " << value << ", expected md5 or xxh3-128" << "\r\n" << termcolor::reset;
+            }
+        } else if (key == "CHUNK_HASH_MIN_FILE_BYTES") {
+            chunk_hash_min_file_bytes = std::stoull(value);
+        } else if (key == "CHUNK_HASH_BYTES") {
+            chunk_hash_bytes = std::stoull(value);
         }
         // Add other config options here as needed
     }
@@ -8,10 +8,15 @@
 #include <cstdint>
 #include <optional>
 
+#include "file_hasher.h"
+#include "file_reader.h"
+
 // Section 3: Defines and Macros
 constexpr uint64_t BYTES_PER_GB = 1ULL << 30; // 1 GiB = 1024^3 bytes
 constexpr uint64_t DEFAULT_MAX_FILE_SIZE_GB = 64ULL;
 constexpr uint64_t DEFAULT_MAX_FILE_SIZE_BYTES = (DEFAULT_MAX_FILE_SIZE_GB * BYTES_PER_GB) - 1;
+constexpr uint64_t DEFAULT_HASH_CACHE_MAX_SIZE_BYTES = 64ULL << 20; // 64 MiB, about a million files
+constexpr uint64_t DEFAULT_CHUNK_HASH_BYTES = 64ULL << 20; // 64 MiB chunks, 1600 of them for a 100 GB file
 
 class ProgramOptions {
 public:
@@ -19,6 +24,7 @@ public:
     enum MODE : std::uint8_t {
         MODE_CLIENT = 0,
         MODE_SERVER,
+        MODE_WATCH,     // Only journal the changes of path, for the client runs on this machine
     };
     
     // Config file options
@@ -32,10 +38,20 @@ public:
     bool auto_sync;     // Skip Y/N prompt and automatically sync
     bool dry_run;       // Print commands but don't execute
     bool exit_after_sync; // Exit server after sending SyncDoneCmd (for unit testing)
+    bool watch;         // Journal the changes of path so indexing only lists changed directories
     std::optional<std::filesystem::path> config_file; // Path to configuration file
+    unsigned index_threads; // Threads indexing subfolders in parallel, 0 means one per core
+    unsigned hash_threads;  // Files hashed concurrently while indexing, 0 means one per core
     
     // Config file options
     uint64_t max_file_size_bytes = DEFAULT_MAX_FILE_SIZE_BYTES; // 64GiB default
+    std::filesystem::path hash_cache_dir; // Empty means ~/.cache/multi-pc-sync
+    uint64_t hash_cache_max_size_bytes = DEFAULT_HASH_CACHE_MAX_SIZE_BYTES; // 0 disables the hash cache
+    FileReader::Mode hash_io_mode = FileReader::Mode::BUFFERED; // How large files are read for hashing
+    uint64_t hash_io_large_file_bytes = FILE_READER_DEFAULT_LARGE_FILE_BYTES; // Size from which hash_io_mode applies
+    FileHasher::Algorithm hash_algorithm = FileHasher::Algorithm::MD5; // Algorithm file contents are hashed with
+    uint64_t chunk_hash_min_file_bytes = 0; // Files from this size are hashed as a chunk tree, 0 never
+    uint64_t chunk_hash_bytes = DEFAULT_CHUNK_HASH_BYTES; // Chunk size of the chunk trees
 
     static ProgramOptions parseArgs(int argc, char *argv[]);
     void parseConfigFile();
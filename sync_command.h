@@ -134,8 +134,13 @@ public:
     int executeAll(const std::map<std::string, std::string> &args, bool verbose = false);
 
     void emplace_back(const char * arg1, const std::string &arg2, const std::string &arg3, const bool &isRemote) {
-        std::cout << "Adding sync command: " << arg1 << " " << arg2 << " " << arg3 << (isRemote ? " (remote)" : "") << "\r\n";
-        std::list<SyncCommand>::emplace_back(arg1, arg2, arg3, isRemote);
+        emplace(end(), arg1, arg2, arg3, isRemote);
+    }
+
+    iterator emplace(const_iterator position, const char * arg1, const std::string &arg2, const std::string &arg3, const bool &isRemote) {
+        // one write, subtrees may be planned on several threads
+        std::cout << "Adding sync command: " + std::string(arg1) + " " + arg2 + " " + arg3 + (isRemote ? " (remote)" : "") + "\r\n";
+        return std::list<SyncCommand>::emplace(position, arg1, arg2, arg3, isRemote);
     }
 
     /**
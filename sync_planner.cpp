@@ -0,0 +1,308 @@
+// Section 1: Main Header
+#include "sync_planner.h"
+
+// Section 2: Includes
+#include "directory_indexer.h"
+#include "file_hasher.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string_view>
+#include <utility>
+
+// Third-Party Includes
+#include "termcolor/termcolor.hpp"
+
+// Section 3: Defines and Macros
+// (none)
+
+// Section 4: Static Variables
+thread_local SyncPlanner::PlanShard *SyncPlanner::currentShard = nullptr;
+
+// Section 5: Constructors and Destructors
+SyncPlanner::SyncPlanner(DirectoryIndexer &local, DirectoryIndexer *past, DirectoryIndexer &remote, DirectoryIndexer *remotePast, bool verbose, bool isRemote) :
+    mLocal( local ),
+    mPast( past ),
+    mRemote( remote ),
+    mRemotePast( remotePast ),
+    mVerbose( verbose ),
+    mIsRemote( isRemote )
+{
+}
+
+// Section 6: Static Methods
+void SyncPlanner::planFetch(DirectoryIndexer &indexer, const PendingFetch &fetch, const com::fileindexer::File &content, SyncCommands &syncCommands, bool verbose)
+{
+    if (currentShard != nullptr)
+    {
+        // copies planned by the subtrees before this one are sources too, known once they are all planned
+        const auto placeholder = syncCommands.insert(syncCommands.end(), SyncCommand("fetch", fetch.remoteFilePath, fetch.localFilePath, !fetch.isRemote));
+        currentShard->events.push_back(ContentEvent{ .indexer = &indexer, .file = nullptr, .remembered = false,
+                                                     .digest = content.hash(), .fetch = fetch, .placeholder = placeholder });
+        return;
+    }
+    const auto copies = indexer.findFileFromHash(nullptr, content, true, verbose);
+    emitFetch(fetch, content.hash(), copies.empty() ? nullptr : copies.front(), syncCommands, syncCommands.end());
+}
+
+void SyncPlanner::recordContent(const DirectoryIndexer &indexer, const com::fileindexer::File &file, bool remembered)
+{
+    if (currentShard != nullptr)
+        currentShard->events.push_back(ContentEvent{ .indexer = &indexer, .file = &file, .remembered = remembered,
+                                                     .digest = file.hash(), .fetch = {}, .placeholder = {} });
+}
+
+void SyncPlanner::sortChildren(com::fileindexer::Folder &folder)
+{
+    const auto byName = [](const auto *entryA, const auto *entryB) { return entryA->name() < entryB->name(); };
+    auto *folders = folder.mutable_folders();
+    if (!std::is_sorted(folders->pointer_begin(), folders->pointer_end(), byName))
+        std::sort(folders->pointer_begin(), folders->pointer_end(), byName);
+    auto *files = folder.mutable_files();
+    if (!std::is_sorted(files->pointer_begin(), files->pointer_end(), byName))
+        std::sort(files->pointer_begin(), files->pointer_end(), byName);
+}
+
+void SyncPlanner::emitFetch(const PendingFetch &fetch, const std::string &digest, const com::fileindexer::File *source, SyncCommands &syncCommands, SyncCommands::iterator position)
+{
+    if (source == nullptr)
+    {
+        DirectoryIndexer::checkPathLengthWarnings(fetch.localFilePath, std::string("fetch/push ") + fetch.reason + " file");
+        syncCommands.emplace(position, fetch.isRemote ? "push" : "fetch", fetch.remoteFilePath, fetch.localFilePath, !fetch.isRemote);
+        return;
+    }
+
+    if (std::string_view(fetch.reason) == "new")
+        std::cout << termcolor::yellow << "File " << termcolor::magenta << fetch.remoteFilePath << termcolor::yellow << " is missing locally, but found in remote index with hash " << termcolor::magenta << FileHasher::toHex(digest) << termcolor::reset << "\r\n";
+    DirectoryIndexer::checkPathLengthWarnings(fetch.localFilePath, std::string("copy ") + fetch.reason + " file");
+    syncCommands.emplace(position, "cp", source->name(), fetch.localFilePath, fetch.isRemote);
+    if (fetch.withChmod)
+    {
+        std::ostringstream oss;
+        oss << std::oct << fetch.permissions;
+        syncCommands.emplace(position, fetch.isRemote ? "system" : "chmod", fetch.isRemote ? "chmod " + oss.str() : oss.str(), "\"" + fetch.localFilePath + "\"", fetch.isRemote);
+    }
+}
+
+void SyncPlanner::resolveShards(std::vector<PlanShard> &shards)
+{
+    // the files each digest lookup held before planning, for the digests the shards touched, in name order like
+    // the lookup; by name alone, as a file forgotten since may hold another digest by now
+    const auto byName = [](const com::fileindexer::File *fileA, const com::fileindexer::File *fileB) { return fileA->name() < fileB->name(); };
+    std::map<std::pair<const DirectoryIndexer *, std::string_view>, std::set<const com::fileindexer::File *, decltype(byName)>> sources;
+    for (const auto &shard : shards)
+    {
+        for (const auto &event : shard.events)
+        {
+            auto [entry, inserted] = sources.try_emplace({ event.indexer, event.digest });
+            if (!inserted)
+                continue;
+            auto [first, last] = event.indexer->mContentLookup.equal_range(std::string_view(event.digest));
+            entry->second.insert(first, last);
+        }
+    }
+    for (auto shard = shards.rbegin(); shard != shards.rend(); ++shard)
+    {
+        for (auto event = shard->events.rbegin(); event != shard->events.rend(); ++event)
+        {
+            if (event->file == nullptr)
+                continue;
+            auto &files = sources[{ event->indexer, event->digest }];
+            if (event->remembered)
+                files.erase(event->file);
+            else
+                files.insert(event->file);
+        }
+    }
+
+    // then replayed in planning order, each fetch getting the copy source the serial planning would have had
+    for (auto &shard : shards)
+    {
+        for (auto &event : shard.events)
+        {
+            auto &files = sources[{ event.indexer, event.digest }];
+            if (event.file == nullptr)
+            {
+                emitFetch(event.fetch, event.digest, files.empty() ? nullptr : *files.begin(), shard.commands, event.placeholder);
+                shard.commands.erase(event.placeholder);
+            }
+            else if (event.remembered)
+                files.insert(event.file);
+            else
+                files.erase(event.file);
+        }
+    }
+}
+
+// Section 7: Public/Protected/Private Methods
+void SyncPlanner::plan(com::fileindexer::Folder *localFolder, com::fileindexer::Folder *remoteFolder, bool topLevel, SyncCommands &syncCommands)
+{
+    // a large tree is planned a top level subtree per task
+    std::unique_ptr<WorkStealingPool> pool;
+    if (topLevel && planInParallel())
+        pool = std::make_unique<WorkStealingPool>(DirectoryIndexer::resolvedIndexThreads());
+    syncMerged(localFolder, remoteFolder, syncCommands, SYNC_PASS::REMOTE_ENTRIES, pool.get());
+    if (!topLevel)
+        return;
+
+    if (mVerbose)
+        std::cout << "\r\n" << "Exporting sync commands from local to remote" << "\r\n";
+    // once every remote entry is planned, as those decisions left both sides
+    syncMerged(localFolder, remoteFolder, syncCommands, SYNC_PASS::LOCAL_ENTRIES, pool.get());
+}
+
+bool SyncPlanner::planInParallel() const
+{
+    if (DirectoryIndexer::resolvedIndexThreads() < 2 || mLocal.mPathLookup.size() + mRemote.mPathLookup.size() < SYNC_PARALLEL_MIN_ENTRIES)
+        return false;
+    // the copy sources are picked by digest afterwards, which only decides between files hashed the same way
+    const auto &localSchemes = mLocal.mContentSchemes;
+    const auto &remoteSchemes = mRemote.mContentSchemes;
+    if (localSchemes.size() > 1 || remoteSchemes.size() > 1)
+        return false;
+    return localSchemes.empty() || remoteSchemes.empty() || localSchemes.begin()->first == remoteSchemes.begin()->first;
+}
+
+void SyncPlanner::syncMerged(com::fileindexer::Folder *localFolder, com::fileindexer::Folder *remoteFolder, SyncCommands &syncCommands, SYNC_PASS pass, WorkStealingPool *pool)
+{
+    const std::string localRoot = mLocal.mDir.path().string();
+    const std::string remoteRoot = mRemote.mDir.path().string();
+    // children of a folder share its name, they sort the same as their names below the roots
+    const auto order = [&](const auto *localChild, const auto *remoteChild) {
+        if (localChild == nullptr)
+            return 1;
+        if (remoteChild == nullptr)
+            return -1;
+        return std::string_view(localChild->name()).substr(localRoot.length() + 1).compare(
+               std::string_view(remoteChild->name()).substr(remoteRoot.length() + 1));
+    };
+    if (localFolder != nullptr)
+        sortChildren(*localFolder);
+    if (remoteFolder != nullptr)
+        sortChildren(*remoteFolder);
+    // what the planning adds goes after these, only the children there before are walked
+    const int localFolders = localFolder != nullptr ? localFolder->folders_size() : 0;
+    const int remoteFolders = remoteFolder != nullptr ? remoteFolder->folders_size() : 0;
+    const int localFiles = localFolder != nullptr ? localFolder->files_size() : 0;
+    const int remoteFiles = remoteFolder != nullptr ? remoteFolder->files_size() : 0;
+    // the first pass plans the remote's children, the second this side's, each with the other side's of the same name
+    const bool remoteEntries = pass == SYNC_PASS::REMOTE_ENTRIES;
+
+    std::vector<FolderPair> folderPairs;
+    for (int localIndex = 0, remoteIndex = 0; localIndex < localFolders || remoteIndex < remoteFolders;)
+    {
+        auto *localChild = localIndex < localFolders ? localFolder->mutable_folders(localIndex) : nullptr;
+        auto *remoteChild = remoteIndex < remoteFolders ? remoteFolder->mutable_folders(remoteIndex) : nullptr;
+        const int comparison = order(localChild, remoteChild);
+        if (comparison < 0)
+            remoteChild = nullptr;
+        else if (comparison > 0)
+            localChild = nullptr;
+        localIndex += localChild != nullptr ? 1 : 0;
+        remoteIndex += remoteChild != nullptr ? 1 : 0;
+        if ((remoteEntries ? remoteChild : localChild) != nullptr)
+            folderPairs.push_back(FolderPair{ .local = localChild, .remote = remoteChild, .missing = false });
+    }
+
+    const auto syncFiles = [&](SyncCommands &commands) {
+        for (int localIndex = 0, remoteIndex = 0; localIndex < localFiles || remoteIndex < remoteFiles;)
+        {
+            auto *localChild = localIndex < localFiles ? localFolder->mutable_files(localIndex) : nullptr;
+            auto *remoteChild = remoteIndex < remoteFiles ? remoteFolder->mutable_files(remoteIndex) : nullptr;
+            const int comparison = order(localChild, remoteChild);
+            if (comparison < 0)
+                remoteChild = nullptr;
+            else if (comparison > 0)
+                localChild = nullptr;
+            localIndex += localChild != nullptr ? 1 : 0;
+            remoteIndex += remoteChild != nullptr ? 1 : 0;
+
+            if (remoteEntries && remoteChild != nullptr)
+                mLocal.syncFile(*remoteChild, localChild, mPast, &mRemote, mRemotePast, commands, mVerbose, mIsRemote, mPast == nullptr);
+            else if (!remoteEntries && localChild != nullptr)
+                mRemote.syncFile(*localChild, remoteChild, mRemotePast, &mLocal, mPast, commands, mVerbose, true, mRemotePast == nullptr);
+        }
+    };
+
+    if (pool == nullptr || folderPairs.size() < 2)
+    {
+        for (auto &folderPair : folderPairs)
+        {
+            createMissingFolder(folderPair, syncCommands, pass);
+            syncFolderPair(folderPair, syncCommands, pass);
+        }
+        syncFiles(syncCommands);
+        return;
+    }
+
+    // one task per subtree planning into a shard of its own, the files of the folder itself last as before;
+    // the folders missing on the side planned onto join this folder first, while no task runs
+    std::vector<PlanShard> shards(folderPairs.size() + 1);
+    for (size_t index = 0; index < folderPairs.size(); ++index)
+        createMissingFolder(folderPairs[index], shards[index].commands, pass);
+    WorkStealingPool::TaskGroup subtreeTasks;
+    for (size_t index = 0; index < folderPairs.size(); ++index)
+    {
+        pool->submit(subtreeTasks, [&, index]() {
+            currentShard = &shards[index];
+            try
+            {
+                syncFolderPair(folderPairs[index], shards[index].commands, pass);
+            }
+            catch (...)
+            {
+                currentShard = nullptr;
+                throw;
+            }
+            currentShard = nullptr;
+        });
+    }
+    pool->wait(subtreeTasks);
+    currentShard = &shards.back();
+    syncFiles(shards.back().commands);
+    currentShard = nullptr;
+
+    resolveShards(shards);
+    for (auto &shard : shards)
+        syncCommands.splice(syncCommands.end(), shard.commands);
+}
+
+void SyncPlanner::createMissingFolder(FolderPair &folderPair, SyncCommands &syncCommands, SYNC_PASS pass)
+{
+    // the second pass plans this side's folders from the remote's, as the first plans the remote's from here
+    const bool remoteEntries = pass == SYNC_PASS::REMOTE_ENTRIES;
+    DirectoryIndexer &target = remoteEntries ? mLocal : mRemote;
+    const DirectoryIndexer &source = remoteEntries ? mRemote : mLocal;
+    auto *&targetFolder = remoteEntries ? folderPair.local : folderPair.remote;
+    auto &sourceFolder = remoteEntries ? *folderPair.remote : *folderPair.local;
+    const std::string targetFolderPath = target.mDir.path().string() + "/" + sourceFolder.name().substr(source.mDir.path().string().length() + 1);
+    if (mVerbose)
+        std::cout << termcolor::cyan << "Entering " << sourceFolder.name() << termcolor::reset << "\r\n";
+    if (targetFolder != nullptr)
+    {
+        if (mVerbose)
+            std::cout << termcolor::cyan << "folder exists! " << targetFolderPath << termcolor::reset << "\r\n";
+        return;
+    }
+
+    if (mVerbose)
+        std::cout << termcolor::cyan << "folder missing! " << targetFolderPath << termcolor::reset << "\r\n";
+    DirectoryIndexer *targetPast = remoteEntries ? mPast : mRemotePast;
+    targetFolder = target.syncMissingFolder(sourceFolder, targetFolderPath, targetPast, syncCommands, remoteEntries ? mIsRemote : true, targetPast == nullptr);
+    folderPair.missing = true;
+}
+
+void SyncPlanner::syncFolderPair(const FolderPair &folderPair, SyncCommands &syncCommands, SYNC_PASS pass)
+{
+    syncMerged(folderPair.local, folderPair.remote, syncCommands, pass, nullptr);
+    // deleted on the side planned onto since the last run, the emptied folder goes on the other
+    if (!folderPair.missing)
+        return;
+    if (pass == SYNC_PASS::REMOTE_ENTRIES && folderPair.local == nullptr)
+        syncCommands.emplace_back("rmdir", folderPair.remote->name(), "", !mIsRemote);
+    else if (pass == SYNC_PASS::LOCAL_ENTRIES && folderPair.remote == nullptr)
+        syncCommands.emplace_back("rmdir", folderPair.local->name(), "", false);
+}
@@ -0,0 +1,131 @@
+// Section 1: Compilation Guards
+#ifndef _SYNC_PLANNER_H_
+#define _SYNC_PLANNER_H_
+
+// Section 2: Includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "folder.pb.h"
+#include "sync_command.h"
+#include "work_stealing_pool.h"
+
+// Section 3: Defines and Macros
+constexpr size_t SYNC_PARALLEL_MIN_ENTRIES = 65536;        // entries on both sides from which a sync is planned a subtree per task
+
+// Section 4: Classes
+class DirectoryIndexer;
+
+/**
+ * Plans the sync commands between the indexes of two sides in a merge walk of both trees:
+ * a pass over the remote's entries planned onto this side, then one over this side's planned onto the remote.
+ * A large tree is planned a top level subtree per task, the copy sources of its fetches picked once all are planned.
+ */
+class SyncPlanner {
+public:
+    /**
+     * File a side gets, transferred from the other or copied from a file of its own with the same content
+     */
+    struct PendingFetch {
+        std::string remoteFilePath;
+        std::string localFilePath;
+        const char *reason;         ///< "missing", "modified" or "new", for the path length checks
+        int32_t permissions;        ///< Set on a copy when withChmod, as the index holds them
+        bool withChmod;
+        bool isRemote;
+    };
+
+    /**
+     * Prepares the planning of a sync between two sides
+     * @param local Indexer of this side
+     * @param past Last run index of this side, nullptr for a first sync
+     * @param remote Indexer of the remote side
+     * @param remotePast Last run index of the remote side, nullptr for a first sync
+     * @param verbose Whether to log the walk
+     * @param isRemote Whether this side is the remote one
+     */
+    SyncPlanner(DirectoryIndexer &local, DirectoryIndexer *past, DirectoryIndexer &remote, DirectoryIndexer *remotePast, bool verbose, bool isRemote);
+
+    /**
+     * Plans the remote's entries of a folder onto this side, then for the roots this side's onto the remote
+     * @param localFolder Folder of this side, nullptr if missing
+     * @param remoteFolder Folder of the remote
+     * @param topLevel Whether these are the roots
+     * @param syncCommands Receives the planned commands
+     */
+    void plan(com::fileindexer::Folder *localFolder, com::fileindexer::Folder *remoteFolder, bool topLevel, SyncCommands &syncCommands);
+
+    /**
+     * Plans a file copied from one of its side with the same content, or transferred when there is none
+     * @param indexer Indexer of the side getting the file
+     * @param fetch File to get
+     * @param content Entry with the content it gets
+     * @param syncCommands Receives the planned commands
+     * @param verbose Whether to log the search
+     */
+    static void planFetch(DirectoryIndexer &indexer, const PendingFetch &fetch, const com::fileindexer::File &content, SyncCommands &syncCommands, bool verbose);
+
+    /**
+     * Records a file joining or leaving a digest lookup, for the subtree task planning on the calling thread
+     * @param indexer Indexer of the digest lookup
+     * @param file File remembered or forgotten, with the digest it is looked up by
+     * @param remembered Whether the file joined the lookup
+     */
+    static void recordContent(const DirectoryIndexer &indexer, const com::fileindexer::File &file, bool remembered);
+
+private:
+    /**
+     * Pass of the planning: the remote's entries onto this side, then this side's onto the remote
+     */
+    enum class SYNC_PASS : std::uint8_t {
+        REMOTE_ENTRIES = 0,     ///< Entries of the remote, planned from this side
+        LOCAL_ENTRIES,          ///< Entries of this side, planned from the remote's as it sees them after the first pass
+    };
+    /**
+     * Subfolders of the same name on both sides, paired by the merge walk
+     */
+    struct FolderPair {
+        com::fileindexer::Folder *local;
+        com::fileindexer::Folder *remote;
+        bool missing;           ///< The side planned onto lacked it, created there or nullptr if deleted since
+    };
+    /**
+     * Change to or search of a digest lookup, recorded in planning order by a subtree task
+     */
+    struct ContentEvent {
+        const DirectoryIndexer *indexer;        ///< Indexer of the digest lookup
+        const com::fileindexer::File *file;     ///< File remembered or forgotten, nullptr for a search
+        bool remembered;
+        std::string digest;
+        PendingFetch fetch;                     ///< What a search is for
+        SyncCommands::iterator placeholder;     ///< Where the commands of a search go in the shard
+    };
+    /**
+     * Commands and digest lookup events of a subtree planned by its own task
+     */
+    struct PlanShard {
+        SyncCommands commands;
+        std::vector<ContentEvent> events;
+    };
+
+    bool planInParallel() const;
+    static void sortChildren(com::fileindexer::Folder &folder);
+    void syncMerged(com::fileindexer::Folder *localFolder, com::fileindexer::Folder *remoteFolder, SyncCommands &syncCommands, SYNC_PASS pass, WorkStealingPool *pool);
+    void createMissingFolder(FolderPair &folderPair, SyncCommands &syncCommands, SYNC_PASS pass);
+    void syncFolderPair(const FolderPair &folderPair, SyncCommands &syncCommands, SYNC_PASS pass);
+    static void emitFetch(const PendingFetch &fetch, const std::string &digest, const com::fileindexer::File *source, SyncCommands &syncCommands, SyncCommands::iterator position);
+    static void resolveShards(std::vector<PlanShard> &shards);
+
+    DirectoryIndexer &mLocal;
+    DirectoryIndexer *mPast;
+    DirectoryIndexer &mRemote;
+    DirectoryIndexer *mRemotePast;
+    bool mVerbose;
+    bool mIsRemote;
+
+    static thread_local PlanShard *currentShard;    ///< Shard the calling thread plans into, nullptr unless planning in parallel
+};
+
+#endif // _SYNC_PLANNER_H_
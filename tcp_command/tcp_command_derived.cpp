@@ -18,8 +18,12 @@
 // C++ Standard Library
 #include <array>
 #include <filesystem>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_set>
 
 // System Includes
 #include <sys/socket.h>
@@ -157,9 +161,9 @@ int IndexFolderCmd::execute(std::map<std::string,std::string> &args)
         if (std::filesystem::exists(lastrunIndexFilename))
         {
             MessageCmd::sendMessage(std::stoi(args.at("txsocket")), "Last run index already exists, removing it");
-            std::filesystem::remove(lastrunIndexFilename);
         }
-        std::filesystem::rename( indexfilename, lastrunIndexFilename );
+        // the index keeps a link of the backup, the walk only records what changed since
+        IndexLog::rotate( indexfilename, lastrunIndexFilename );
     }
     
     /* kick off the indexing */
@@ -203,6 +207,13 @@ int IndexFolderCmd::execute(std::map<std::string,std::string> &args)
     appendDeletionLogToBuffer(commandbuf, deletions);
     // --- End insertion ---
 
+    // the index files are sent as they are, the peer reads them without their logs
+    if ( localIndexer->compactIndexFile() < 0 || ( lastindexer != nullptr && lastindexer->compactIndexFile() < 0 ) )
+    {
+        MessageCmd::sendMessage(std::stoi(args.at("txsocket")), "Failed to write index file.");
+        return -1;
+    }
+
     TcpCommand * command = TcpCommand::create(commandbuf);
     if ( command == nullptr )
     {
@@ -338,36 +349,53 @@ int IndexPayloadCmd::execute(std::map<std::string, std::string> &args)
     if ( std::filesystem::exists(indexpath) )
     {
         lastrunIndexPresent = true;
-        if (std::filesystem::exists(lastRunIndexPath))
-        {
-            std::filesystem::remove(lastRunIndexPath);
-        }
-        std::filesystem::rename(indexpath, lastRunIndexPath);
+        // the index keeps a link of the backup, the walk only records what changed since
+        IndexLog::rotate(indexpath, lastRunIndexPath);
     }
 
     std::cout << termcolor::cyan << "importing remote index" << "\r\n" << termcolor::reset;
-    DirectoryIndexer remoteIndexer(localPath, true, DirectoryIndexer::INDEX_TYPE_REMOTE);
-    remoteIndexer.setPath(remotePath);
-
-    DirectoryIndexer *lastRunRemoteIndexer = nullptr;
+    // the four indexes of the session share one arena, freed at once when it ends
+    google::protobuf::Arena indexArena(DirectoryIndexer::indexArenaOptions());
+    // the four files load at once, the last run ones barely read until the planner looks them up
+    auto loadIndexer = [&localPath, &indexArena](DirectoryIndexer::INDEX_TYPE type) {
+        return std::async(std::launch::async, [&localPath, &indexArena, type]() {
+            return std::make_unique<DirectoryIndexer>(localPath, true, type, &indexArena);
+        });
+    };
+    auto remoteLoad = loadIndexer(DirectoryIndexer::INDEX_TYPE_REMOTE);
+
+    std::future<std::unique_ptr<DirectoryIndexer>> lastRunRemoteLoad;
     if (std::filesystem::exists(remoteLastRunIndexPath))
     {
         std::cout << termcolor::cyan << "importing remote index from last run" << "\r\n" << termcolor::reset;
-        lastRunRemoteIndexer = new DirectoryIndexer(localPath, true, DirectoryIndexer::INDEX_TYPE_REMOTE_LAST_RUN);
-        lastRunRemoteIndexer->setPath(remotePath);
+        lastRunRemoteLoad = loadIndexer(DirectoryIndexer::INDEX_TYPE_REMOTE_LAST_RUN);
     }
 
-    std::cout << termcolor::cyan << "remote and local indexes in hand, ready to sync" << "\r\n" << termcolor::reset;
-    DirectoryIndexer *lastRunIndexer = nullptr;
+    std::future<std::unique_ptr<DirectoryIndexer>> lastRunLoad;
     if (lastrunIndexPresent)
     {
         std::cout << termcolor::cyan << "importing local index from last run" << "\r\n" << termcolor::reset;
-        lastRunIndexer = new DirectoryIndexer(localPath, true, DirectoryIndexer::INDEX_TYPE_LOCAL_LAST_RUN);
+        lastRunLoad = loadIndexer(DirectoryIndexer::INDEX_TYPE_LOCAL_LAST_RUN);
     }
-    DirectoryIndexer localIndexer(localPath, true, DirectoryIndexer::INDEX_TYPE_LOCAL);
+    DirectoryIndexer localIndexer(localPath, true, DirectoryIndexer::INDEX_TYPE_LOCAL, &indexArena);
+
+    const std::unique_ptr<DirectoryIndexer> remoteIndexer = remoteLoad.get();
+    remoteIndexer->setPath(remotePath);
+    std::unique_ptr<DirectoryIndexer> lastRunRemoteIndexer = lastRunRemoteLoad.valid() ? lastRunRemoteLoad.get() : nullptr;
+    if (lastRunRemoteIndexer != nullptr)
+        lastRunRemoteIndexer->setPath(remotePath);
+    std::unique_ptr<DirectoryIndexer> lastRunIndexer = lastRunLoad.valid() ? lastRunLoad.get() : nullptr;
+    std::cout << termcolor::cyan << "remote and local indexes in hand, ready to sync" << "\r\n" << termcolor::reset;
+
+    // digests only compare when computed the same way, hash the local side the way the server did
+    const FileHasher::Algorithm remoteHashAlgorithm = remoteIndexer->indexedHashAlgorithm();
+    if ( remoteHashAlgorithm != FileHasher::algorithm() )
+        std::cout << termcolor::yellow << "Server hashes with " << FileHasher::algorithmName(remoteHashAlgorithm)
+                  << ", indexing with it instead of " << FileHasher::algorithmName(FileHasher::algorithm()) << "\r\n" << termcolor::reset;
+    localIndexer.adoptHashSettings(*remoteIndexer);
     localIndexer.indexonprotobuf(false);
 
-    const auto localDeletions = localIndexer.getDeletions(lastRunIndexer);
+    const auto localDeletions = localIndexer.getDeletions(lastRunIndexer.get());
 
     //std::cout << termcolor::white << "local index size: " << localIndexer.count(nullptr, 10) << "\n\r" << termcolor::reset;
     //std::cout << termcolor::white << "remote index size: " << remoteIndexer.count(nullptr, 10) << "\n\r" << termcolor::reset;
@@ -375,7 +403,7 @@ int IndexPayloadCmd::execute(std::map<std::string, std::string> &args)
     std::cout << termcolor::cyan << "Exporting Sync commands." << "\r\n" << termcolor::reset;
 
     SyncCommands syncCommands;
-    localIndexer.sync(nullptr, lastRunIndexer, &remoteIndexer, lastRunRemoteIndexer, syncCommands, true, false);
+    localIndexer.sync(nullptr, lastRunIndexer.get(), remoteIndexer.get(), lastRunRemoteIndexer.get(), syncCommands, true, false);
 
     if (syncCommands.empty())
     {
@@ -403,36 +431,28 @@ int IndexPayloadCmd::execute(std::map<std::string, std::string> &args)
         return 0;
     }
 
-    // Need to put the removals in a list since it invalidates the iterator
-    // when we remove elements from syncCommands
-    // This is necessary to avoid modifying the list while iterating over it
-    std::list <SyncCommand> commandsToRemove;
-
-    for (const auto& path : remoteDeletions) {
-        for (auto &command : syncCommands)
-        {
-            if (command.path1() == "\""+path+"\"")
-            {
-                commandsToRemove.push_back(command);
-                std::cout << termcolor::magenta << "Removing command because of deleted file: " << command.string() << "\r\n" << termcolor::reset;
-            }
-        }
-    }
-    for (const auto& path : localDeletions) {
-        for (auto &command : syncCommands)
+    // Drop the commands on paths deleted since the last run, either side's deletion log
+    // looked up by path in one pass over the plan
+    std::unordered_set<std::string_view> deletedPaths;
+    deletedPaths.reserve(remoteDeletions.size() + localDeletions.size());
+    deletedPaths.insert(remoteDeletions.begin(), remoteDeletions.end());
+    deletedPaths.insert(localDeletions.begin(), localDeletions.end());
+    if (!deletedPaths.empty())
+    {
+        for (auto command = syncCommands.begin(); command != syncCommands.end();)
         {
-            if (command.path1() == "\""+path+"\"")
+            // the paths of a command are kept quoted
+            const std::string_view path = command->path1();
+            if (path.size() < 2 || path.front() != '"' || path.back() != '"' ||
+                !deletedPaths.contains(path.substr(1, path.size() - 2)))
             {
-                commandsToRemove.push_back(command);
-                std::cout << termcolor::magenta << "Removing command because of deleted file: " << command.string() << "\r\n" << termcolor::reset;
+                ++command;
+                continue;
             }
+            std::cout << termcolor::magenta << "Removing command because of deleted file: " << command->string() << "\r\n" << termcolor::reset;
+            command = syncCommands.erase(command);
         }
     }
-     // Remove the commands that match the deletions
-    for (const auto& command : commandsToRemove)
-    {
-        syncCommands.remove(command);
-    }
 
     // Sort the commands based on their priority
     // This will ensure that file creation commands are executed before deletions
@@ -527,17 +547,8 @@ int IndexPayloadCmd::execute(std::map<std::string, std::string> &args)
         }
     }
 
-    if (lastRunIndexer != nullptr)
-    {
-        delete lastRunIndexer;
-        lastRunIndexer = nullptr;
-    }
-
-    if (lastRunRemoteIndexer != nullptr)
-    {
-        delete lastRunRemoteIndexer;
-        lastRunRemoteIndexer = nullptr;
-    }
+    lastRunIndexer.reset();
+    lastRunRemoteIndexer.reset();
 
     // Finally, store the local index after sync completion
     std::cout << termcolor::cyan << "Storing local index after sync" << "\r\n" << termcolor::reset;
@@ -0,0 +1,161 @@
+// Section 1: Main Header
+#include "work_stealing_pool.h"
+
+// Section 2: Includes
+#include <chrono>
+#include <utility>
+
+// Section 3: Defines and Macros
+constexpr auto IDLE_POLL_INTERVAL = std::chrono::milliseconds(1);
+
+// Section 4: Static Variables
+static thread_local const WorkStealingPool *tlsPool = nullptr;
+static thread_local size_t tlsQueue = 0;
+
+// Section 5: Constructors and Destructors
+WorkStealingPool::WorkStealingPool(unsigned threads)
+{
+    if ( threads == 0 )
+        threads = 1;
+
+    for ( unsigned i = 0; i < threads; ++i )
+        mQueues.emplace_back(std::make_unique<WorkerQueue>());
+
+    // the calling thread works from queue 0 while it waits, the workers own the others
+    for ( unsigned i = 1; i < threads; ++i )
+        mThreads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    mQuit = true;
+    {
+        const std::lock_guard<std::mutex> lock(mIdleMutex);
+    }
+    mIdleCondition.notify_all();
+    for ( auto &thread : mThreads )
+        thread.join();
+}
+
+// Section 6: Static Methods
+// (none)
+
+// Section 7: Public/Protected/Private Methods
+void WorkStealingPool::submit(TaskGroup &group, Task task)
+{
+    group.mPending.fetch_add(1, std::memory_order_relaxed);
+    {
+        WorkerQueue &queue = *mQueues[currentQueue()];
+        const std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ .task = std::move(task), .group = &group });
+    }
+    mQueued.fetch_add(1, std::memory_order_release);
+    {
+        const std::lock_guard<std::mutex> lock(mIdleMutex);
+    }
+    mIdleCondition.notify_one();
+}
+
+void WorkStealingPool::wait(TaskGroup &group)
+{
+    while ( group.mPending.load(std::memory_order_acquire) != 0 )
+    {
+        if ( tryRunOne(currentQueue()) )
+            continue;
+
+        std::unique_lock<std::mutex> lock(mIdleMutex);
+        mIdleCondition.wait_for(lock, IDLE_POLL_INTERVAL, [&] {
+            return group.mPending.load(std::memory_order_acquire) == 0 || mQueued.load(std::memory_order_acquire) != 0;
+        });
+    }
+
+    const std::lock_guard<std::mutex> lock(group.mErrorMutex);
+    if ( group.mError )
+        std::rethrow_exception(std::exchange(group.mError, nullptr));
+}
+
+void WorkStealingPool::workerLoop(size_t index)
+{
+    tlsPool = this;
+    tlsQueue = index;
+
+    while ( !mQuit.load(std::memory_order_acquire) )
+    {
+        if ( tryRunOne(index) )
+            continue;
+
+        std::unique_lock<std::mutex> lock(mIdleMutex);
+        mIdleCondition.wait(lock, [this] {
+            return mQuit.load(std::memory_order_acquire) || mQueued.load(std::memory_order_acquire) != 0;
+        });
+    }
+}
+
+bool WorkStealingPool::tryRunOne(size_t self)
+{
+    QueuedTask queued;
+    if ( !popLocal(self, queued) && !steal(self, queued) )
+        return false;
+
+    mQueued.fetch_sub(1, std::memory_order_acq_rel);
+    run(queued);
+    return true;
+}
+
+bool WorkStealingPool::popLocal(size_t self, QueuedTask &out)
+{
+    WorkerQueue &queue = *mQueues[self];
+    const std::lock_guard<std::mutex> lock(queue.mutex);
+    if ( queue.tasks.empty() )
+        return false;
+
+    // newest first, keeps the owner working depth first on what it just split off
+    out = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(size_t self, QueuedTask &out)
+{
+    for ( size_t i = 1; i < mQueues.size(); ++i )
+    {
+        WorkerQueue &victim = *mQueues[(self + i) % mQueues.size()];
+        const std::lock_guard<std::mutex> lock(victim.mutex);
+        if ( victim.tasks.empty() )
+            continue;
+
+        // oldest first, those are the biggest pieces of work still unsplit
+        out = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::run(QueuedTask &queued)
+{
+    TaskGroup &group = *queued.group;
+    try
+    {
+        queued.task();
+    }
+    catch (...)
+    {
+        const std::lock_guard<std::mutex> lock(group.mErrorMutex);
+        if ( !group.mError )
+            group.mError = std::current_exception();
+    }
+
+    if ( group.mPending.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mIdleMutex);
+        }
+        mIdleCondition.notify_all();
+    }
+}
+
+size_t WorkStealingPool::currentQueue() const
+{
+    return tlsPool == this ? tlsQueue : 0;
+}
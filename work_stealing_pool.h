@@ -0,0 +1,106 @@
+// Section 1: Compilation Guards
+#ifndef _WORK_STEALING_POOL_H_
+#define _WORK_STEALING_POOL_H_
+
+// Section 2: Includes
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Section 3: Defines and Macros
+// (none)
+
+// Section 4: Classes
+/**
+ * Fixed-size thread pool where every worker owns a task deque.
+ * Workers pop their own tasks LIFO (depth first) and steal FIFO from the
+ * other workers when they run dry. Threads waiting on a TaskGroup help
+ * execute queued tasks, so nested fork/join never deadlocks.
+ */
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * Set of tasks that can be waited on together
+     */
+    class TaskGroup {
+    public:
+        TaskGroup() = default;
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+    private:
+        friend class WorkStealingPool;
+        std::atomic<size_t> mPending{0};
+        std::mutex mErrorMutex;
+        std::exception_ptr mError;
+    };
+
+    /**
+     * Creates the pool
+     * @param threads Total number of threads taking part in the work, including the waiting caller
+     */
+    explicit WorkStealingPool(unsigned threads);
+
+    /**
+     * Stops and joins all worker threads
+     */
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+     * Queues a task on the calling worker's deque (or the shared deque for outside threads)
+     * @param group Group the task belongs to
+     * @param task Task to execute
+     */
+    void submit(TaskGroup &group, Task task);
+
+    /**
+     * Runs queued tasks until every task of the group has completed.
+     * Rethrows the first exception thrown by a task of the group.
+     * @param group Group to wait for
+     */
+    void wait(TaskGroup &group);
+
+    /**
+     * Gets the number of threads taking part in the work
+     * @return Thread count, including the waiting caller
+     */
+    [[nodiscard]] unsigned size() const { return static_cast<unsigned>(mThreads.size() + 1); }
+
+private:
+    struct QueuedTask {
+        Task task;
+        TaskGroup *group;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<QueuedTask> tasks;
+    };
+
+    void workerLoop(size_t index);
+    bool tryRunOne(size_t self);
+    bool popLocal(size_t self, QueuedTask &out);
+    bool steal(size_t self, QueuedTask &out);
+    void run(QueuedTask &queued);
+    size_t currentQueue() const;
+
+    std::vector<std::unique_ptr<WorkerQueue>> mQueues;   ///< Index 0 is shared by threads outside the pool
+    std::vector<std::thread> mThreads;
+    std::atomic<bool> mQuit{false};
+    std::atomic<size_t> mQueued{0};
+    std::mutex mIdleMutex;
+    std::condition_variable mIdleCondition;
+};
+
+#endif // _WORK_STEALING_POOL_H_